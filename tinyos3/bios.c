@@ -39,8 +39,11 @@
 
 /*
 	Per-core data.
+
+	Each Core is cache-line aligned, since it is accessed by other threads
+	(the PIC thread and other cores raise interrupts to it).
  */
-typedef struct core
+typedef struct __cacheline_aligned core
 {
 	uint id;
 	interrupt_handler* bootfunc;
@@ -52,9 +55,16 @@ typedef struct core
 	volatile uint32_t intr_pending;
 	interrupt_handler* intvec[maximum_interrupt_no];
 
+} Core;
+
 
 #if defined(CORE_STATISTICS)
-	/* Statistics */
+/*
+	Per-core statistics. These are kept apart from the Core, so that updating
+	them does not invalidate the cache lines used to deliver interrupts.
+ */
+typedef struct __cacheline_aligned core_statistics
+{
 	volatile uintptr_t irq_count;
 	volatile uintptr_t irq_raised[maximum_interrupt_no];
 	volatile uintptr_t irq_delivered[maximum_interrupt_no];
@@ -62,9 +72,13 @@ typedef struct core
 	volatile uintptr_t rst_count;
 	volatile TimerDuration hlt_time;
 	volatile TimerDuration run_time;
-#endif
+} CoreStatistics;
 
-} Core;
+static CoreStatistics CORE_STATS[MAX_CORES];
+
+/* The statistics of a Core */
+#define STATS(core) (CORE_STATS[(core)->id])
+#endif
 
 
 /* Used to store the set of core threads' signal mask */
@@ -299,7 +313,7 @@ static inline void raise_interrupt(Core* core, Interrupt intno)
 	if(! intr_fetch_set(core, intno) ) {
 
 #if defined(CORE_STATISTICS)
-		core->irq_raised[intno] ++;
+		STATS(core).irq_raised[intno] ++;
 #endif
 
 		interrupt_core(core);
@@ -324,7 +338,7 @@ static inline void dispatch_interrupts(Core* core)
 	
 		assert(0 <= irq  && irq < maximum_interrupt_no);
 #if defined(CORE_STATISTICS)
-		core->irq_delivered[irq]++;
+		STATS(core).irq_delivered[irq]++;
 #endif
 		interrupt_handler* handler =  core->intvec[irq];
 		if(handler != NULL) handler();
@@ -350,7 +364,7 @@ static void sigusr1_handler(int signo, siginfo_t* si, void* ctx)
 	Core* core = & CORE[si->si_value.sival_int];
 
 #if defined(CORE_STATISTICS)
-	core->irq_count++;
+	STATS(core).irq_count++;
 #endif
 
 	dispatch_interrupts(core);
@@ -909,14 +923,14 @@ void vm_run(vm_config* vmc)
 
 #if defined(CORE_STATISTICS)
 		/* Initialize Core statistics */
-		CORE[c].irq_count = 0;
+		CORE_STATS[c].irq_count = 0;
 		for(uint intno=0; intno<maximum_interrupt_no;intno++) {
-			CORE[c].irq_delivered[intno] = 0;
-			CORE[c].irq_raised[intno] = 0;
-			CORE[c].hlt_count = 0;
-			CORE[c].rst_count = 0;
-			CORE[c].hlt_time = 0;
-			CORE[c].run_time = get_coarse_time();
+			CORE_STATS[c].irq_delivered[intno] = 0;
+			CORE_STATS[c].irq_raised[intno] = 0;
+			CORE_STATS[c].hlt_count = 0;
+			CORE_STATS[c].rst_count = 0;
+			CORE_STATS[c].hlt_time = 0;
+			CORE_STATS[c].run_time = get_coarse_time();
 		}
 #endif
 
@@ -938,7 +952,7 @@ void vm_run(vm_config* vmc)
 		CHECKRC(pthread_join(CORE[c].thread, NULL));
 
 #if defined(CORE_STATISTICS)
-		CORE[c].run_time = get_coarse_time() - CORE[c].run_time;
+		CORE_STATS[c].run_time = get_coarse_time() - CORE_STATS[c].run_time;
 #endif
 	}
 
@@ -964,12 +978,12 @@ void vm_run(vm_config* vmc)
 	double total_util = 0.0;
 	for(uint c=0; c < vmc->cores; c++) {
 		fprintf(stderr,"Core %3d: irq_count=%6tu. deliv(raised):  ",
-			c, CORE[c].irq_count);
+			c, CORE_STATS[c].irq_count);
 		for(uint i=0;i<maximum_interrupt_no;i++) 
-			fprintf(stderr," %tu(%tu)",CORE[c].irq_delivered[i], CORE[c].irq_raised[i]);
-		fprintf(stderr, "  hlt(rst): %tu(%tu)", CORE[c].hlt_count, CORE[c].rst_count);
-		fprintf(stderr, "  hltt: %2.3lf", 1E-6*CORE[c].hlt_time);
-		double util = 100.0 - 100.0 * CORE[c].hlt_time / (double)CORE[c].run_time ;
+			fprintf(stderr," %tu(%tu)",CORE_STATS[c].irq_delivered[i], CORE_STATS[c].irq_raised[i]);
+		fprintf(stderr, "  hlt(rst): %tu(%tu)", CORE_STATS[c].hlt_count, CORE_STATS[c].rst_count);
+		fprintf(stderr, "  hltt: %2.3lf", 1E-6*CORE_STATS[c].hlt_time);
+		double util = 100.0 - 100.0 * CORE_STATS[c].hlt_time / (double)CORE_STATS[c].run_time ;
 		total_util += util;
 		fprintf(stderr, "  util %%: %3.2lf", util);		
 		fprintf(stderr,"\n");
@@ -1007,7 +1021,7 @@ void cpu_core_halt()
 	__atomic_fetch_or(& halt_vector, cmask, __ATOMIC_RELAXED);
 
 #if defined(CORE_STATISTICS)
-	core->hlt_count ++;
+	STATS(core).hlt_count ++;
 #endif
 
 	siginfo_t info;
@@ -1027,7 +1041,7 @@ void cpu_core_halt()
 
 #if defined(CORE_STATISTICS)
 	/* Unset halt bit */
-	core->hlt_time += get_coarse_time()-stime0;
+	STATS(core).hlt_time += get_coarse_time()-stime0;
 #endif
 
 	__atomic_fetch_and(& halt_vector, ~cmask, __ATOMIC_RELAXED);
@@ -1043,7 +1057,7 @@ static int __core_restart(uint c)
 	if( prevhv & cmask ) {
 		interrupt_core(CORE+c);
 #if defined(CORE_STATISTICS)		
-		__atomic_fetch_add(& CORE[c].rst_count, 1 , __ATOMIC_RELAXED);
+		__atomic_fetch_add(& CORE_STATS[c].rst_count, 1 , __ATOMIC_RELAXED);
 #endif
 
 		return 1;
@@ -303,6 +303,69 @@ extern _Thread_local uint cpu_core_id;
 uint cpu_cores();
 
 
+/**
+	@brief The size of a cache line, in bytes.
+ */
+#define CACHE_LINE_SIZE 64
+
+/**
+	@brief Align a structure or variable to a cache line.
+
+	Data that is written by one core should not share a cache line with data
+	used by other cores; else, the cores keep invalidating each other's
+	cache (false sharing). Per-core data should be declared as follows:
+	@code
+	typedef struct __cacheline_aligned my_percore_data { ... } my_percore_data;
+	my_percore_data per_core[MAX_CORES];
+	@endcode
+ */
+#define __cacheline_aligned __attribute__((aligned(CACHE_LINE_SIZE)))
+
+
+/**
+	@brief A per-core counter.
+
+	Each core updates its own slot, in its own cache line, so that updating
+	the counter causes no traffic between cores. The value of the counter is
+	the sum of all slots, computed only when someone reads it.
+
+	A thread may migrate to another core while adding to a counter, so the
+	slots are updated atomically; but the cache line is normally owned by the
+	updating core, so this is cheap.
+
+	A per-core counter is zero-initialized, e.g., 
+	@code
+	static percore_counter my_counter;
+	@endcode
+
+	@see percore_add
+	@see percore_read
+ */
+typedef struct percore_counter {
+	struct __cacheline_aligned { unsigned long value; } slot[MAX_CORES];
+} percore_counter;
+
+/** @brief Add @c v to the slot of the current core. */
+static inline void percore_add(percore_counter* c, unsigned long v)
+{
+	__atomic_fetch_add(& c->slot[cpu_core_id].value, v, __ATOMIC_RELEASE);
+}
+
+/** @brief Return the sum of all slots of a per-core counter. 
+
+	The slots are not read atomically with respect to each other; for 
+	monotonic counters, the result lies between the values of the counter at
+	the start and at the end of the call.
+*/
+static inline unsigned long percore_read(percore_counter* c)
+{
+	unsigned long sum = 0;
+	for(unsigned int i=0; i<MAX_CORES; i++)
+		sum += __atomic_load_n(& c->slot[i].value, __ATOMIC_ACQUIRE);
+	return sum;
+}
+
+
 /**
 	@brief Barrier synchronization for all cores.
 
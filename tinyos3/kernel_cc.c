@@ -19,6 +19,47 @@
   */
 
 
+/* Statements that are only compiled for lock profiling */
+#ifdef LOCK_PROFILING
+#define PROF(stmt) stmt
+#else
+#define PROF(stmt)
+#endif
+
+
+/*
+	Wait sets.
+
+	Mutexes, barriers and semaphores keep their waiters in a ring without
+	a head node, whose first node is pointed to by a @c waitset field.
+	The ring nodes are stored in the stacks of the sleeping threads.
+*/
+
+/**
+   @internal
+   Append a node to the back of a waitset ring.
+ */
+static inline void waitset_push(void** waitset, rlnode* node)
+{
+	if(*waitset)
+		rlist_push_back((rlnode*) *waitset, node);
+	else
+		*waitset = node;
+}
+
+/**
+   @internal
+   Remove a node from a waitset ring.
+ */
+static inline void waitset_remove(void** waitset, rlnode* node)
+{
+	if(*waitset == node)
+		*waitset = (node->next == node) ? NULL : node->next;
+	rlist_remove(node);
+}
+
+
+
 /*
  	Pre-emption aware mutex.
  	-------------------------
@@ -32,32 +73,97 @@
  	The implementation is based on GCC atomics, as the standard C11 primitives
  	are not supported by all recent compilers. Eventually, this will change.
  */
-void Mutex_Lock(Mutex* lock)
+static inline void mutex_lock(Mutex* mx, const char* site)
 {
 #define MUTEX_SPINS (cpu_cores()>1 ?  1000 : 10000)
+  PROF(unsigned long t0 = 0; unsigned long spins = 0; unsigned long yields = 0;)
 
-  while(__atomic_test_and_set(lock,__ATOMIC_ACQUIRE)) {
+  while(__atomic_test_and_set(&mx->lock,__ATOMIC_ACQUIRE)) {
+    PROF(if(t0==0) t0 = lockprof_clock();)
     int spin=MUTEX_SPINS;
-    while(__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+    while(__atomic_load_n(&mx->lock, __ATOMIC_RELAXED)) {
 #if defined(__x86__) || defined(__x86_64__)
       __builtin_ia32_pause();
 #endif
+      PROF(spins++;)
       if(spin>0) 
       	spin--; 
       else { 
       	spin=MUTEX_SPINS; 
-      	if(cpu_interrupts_enabled())
+      	if(cpu_interrupts_enabled()) {
+      		PROF(yields++;)
       		yield(SCHED_MUTEX); 
+      	}
       }
     }
   }
+  PROF(lockprof_mutex_acquired(mx, site, t0, spins, yields);)
 #undef MUTEX_SPINS
 }
 
+void (Mutex_Lock)(Mutex* mx)
+{
+	mutex_lock(mx, __FUNCTION__);
+}
+
+#ifdef LOCK_PROFILING
+void Mutex_Lock_at(Mutex* mx, const char* site)
+{
+	mutex_lock(mx, site);
+}
+#endif
+
+
+/*
+	The mutex wait queue.
+
+	It holds condition waiters that were signalled while the mutex was
+	locked (see cv_signal below). It is protected by @c waitq_lock, which 
+	is a pure spinlock held with preemption off, for a few instructions.
+	Since the wait queue is only used on contention, the cost of turning
+	preemption off is not paid by uncontended mutexes.
+ */
+static inline int waitq_lock(Mutex* mx)
+{
+	int preempt = preempt_off;
+	while(__atomic_test_and_set(&mx->waitq_lock, __ATOMIC_ACQUIRE)) {
+#if defined(__x86__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#endif
+	}
+	return preempt;
+}
+
+static inline void waitq_unlock(Mutex* mx, int preempt)
+{
+	__atomic_clear(&mx->waitq_lock, __ATOMIC_RELEASE);
+	if(preempt) preempt_on;
+}
+
+static void mutex_wakeup(Mutex* mx);
+
 
-void Mutex_Unlock(Mutex* lock)
+void Mutex_Unlock(Mutex* mx)
 {
-  __atomic_clear(lock, __ATOMIC_RELEASE);
+	PROF(lockprof_mutex_released(mx);)
+
+	/*
+		Only a mutex that has been used with a condition variable can have 
+		requeued waiters. The flag is set by a holder of the mutex, so we 
+		see it before we unlock. Other mutexes (e.g., the kernel spinlocks)
+		skip the fence.
+	 */
+	int cond_waits = mx->cond_waits;
+	__atomic_clear(&mx->lock, __ATOMIC_RELEASE);
+	if(! cond_waits) return;
+
+	/* 
+		Pairs with the fence in mutex_requeue: either we see the requeued
+		waiter, or the requeuer sees the mutex unlocked.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&mx->waitq, __ATOMIC_RELAXED))
+		mutex_wakeup(mx);
 }
 
 
@@ -70,12 +176,83 @@ void Mutex_Unlock(Mutex* lock)
 typedef struct __cv_waiter {
 	rlnode node;				/* become part of a ring */
 	TCB* thread;				/* thread to wait */
+	Mutex* mutex;				/* the mutex to reacquire */
 	sig_atomic_t signalled;		/* this is set if the thread is signalled */
 	sig_atomic_t removed;		/* this is set if the waiter is removed 
 								   from the ring */
+	sig_atomic_t requeued;		/* this is set if the waiter is moved to
+								   the mutex wait queue */
+	sig_atomic_t dequeued;		/* this is set if the waiter was woken up
+								   from the mutex wait queue */
 } __cv_waiter;
 /** \endcond */
 
+
+/**
+   @internal
+   Wake up the first waiter of the wait queue of the mutex, if the mutex
+   is free. The waiter competes for the mutex like any other thread. If
+   someone else got the mutex first, it will wake up the waiter when it
+   unlocks.
+
+   The mutex is not handed over to the waiter: when many threads are 
+   ready, the waiter may have to wait for a long time before it runs, and
+   holding the mutex on its behalf would stall every other thread.
+ */
+static void mutex_wakeup(Mutex* mx)
+{
+	int preempt = waitq_lock(mx);
+	if(mx->waitq && ! __atomic_load_n(&mx->lock, __ATOMIC_RELAXED)) {
+		__cv_waiter* waiter = mx->waitq;
+		waitset_remove(&mx->waitq, &waiter->node);
+		waiter->dequeued = 1;
+		/* The waiter may have timed out already, but it cannot leave
+		   before we release the wait queue */
+		wakeup(waiter->thread);
+	}
+	waitq_unlock(mx, preempt);
+}
+
+
+/**
+   @internal
+   Move a signalled waiter to the wait queue of its mutex, instead of
+   waking it up. This is only done if the mutex is locked; else, the 
+   function returns 0 and the caller should wake up the waiter.
+ */
+static int mutex_requeue(Mutex* mx, __cv_waiter* waiter)
+{
+	if(! __atomic_load_n(&mx->lock, __ATOMIC_RELAXED))
+		return 0;
+
+	int preempt = waitq_lock(mx);
+	waitset_push(&mx->waitq, &waiter->node);
+	waiter->requeued = 1;
+	waitq_unlock(mx, preempt);
+
+	/* The mutex may have been unlocked before the waiter was queued */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(! __atomic_load_n(&mx->lock, __ATOMIC_RELAXED))
+		mutex_wakeup(mx);
+	return 1;
+}
+
+
+/**
+   @internal
+   Called by a requeued waiter that woke up. If the waiter is still 
+   in the wait queue of the mutex (this happens on timeout), it is 
+   removed.
+ */
+static void mutex_unqueue(Mutex* mx, __cv_waiter* waiter)
+{
+	int preempt = waitq_lock(mx);
+	if(! waiter->dequeued)
+		waitset_remove(&mx->waitq, &waiter->node);
+	waitq_unlock(mx, preempt);
+}
+
+
 /**
    @internal
    A helper routine to remove a condition waiter from the CondVar ring.
@@ -106,12 +283,16 @@ static inline void remove_from_ring(CondVar* cv, __cv_waiter* w)
   When the thread is woken up later (by another thread that calls @c 
   Cond_Signal or @c Cond_Broadcast, or because the timeout has expired, or
   because the thread was awoken by another kernel routine), 
-  it first re-locks the mutex and then returns.  
+  it first re-locks the mutex and then returns. If the thread was
+  requeued on the mutex by the signaller, it is woken up when the mutex
+  is unlocked.
 
   @param mx The mutex to be unlocked as the thread sleeps.
   @param cv The condition variable to sleep on.
   @param cause A cause provided to the kernel scheduler.
   @param timeout The time to sleep, or @c NO_TIMEOUT to sleep for ever.
+  @param site The lock site of the call, for lock profiling, and the wait
+     channel of the sleep.
 
   @returns 1 if this thread was woken up by signal/broadcast, 0 otherwise
 
@@ -119,11 +300,16 @@ static inline void remove_from_ring(CondVar* cv, __cv_waiter* w)
   @see Cond_Broadcast
   */
 static int cv_wait(Mutex* mutex, CondVar* cv, 
-		enum SCHED_CAUSE cause, TimerDuration timeout)
+		enum SCHED_CAUSE cause, TimerDuration timeout, const char* site)
 {
-	__cv_waiter waiter = { .thread=cur_thread(), .signalled = 0, .removed=0 };
+	PROF(unsigned long t0 = lockprof_clock();)
+	__cv_waiter waiter = { .thread=cur_thread(), .mutex=mutex, 
+		.signalled = 0, .removed=0, .requeued=0, .dequeued=0 };
 	rlnode_init(& waiter.node, &waiter);
 
+	/* From now on, unlocking the mutex must look for requeued waiters */
+	mutex->cond_waits = 1;
+
 	Mutex_Lock(&(cv->waitset_lock));
 	/* We just push the current thread to the back of the list */
 	if(cv->waitset) {
@@ -135,7 +321,7 @@ static int cv_wait(Mutex* mutex, CondVar* cv,
 
 	/* Now atomically release mutex and sleep */
 	Mutex_Unlock(mutex);
-	sleep_releasing(STOPPED, &(cv->waitset_lock), cause, timeout);
+	sleep_releasing(STOPPED, &(cv->waitset_lock), cause, site, timeout);
 
 	/* Woke up, we must check wether we were signaled, and tidy up */
 	Mutex_Lock(&(cv->waitset_lock));
@@ -146,17 +332,82 @@ static int cv_wait(Mutex* mutex, CondVar* cv,
 		remove_from_ring(cv, &waiter);
 	}
 	Mutex_Unlock(&(cv->waitset_lock));
+	PROF(lockprof_cond_wait(site, t0, waiter.signalled);)
 
-	Mutex_Lock(mutex);
+	/* If we were requeued, we must leave the wait queue of the mutex */
+	if(waiter.requeued)
+		mutex_unqueue(mutex, &waiter);
+
+	mutex_lock(mutex, site);
 	return waiter.signalled;
 }
 
 
+/** 
+   @internal
+   @brief Wait on many condition variables at once.
+
+   This is like @c cv_wait, but the thread is queued on every condition 
+   variable of @c cvs, and wakes up when any of them is signalled. Unlike 
+   @c cv_wait, the mutex is kept locked until the thread is asleep: a 
+   signal that arrives while the thread is queued on the rest of the 
+   condition variables finds the mutex locked, and requeues the waiter on 
+   it, so that the thread is woken up as soon as it releases the mutex.
+
+   The condition variables must be distinct.
+
+  @returns 1 if this thread was woken up by signal/broadcast, 0 otherwise
+  */
+static int cv_wait_any(Mutex* mutex, CondVar** cvs, unsigned int n,
+		enum SCHED_CAUSE cause, TimerDuration timeout, const char* site)
+{
+	__cv_waiter local[8];
+	__cv_waiter* waiter = (n <= 8) ? local : xmalloc(n*sizeof(__cv_waiter));
+	mutex->cond_waits = 1;
+
+	for(unsigned int i=0; i<n; i++) {
+		waiter[i] = (__cv_waiter){ .thread=cur_thread(), .mutex=mutex, 
+			.signalled = 0, .removed=0, .requeued=0, .dequeued=0 };
+		rlnode_init(& waiter[i].node, &waiter[i]);
+
+		Mutex_Lock(&(cvs[i]->waitset_lock));
+		if(cvs[i]->waitset) {
+			__cv_waiter* wset = cvs[i]->waitset;
+			rlist_push_back(& wset->node, & waiter[i].node);
+		} else
+			cvs[i]->waitset = &waiter[i];
+		Mutex_Unlock(&(cvs[i]->waitset_lock));
+	}
+
+	sleep_releasing(STOPPED, mutex, cause, site, timeout);
+
+	int signalled = 0;
+	for(unsigned int i=0; i<n; i++) {
+		Mutex_Lock(&(cvs[i]->waitset_lock));
+		if(! waiter[i].removed)
+			remove_from_ring(cvs[i], &waiter[i]);
+		Mutex_Unlock(&(cvs[i]->waitset_lock));
+
+		if(waiter[i].requeued)
+			mutex_unqueue(mutex, &waiter[i]);
+		signalled |= waiter[i].signalled;
+	}
+
+	if(waiter != local) free(waiter);
+
+	mutex_lock(mutex, site);
+	return signalled;
+}
+
+
 /**
   @internal
   Helper for Cond_Signal and Cond_Broadcast. This method 
   will actually find a waiter to signal, if one exists. 
   Else, it leaves the cv->waitset == NULL.
+
+  A waiter whose mutex is locked is requeued on the mutex, as it would 
+  only wake up to block on it. 
  */
 static inline void cv_signal(CondVar* cv)
 {
@@ -165,40 +416,193 @@ static inline void cv_signal(CondVar* cv)
 		__cv_waiter* waiter = cv->waitset;
 		remove_from_ring(cv, waiter);
 		waiter->removed = 1;
-		if(wakeup(waiter->thread)) {
-			waiter->signalled = 1;
+		waiter->signalled = 1;
+		if(mutex_requeue(waiter->mutex, waiter) || wakeup(waiter->thread))
 			return;
-		}
+		waiter->signalled = 0;
 	}
 }
 
 
 
-int Cond_Wait(Mutex* mutex, CondVar* cv)
+static inline void cond_signal(CondVar* cv, const char* site)
 {
-	return cv_wait(mutex, cv, SCHED_USER, NO_TIMEOUT);
+  PROF(lockprof_cond_signal(site);)
+  Mutex_Lock(&(cv->waitset_lock));
+  cv_signal(cv);
+  Mutex_Unlock(&(cv->waitset_lock));
 }
 
-int Cond_TimedWait(Mutex* mutex, CondVar* cv, timeout_t timeout)
+static inline void cond_broadcast(CondVar* cv, const char* site)
+{
+  PROF(lockprof_cond_signal(site);)
+  Mutex_Lock(&(cv->waitset_lock));
+  while(cv->waitset) cv_signal(cv);
+  Mutex_Unlock(&(cv->waitset_lock));
+}
+
+
+int (Cond_Wait)(Mutex* mutex, CondVar* cv)
+{
+	return cv_wait(mutex, cv, SCHED_USER, NO_TIMEOUT, __FUNCTION__);
+}
+
+int (Cond_TimedWait)(Mutex* mutex, CondVar* cv, timeout_t timeout)
 {
 	/* We have to translate timeout from msec to usec */
-	return cv_wait(mutex, cv, SCHED_USER, timeout*1000ul);
+	return cv_wait(mutex, cv, SCHED_USER, timeout*1000ul, __FUNCTION__);
 }
 
+void (Cond_Signal)(CondVar* cv)
+{
+	cond_signal(cv, __FUNCTION__);
+}
 
-void Cond_Signal(CondVar* cv)
+void (Cond_Broadcast)(CondVar* cv)
 {
-  Mutex_Lock(&(cv->waitset_lock));
-  cv_signal(cv);
-  Mutex_Unlock(&(cv->waitset_lock));
+	cond_broadcast(cv, __FUNCTION__);
 }
 
 
-void Cond_Broadcast(CondVar* cv)
+#ifdef LOCK_PROFILING
+int Cond_Wait_at(Mutex* mutex, CondVar* cv, const char* site)
 {
-  Mutex_Lock(&(cv->waitset_lock));
-  while(cv->waitset) cv_signal(cv);
-  Mutex_Unlock(&(cv->waitset_lock));
+	return cv_wait(mutex, cv, SCHED_USER, NO_TIMEOUT, site);
+}
+
+int Cond_TimedWait_at(Mutex* mutex, CondVar* cv, timeout_t timeout, const char* site)
+{
+	return cv_wait(mutex, cv, SCHED_USER, timeout*1000ul, site);
+}
+
+void Cond_Signal_at(CondVar* cv, const char* site)
+{
+	cond_signal(cv, site);
+}
+
+void Cond_Broadcast_at(CondVar* cv, const char* site)
+{
+	cond_broadcast(cv, site);
+}
+#endif
+
+
+
+/*
+	Barriers and semaphores.
+
+	Each node of their waitset ring is keyed by the TCB of a sleeping thread.
+*/
+
+void Barrier_Sync(Barrier* bar, unsigned int n)
+{
+	assert(n>0);
+	Mutex_Lock(& bar->lock);
+	assert(bar->count < n);
+
+	unsigned int epoch = bar->epoch;
+
+	if(++bar->count == n) {
+		/* Last to arrive: grab the whole waitset and start a new episode */
+		rlnode released;
+		rlnode_init(&released, NULL);
+		if(bar->waitset)
+			rlist_push_back(&released, (rlnode*) bar->waitset);
+		bar->waitset = NULL;
+		bar->count = 0;
+		__atomic_store_n(&bar->epoch, epoch+1, __ATOMIC_RELEASE);
+		Mutex_Unlock(& bar->lock);
+
+		/* Release all waiters in one batch */
+		wakeup_all(&released);
+		return;
+	}
+
+	rlnode waiter;
+	rlnode_init(&waiter, cur_thread());
+	waitset_push(&bar->waitset, &waiter);
+
+	while(1) {
+		sleep_releasing(STOPPED, &bar->lock, SCHED_USER, __FUNCTION__, NO_TIMEOUT);
+
+		/* We do not need the lock to leave: the releaser has unlinked us */
+		if(__atomic_load_n(&bar->epoch, __ATOMIC_ACQUIRE) != epoch)
+			break;
+
+		/* Spurious wakeup, we are still in the waitset */
+		Mutex_Lock(& bar->lock);
+		if(bar->epoch != epoch) {
+			Mutex_Unlock(& bar->lock);
+			break;
+		}
+	}
+}
+
+
+/** \cond HELPER Helper structure for semaphores. */
+typedef struct __sem_waiter {
+	rlnode node;				/* become part of a ring, keyed by the thread */
+	int granted;				/* set when Sem_Post hands us a unit */
+} __sem_waiter;
+/** \endcond */
+
+/**
+   @internal
+   The basic implementation of the 'wait' operation on semaphores.
+   Returns 1 if the semaphore was decremented, 0 on timeout.
+ */
+static int sem_wait(Semaphore* sem, TimerDuration timeout)
+{
+	Mutex_Lock(& sem->lock);
+
+	if(sem->value > 0) {
+		sem->value--;
+		Mutex_Unlock(& sem->lock);
+		return 1;
+	}
+
+	__sem_waiter waiter = { .granted = 0 };
+	rlnode_init(& waiter.node, cur_thread());
+	waitset_push(& sem->waitset, & waiter.node);
+
+	do {
+		sleep_releasing(STOPPED, &sem->lock, SCHED_USER, __FUNCTION__, timeout);
+		Mutex_Lock(& sem->lock);
+	} while(! waiter.granted && timeout == NO_TIMEOUT);
+
+	/* On timeout, we are still in the waitset */
+	if(! waiter.granted)
+		waitset_remove(& sem->waitset, & waiter.node);
+
+	Mutex_Unlock(& sem->lock);
+	return waiter.granted;
+}
+
+
+void Sem_Wait(Semaphore* sem)
+{
+	sem_wait(sem, NO_TIMEOUT);
+}
+
+int Sem_TimedWait(Semaphore* sem, timeout_t timeout)
+{
+	/* We have to translate timeout from msec to usec */
+	return sem_wait(sem, timeout*1000ul);
+}
+
+void Sem_Post(Semaphore* sem)
+{
+	Mutex_Lock(& sem->lock);
+	if(sem->waitset) {
+		/* Hand the unit over to the first waiter */
+		__sem_waiter* waiter = sem->waitset;
+		waitset_remove(& sem->waitset, & waiter->node);
+		waiter->granted = 1;
+		wakeup(waiter->node.tcb);
+	} else {
+		sem->value++;
+	}
+	Mutex_Unlock(& sem->lock);
 }
 
 
@@ -231,19 +635,34 @@ static int kernel_sem = 1;
 /* Semaphore condition */
 static CondVar kernel_sem_cv = COND_INIT;
 
-void kernel_lock()
+static inline void kernel_lock_site(const char* site)
 {
-	Mutex_Lock(& kernel_mutex);
+	mutex_lock(& kernel_mutex, site);
+	PROF(unsigned long t0 = (kernel_sem<=0) ? lockprof_clock() : 0;)
 	while(kernel_sem<=0) {
-		Cond_Wait(& kernel_mutex, &kernel_sem_cv);
+		cv_wait(& kernel_mutex, &kernel_sem_cv, SCHED_USER, NO_TIMEOUT, site);
 	}
 	kernel_sem--;
+	PROF(lockprof_kernel_acquired(site, t0);)
 	Mutex_Unlock(& kernel_mutex);
 }
 
+void (kernel_lock)()
+{
+	kernel_lock_site(__FUNCTION__);
+}
+
+#ifdef LOCK_PROFILING
+void kernel_lock_at(const char* site)
+{
+	kernel_lock_site(site);
+}
+#endif
+
 void kernel_unlock()
 {
 	Mutex_Lock(& kernel_mutex);
+	PROF(lockprof_kernel_released();)
 	kernel_sem++;
 	Cond_Signal(&kernel_sem_cv);
 	Mutex_Unlock(& kernel_mutex);
@@ -254,26 +673,72 @@ int kernel_wait_wchan(CondVar* cv, enum SCHED_CAUSE cause,
 {
 	/* Atomically release kernel semaphore */
 	Mutex_Lock(& kernel_mutex);
+	PROF(lockprof_kernel_released();)
 	kernel_sem++;
 	Cond_Signal(&kernel_sem_cv);	
 
-	int ret = cv_wait(&kernel_mutex, cv, cause, timeout);
+	int ret = cv_wait(&kernel_mutex, cv, cause, timeout, wchan_name);
 
 	/* Reacquire kernel semaphore */
+	PROF(unsigned long t0 = (kernel_sem<=0) ? lockprof_clock() : 0;)
 	while(kernel_sem<=0)
-		Cond_Wait(& kernel_mutex, &kernel_sem_cv);
+		cv_wait(& kernel_mutex, &kernel_sem_cv, SCHED_USER, NO_TIMEOUT, wchan_name);
 	kernel_sem--;
+	PROF(lockprof_kernel_acquired(wchan_name, t0);)
 	Mutex_Unlock(& kernel_mutex);		
 
 	return ret;
 }
 
-void kernel_signal(CondVar* cv) 
+int kernel_wait_until_wchan(CondVar* cv, enum SCHED_CAUSE cause,
+	const char* wchan_name, TimerDuration deadline)
+{
+	if(deadline == NO_TIMEOUT) {
+		kernel_wait_wchan(cv, cause, wchan_name, NO_TIMEOUT);
+		return 1;
+	}
+
+	TimerDuration now = bios_clock();
+	if(now >= deadline) return 0;
+	kernel_wait_wchan(cv, cause, wchan_name, deadline-now);
+	return bios_clock() < deadline;
+}
+
+int kernel_wait_any_until_wchan(CondVar** cvs, unsigned int n, 
+	enum SCHED_CAUSE cause, const char* wchan, TimerDuration deadline)
+{
+	TimerDuration timeout = NO_TIMEOUT;
+	if(deadline != NO_TIMEOUT) {
+		TimerDuration now = bios_clock();
+		if(now >= deadline) return 0;
+		timeout = deadline - now;
+	}
+
+	/* Atomically release kernel semaphore */
+	Mutex_Lock(& kernel_mutex);
+	PROF(lockprof_kernel_released();)
+	kernel_sem++;
+	Cond_Signal(&kernel_sem_cv);	
+
+	cv_wait_any(&kernel_mutex, cvs, n, cause, timeout, wchan);
+
+	/* Reacquire kernel semaphore */
+	PROF(unsigned long t0 = (kernel_sem<=0) ? lockprof_clock() : 0;)
+	while(kernel_sem<=0)
+		cv_wait(& kernel_mutex, &kernel_sem_cv, SCHED_USER, NO_TIMEOUT, wchan);
+	kernel_sem--;
+	PROF(lockprof_kernel_acquired(wchan, t0);)
+	Mutex_Unlock(& kernel_mutex);		
+
+	return deadline == NO_TIMEOUT || bios_clock() < deadline;
+}
+
+void (kernel_signal)(CondVar* cv) 
 { 
 	Cond_Signal(cv); 
 }
 
-void kernel_broadcast(CondVar* cv) 
+void (kernel_broadcast)(CondVar* cv) 
 { 
 	Cond_Broadcast(cv); 
 }
@@ -281,9 +746,10 @@ void kernel_broadcast(CondVar* cv)
 void kernel_sleep(Thread_state newstate, enum SCHED_CAUSE cause)
 {
 	Mutex_Lock(& kernel_mutex);
+	PROF(lockprof_kernel_released();)
 	kernel_sem++;
 	Cond_Signal(&kernel_sem_cv);
-	sleep_releasing(newstate, &kernel_mutex, cause, NO_TIMEOUT);
+	sleep_releasing(newstate, &kernel_mutex, cause, __FUNCTION__, NO_TIMEOUT);
 }
 
 
@@ -49,6 +49,10 @@ void kernel_unlock();
 
 /**
 	@brief Wait on a condition variable using the kernel lock.
+
+	The wait channel @c wchan (the calling function, for @c kernel_wait)
+	is kept in the TCB while the thread sleeps, and is reported by
+	@c OpenThreadInfo.
 	@returns 1 if signalled, 0 if not
   */
 int kernel_wait_wchan(CondVar* cv, enum SCHED_CAUSE cause, 
@@ -59,6 +63,39 @@ int kernel_wait_wchan(CondVar* cv, enum SCHED_CAUSE cause,
 #define kernel_timedwait(cv, cause, timeout) \
 	kernel_wait_wchan((cv),(cause),__FUNCTION__, (timeout))
 
+/**
+	@brief Wait on a condition variable using the kernel lock, until a deadline.
+
+	This is meant for waiting in a loop, with a timeout for the whole loop.
+	The deadline is a time of @c bios_clock(), or @c NO_TIMEOUT.
+	@returns 1 if woken up before the deadline, 0 if the deadline has passed
+  */
+int kernel_wait_until_wchan(CondVar* cv, enum SCHED_CAUSE cause,
+	const char* wchan, TimerDuration deadline);
+
+#define kernel_wait_until(cv, cause, deadline) \
+	kernel_wait_until_wchan((cv),(cause),__FUNCTION__, (deadline))
+
+/**
+	@brief Wait on many condition variables using the kernel lock, until a deadline.
+
+	The thread sleeps until any of the @c n (distinct) condition variables of 
+	@c cvs is signalled, or the deadline passes. This is used by @c Poll to 
+	wait on the condition variables of many streams.
+	@returns 1 if woken up before the deadline, 0 if the deadline has passed
+  */
+int kernel_wait_any_until_wchan(CondVar** cvs, unsigned int n, 
+	enum SCHED_CAUSE cause, const char* wchan, TimerDuration deadline);
+
+#define kernel_wait_any_until(cvs, n, cause, deadline) \
+	kernel_wait_any_until_wchan((cvs),(n),(cause),__FUNCTION__, (deadline))
+
+/** @brief The deadline of a timeout of @c msec milliseconds from now. */
+static inline TimerDuration kernel_deadline(timeout_t msec)
+{
+	return bios_clock() + msec*1000ul;
+}
+
 /**
 	@brief Signal a kernel condition to one waiter.
 
@@ -71,6 +108,19 @@ void kernel_signal(CondVar* cv);
   */
 void kernel_broadcast(CondVar* cv);
 
+/**
+	@brief Check if any thread waits on a kernel condition.
+
+	A thread that waits with @c kernel_wait (or @c kernel_wait_any_until) 
+	is queued on the condition before the kernel lock is released. Therefore,
+	while we hold the kernel lock, this is exact, and a broadcast can be 
+	skipped when it returns 0.
+  */
+static inline int kernel_has_waiters(CondVar* cv)
+{
+	return cv->waitset != NULL;
+}
+
 
 /**
 	@brief Put thread to sleep, unlocking the kernel.
@@ -108,6 +158,54 @@ void kernel_sleep(Thread_state state, enum SCHED_CAUSE cause);
 #define preempt_on  cpu_enable_interrupts()
 
 
+
+/*
+ * Lock profiling.
+ *
+ * When the kernel is compiled with LOCK_PROFILING (make LOCKPROF=1), 
+ * lock operations keep statistics per lock site, in a table maintained
+ * by kernel_lockprof.c. The kernel lock wrappers take the site of their
+ * caller, just like kernel_wait takes its wait channel.
+ */
+#ifdef LOCK_PROFILING
+
+void kernel_lock_at(const char* site);
+#define kernel_lock() kernel_lock_at(__FUNCTION__)
+#define kernel_signal(cv) Cond_Signal_at((cv), __FUNCTION__)
+#define kernel_broadcast(cv) Cond_Broadcast_at((cv), __FUNCTION__)
+
+/** @brief Return a monotonic time stamp in nanoseconds. */
+unsigned long lockprof_clock();
+
+/** @brief Account an acquisition of @c mx at @c site. 
+
+	@c t0 is the time the caller started waiting, or 0 if the mutex was 
+	acquired without contention.
+  */
+void lockprof_mutex_acquired(Mutex* mx, const char* site, unsigned long t0,
+	unsigned long spins, unsigned long yields);
+
+/** @brief Account the hold time of @c mx; call just before unlocking. */
+void lockprof_mutex_released(Mutex* mx);
+
+/** @brief Account a condition wait at @c site, started at @c t0. */
+void lockprof_cond_wait(const char* site, unsigned long t0, int signalled);
+
+/** @brief Account a condition signal or broadcast at @c site. */
+void lockprof_cond_signal(const char* site);
+
+/** @brief Account an acquisition of the kernel lock; call under the kernel monitor. */
+void lockprof_kernel_acquired(const char* site, unsigned long t0);
+
+/** @brief Account the hold time of the kernel lock; call under the kernel monitor. */
+void lockprof_kernel_released();
+
+/** @brief Print the lock statistics to @c stderr. */
+void lockprof_report();
+
+#endif
+
+
 #endif
 
 
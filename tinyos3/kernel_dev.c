@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <limits.h>
 #include "kernel_cc.h"
 #include "kernel_dev.h"
 #include "kernel_sched.h"
@@ -37,6 +38,32 @@ int nulldev_write(void* dev, const char* buf, unsigned int size)
 }
 
 
+int nulldev_readv(void* dev, const iovec_t* iov, unsigned int iovcnt)
+{
+  unsigned int count = 0;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    memset(iov[i].base, 0, iov[i].len);
+    count += iov[i].len;
+  }
+  return count;
+}
+
+int nulldev_writev(void* dev, const iovec_t* iov, unsigned int iovcnt)
+{
+  unsigned int count = 0;
+  for(unsigned int i=0; i<iovcnt; i++)
+    count += iov[i].len;
+  return count;
+}
+
+
+int nulldev_available(void* dev, unsigned int* readable, unsigned int* writable)
+{
+  *readable = *writable = UINT_MAX;
+  return 0;
+}
+
+
 int nulldev_close(void* dev) 
 {
   return 0;
@@ -51,6 +78,9 @@ static file_ops nulldev_fops = {
   .Open = nulldev_open,
   .Read = nulldev_read,
   .Write = nulldev_write,
+  .ReadV = nulldev_readv,
+  .WriteV = nulldev_writev,
+  .Available = nulldev_available,
   .Close = nulldev_close
 };
 
@@ -65,11 +95,15 @@ static file_ops nulldev_fops = {
 /* forward */
 void serial_rx_handler();
 void serial_tx_handler();
+int serial_readv(void* dev, const iovec_t* iov, unsigned int iovcnt);
+int serial_writev(void* dev, const iovec_t* iov, unsigned int iovcnt);
 
 typedef struct serial_device_control_block {
   uint devno;
   Mutex spinlock;
   CondVar rx_ready;
+  int has_lookahead;    /* a byte was taken from the device by serial_ready */
+  char lookahead;
 } serial_dcb_t;
 
 serial_dcb_t serial_dcb[MAX_TERMINALS];
@@ -99,6 +133,16 @@ void serial_rx_handler()
   Read from the device, sleeping if needed.
  */
 int serial_read(void* dev, char *buf, unsigned int size)
+{
+  iovec_t iov = { buf, size };
+  return serial_readv(dev, &iov, 1);
+}
+
+/*
+  Read into the segments in order, sleeping only if nothing 
+  has been read yet.
+ */
+int serial_readv(void* dev, const iovec_t* iov, unsigned int iovcnt)
 {
   serial_dcb_t* dcb = (serial_dcb_t*)dev;
 
@@ -106,17 +150,36 @@ int serial_read(void* dev, char *buf, unsigned int size)
 
   uint count =  0;
 
-  while(count<size) {
-    int valid = bios_read_serial(dcb->devno, &buf[count]);
-    
-    if (valid) {
-      count++;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    char* buf = iov[i].base;
+    uint pos = 0;
+
+    while(pos<iov[i].len) {
+      int valid;
+      if(dcb->has_lookahead) {
+        buf[pos] = dcb->lookahead;
+        dcb->has_lookahead = 0;
+        valid = 1;
+      }
+      else
+        valid = bios_read_serial(dcb->devno, &buf[pos]);
+      
+      if (valid) {
+        pos++;
+      }
+      else if(count+pos==0) {
+        if(io_nonblocking()) {
+          preempt_on;
+          return WOULDBLOCK;
+        }
+        kernel_wait(&dcb->rx_ready, SCHED_IO);
+      }
+      else
+        break;
     }
-    else if(count==0) {
-      kernel_wait(&dcb->rx_ready, SCHED_IO);
-    }
-    else
-      break;
+
+    count += pos;
+    if(pos < iov[i].len) break;
   }
 
   preempt_on;           /* Restart preemption */
@@ -140,28 +203,70 @@ void serial_tx_handler()
   This is currently a polling driver.
 */
 int serial_write(void* dev, const char* buf, unsigned int size)
+{
+  iovec_t iov = { (void*) buf, size };
+  return serial_writev(dev, &iov, 1);
+}
+
+/* Write the segments in order, yielding only if nothing has been written yet */
+int serial_writev(void* dev, const iovec_t* iov, unsigned int iovcnt)
 {
   serial_dcb_t* dcb = (serial_dcb_t*)dev;
 
   unsigned int count = 0;
-  while(count < size) {
-    int success = bios_write_serial(dcb->devno, buf[count]);
-
-    if(success) {
-      count++;
-    } 
-    else if(count==0)
-    {
-      yield(SCHED_IO);
+  for(unsigned int i=0; i<iovcnt; i++) {
+    const char* buf = iov[i].base;
+    unsigned int pos = 0;
+
+    while(pos < iov[i].len) {
+      int success = bios_write_serial(dcb->devno, buf[pos]);
+
+      if(success) {
+        pos++;
+      } 
+      else if(count+pos==0)
+      {
+        if(io_nonblocking())
+          return WOULDBLOCK;
+        yield(SCHED_IO);
+      }
+      else
+        break;
     }
-    else
-      break;
+
+    count += pos;
+    if(pos < iov[i].len) break;
   }
 
   return count;  
 }
 
 
+/*
+  The device cannot tell if it has data without reading them, so
+  we keep the byte that we read, for the next serial_read.
+  Writes are always ready, since the driver does not sleep on them.
+ */
+int serial_ready(void* dev)
+{
+  serial_dcb_t* dcb = (serial_dcb_t*)dev;
+
+  int pre = preempt_off;
+  if(! dcb->has_lookahead)
+    dcb->has_lookahead = bios_read_serial(dcb->devno, &dcb->lookahead);
+  if(pre) preempt_on;
+
+  return POLLOUT | (dcb->has_lookahead ? POLLIN : 0);
+}
+
+unsigned int serial_waitq(void* dev, int events, CondVar** wq)
+{
+  serial_dcb_t* dcb = (serial_dcb_t*)dev;
+  wq[0] = &dcb->rx_ready;
+  return 1;
+}
+
+
 int serial_close(void* dev) 
 {
   return 0;
@@ -180,6 +285,10 @@ file_ops serial_fops = {
   .Open = serial_open,
   .Read = serial_read,
   .Write = serial_write,
+  .ReadV = serial_readv,
+  .WriteV = serial_writev,
+  .Ready = serial_ready,
+  .WaitQueues = serial_waitq,
   .Close = serial_close
 };
 
@@ -211,6 +320,7 @@ void initialize_devices()
     serial_dcb[i].devno = i;
     serial_dcb[i].rx_ready = COND_INIT;
     serial_dcb[i].spinlock = MUTEX_INIT;
+    serial_dcb[i].has_lookahead = 0;
   }
 
   cpu_interrupt_handler(SERIAL_RX_READY, serial_rx_handler);
@@ -34,6 +34,9 @@
 */
 
 
+/** @brief The max. number of wait queues of a stream, for Poll. */
+#define MAX_POLL_WAITQ 2
+
 /**
   @brief The device-specific file operations table.
 
@@ -58,7 +61,8 @@ typedef struct file_operations {
   /** @brief Read operation.
 
     Read up to 'size' bytes from stream 'this' into buffer 'buf'. 
-    If no data is available, the thread will block, to wait for data.
+    If no data is available, the thread will block, to wait for data,
+    unless io_nonblocking() is true, in which case WOULDBLOCK is returned.
     The Read function should return the number of bytes copied into buf, 
     or -1 on error. The call may return fewer bytes than 'size', 
     but at least 1. A value of 0 indicates "end of data".
@@ -72,7 +76,8 @@ typedef struct file_operations {
 
     Write up to 'size' bytes from 'buf' to the stream 'this'.
     If it is not possible to write any data (e.g., a buffer is full),
-    the thread will block. 
+    the thread will block, unless io_nonblocking() is true, in which case
+    WOULDBLOCK is returned.
     The write function should return the number of bytes copied from buf, 
     or -1 on error. 
 
@@ -81,6 +86,59 @@ typedef struct file_operations {
   */
     int (*Write)(void* this, const char* buf, unsigned int size);
 
+  /** @brief Scatter read operation (optional).
+
+    Read into the 'iovcnt' segments of 'iov', in order, with the semantics of 
+    Read for the total size. If this is NULL, the segments are read one at
+    a time by Read.
+  */
+    int (*ReadV)(void* this, const iovec_t* iov, unsigned int iovcnt);
+
+  /** @brief Gather write operation (optional).
+
+    Write from the 'iovcnt' segments of 'iov', in order, with the semantics of
+    Write for the total size. If this is NULL, the segments are written one at
+    a time by Write.
+  */
+    int (*WriteV)(void* this, const iovec_t* iov, unsigned int iovcnt);
+
+  /** @brief Buffered bytes query (optional).
+
+    Store into 'readable' the number of bytes that Read would return at once, 
+    and into 'writable' the number of bytes that Write would accept at once.
+    This must not sleep. Return 0 on success, or -1 on error.
+    If this is NULL, the stream does not support Available().
+  */
+    int (*Available)(void* this, unsigned int* readable, unsigned int* writable);
+
+  /** @brief Readiness callback (optional).
+
+    Return the poll events (POLLIN, POLLOUT, POLLERR, POLLHUP) that are
+    currently true for the stream. This must not sleep.
+    If this is NULL, the stream is always ready, for the operations it has.
+  */
+    int (*Ready)(void* this);
+
+  /** @brief Wait-queue hook (optional, with Ready).
+
+    Store into 'wq' the condition variables (at most MAX_POLL_WAITQ) that are
+    signalled when the readiness of the stream for 'events' may change, and 
+    return their number. Poll sleeps on these, along with those of the other
+    polled streams.
+  */
+    unsigned int (*WaitQueues)(void* this, int events, CondVar** wq);
+
+  /** @brief Watcher list hook (optional, with Ready).
+
+    Store into 'lists' the watcher lists (at most MAX_POLL_WAITQ) of the 
+    stream for 'events', and return their number. The stream calls
+    stream_notify() on a list whenever its readiness for the respective 
+    events may have changed. This must be done while holding the kernel lock;
+    streams that change state in interrupt handlers should not have this 
+    hook, and are polled by the event queues instead.
+  */
+    unsigned int (*Watchers)(void* this, int events, rlnode** lists);
+
     /** @brief Close operation.
 
       Close the stream object, deallocating any resources held by it.
@@ -94,6 +152,18 @@ typedef struct file_operations {
     int (*Close)(void* this);
 } file_ops;
 
+
+/**
+  @brief Check if the current I/O call must not block.
+
+  This is true while the current thread executes a stream operation on a 
+  stream in non-blocking mode. Drivers call this before they sleep, and
+  return @c WOULDBLOCK if it is true.
+
+  @see SetNonBlocking
+*/
+int io_nonblocking();
+
 /**
   @brief The device type.
 	
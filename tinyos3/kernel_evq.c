@@ -0,0 +1,376 @@
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+
+/**
+	@file kernel_evq.c
+
+	@brief Event queues.
+
+	An event queue keeps a registration for each stream it watches. The
+	registration is linked into the watcher lists of the stream (see
+	@c file_ops.Watchers), and the stream calls @c stream_notify on them 
+	when its state changes. A notified registration whose stream is ready
+	is appended to the ready list of its queue, so that a wait only looks 
+	at the ready streams.
+
+	Streams without watcher lists (e.g., terminals, whose state changes in
+	interrupt handlers) are kept in a separate list, which is checked at
+	every wait, and their wait queues are slept on along with the queue.
+  */
+
+typedef struct event_queue_control_block EVQ;
+
+/* A registration of a stream to an event queue */
+typedef struct evq_item {
+	EVQ* evq;
+	FCB* fcb;
+	Fid_t fd;
+	int events;			/* the events of interest, with EVQ_EDGE */
+	int last;			/* the events of a polled stream at the last wait */
+	int queued;			/* the item is in the ready list */
+	int polled;			/* the item is in the polled list */
+
+	rlnode item_node;	/* in the items of the queue */
+	rlnode fcb_node;	/* in the registrations of the stream */
+	rlnode ready_node;	/* in the ready list, or the polled list */
+	stream_watcher watcher;				/* calls evq_item_push */
+	rlnode watch_node[MAX_POLL_WAITQ];	/* in the watcher lists of the stream */
+} evq_item;
+
+struct event_queue_control_block {
+	rlnode items;			/* all registrations */
+	rlnode ready;			/* registrations that may have events */
+	unsigned int nready;
+	rlnode polled;			/* registrations of streams without watcher lists */
+	unsigned int npolled;
+	CondVar has_events;		/* broadcast when the ready list grows */
+	rlnode watchers;		/* registrations of this queue in other queues */
+};
+
+
+static file_ops evq_file_ops;
+
+
+/* Append an item whose stream is ready to the ready list */
+static void evq_item_push(evq_item* item)
+{
+	if(item->queued || item->polled) return;
+	if(stream_ready(item->fcb, item->events) == 0) return;
+
+	EVQ* evq = item->evq;
+	rlist_push_back(&evq->ready, &item->ready_node);
+	item->queued = 1;
+	evq->nready++;
+
+	kernel_broadcast(&evq->has_events);
+	if(evq->nready == 1)
+		stream_notify(&evq->watchers);
+}
+
+static void evq_item_notify(void* item)
+{
+	evq_item_push(item);
+}
+
+
+/* Link an item into the watcher lists of its stream, or the polled list */
+static void evq_item_attach(evq_item* item)
+{
+	file_ops* ops = item->fcb->streamfunc;
+	rlnode* lists[MAX_POLL_WAITQ];
+	unsigned int n = ops->Watchers ? ops->Watchers(item->fcb->streamobj, item->events, lists) : 0;
+
+	item->watcher = (stream_watcher){ evq_item_notify, item };
+	for(unsigned int i=0; i<MAX_POLL_WAITQ; i++) {
+		rlnode_init(&item->watch_node[i], &item->watcher);
+		if(i < n) rlist_push_back(lists[i], &item->watch_node[i]);
+	}
+
+	item->last = 0;
+	if(n == 0) {
+		rlist_push_back(&item->evq->polled, &item->ready_node);
+		item->polled = 1;
+		item->evq->npolled++;
+		kernel_broadcast(&item->evq->has_events);
+	}
+	else
+		evq_item_push(item);
+}
+
+static void evq_item_detach(evq_item* item)
+{
+	for(unsigned int i=0; i<MAX_POLL_WAITQ; i++)
+		rlist_remove(&item->watch_node[i]);
+
+	rlist_remove(&item->ready_node);
+	if(item->queued) item->evq->nready--;
+	if(item->polled) item->evq->npolled--;
+	item->queued = item->polled = 0;
+}
+
+static void evq_item_free(evq_item* item)
+{
+	evq_item_detach(item);
+	rlist_remove(&item->item_node);
+	rlist_remove(&item->fcb_node);
+	free(item);
+}
+
+void evq_detach(FCB* fcb)
+{
+	while(! is_rlist_empty(&fcb->evq_items))
+		evq_item_free(fcb->evq_items.next->obj);
+}
+
+
+/*
+	Store up to max events. Edge-triggered items leave the ready list when 
+	they are reported, level-triggered ones when they are no longer ready.
+ */
+static unsigned int evq_collect(EVQ* evq, evq_event* out, unsigned int max)
+{
+	unsigned int count = 0;
+
+	for(rlnode* n = evq->polled.next; n != &evq->polled && count < max; n = n->next) {
+		evq_item* item = n->obj;
+		int ready = stream_ready(item->fcb, item->events);
+		int report = (item->events & EVQ_EDGE) ? (ready & ~item->last) : ready;
+		item->last = ready;
+		if(report)
+			out[count++] = (evq_event){ item->fd, ready };
+	}
+
+	for(unsigned int k = evq->nready; k > 0 && count < max; k--) {
+		evq_item* item = rlist_pop_front(&evq->ready)->obj;
+		item->queued = 0;
+		evq->nready--;
+
+		int ready = stream_ready(item->fcb, item->events);
+		if(ready == 0) continue;
+
+		out[count++] = (evq_event){ item->fd, ready };
+		if(! (item->events & EVQ_EDGE)) {
+			rlist_push_back(&evq->ready, &item->ready_node);
+			item->queued = 1;
+			evq->nready++;
+		}
+	}
+
+	return count;
+}
+
+
+/* Wait until there are events, or the deadline passes */
+static unsigned int evq_wait(EVQ* evq, evq_event* out, unsigned int max, 
+	TimerDuration deadline, int nowait)
+{
+	unsigned int count;
+	int preempt = preempt_off;
+
+	while((count = evq_collect(evq, out, max)) == 0 && ! nowait) {
+		/* The streams of the polled items must not be closed while we sleep on them */
+		unsigned int npolled = evq->npolled;
+		CondVar** wq = xmalloc((1 + npolled*MAX_POLL_WAITQ)*sizeof(CondVar*));
+		FCB** pinned = xmalloc((npolled+1)*sizeof(FCB*));
+
+		unsigned int nwq = 0, k = 0;
+		wq[nwq++] = &evq->has_events;
+		for(rlnode* n = evq->polled.next; n != &evq->polled; n = n->next) {
+			evq_item* item = n->obj;
+			file_ops* ops = item->fcb->streamfunc;
+			FCB_incref(pinned[k++] = item->fcb);
+
+			CondVar* cvs[MAX_POLL_WAITQ];
+			unsigned int m = ops->WaitQueues ? ops->WaitQueues(item->fcb->streamobj, item->events, cvs) : 0;
+			for(unsigned int i=0; i<m; i++) {
+				unsigned int j = 0;
+				while(j<nwq && wq[j]!=cvs[i]) j++;
+				if(j==nwq) wq[nwq++] = cvs[i];
+			}
+		}
+
+		int timely = kernel_wait_any_until(wq, nwq, SCHED_POLL, deadline);
+
+		for(unsigned int i=0; i<k; i++)
+			FCB_decref(pinned[i]);
+		free(pinned);
+		free(wq);
+
+		if(! timely) {
+			count = evq_collect(evq, out, max);
+			break;
+		}
+	}
+
+	if(preempt) preempt_on;
+	return count;
+}
+
+
+/*
+	The event queue stream.
+ */
+
+static int evq_read(void* this, char* buf, unsigned int n)
+{
+	if(n < sizeof(evq_event)) return -1;
+
+	unsigned int count = evq_wait(this, (evq_event*) buf, n/sizeof(evq_event), 
+		NO_TIMEOUT, io_nonblocking());
+	return (count > 0) ? count*sizeof(evq_event) : WOULDBLOCK;
+}
+
+/* A queue is readable when some of its streams are */
+static int evq_ready(void* this)
+{
+	EVQ* evq = this;
+	if(evq->nready > 0) return POLLIN;
+	for(rlnode* n = evq->polled.next; n != &evq->polled; n = n->next) {
+		evq_item* item = n->obj;
+		if(stream_ready(item->fcb, item->events)) return POLLIN;
+	}
+	return 0;
+}
+
+static unsigned int evq_waitq(void* this, int events, CondVar** wq)
+{
+	wq[0] = & ((EVQ*) this)->has_events;
+	return 1;
+}
+
+static unsigned int evq_watchers(void* this, int events, rlnode** lists)
+{
+	lists[0] = & ((EVQ*) this)->watchers;
+	return 1;
+}
+
+static int evq_close(void* this)
+{
+	EVQ* evq = this;
+	while(! is_rlist_empty(&evq->items))
+		evq_item_free(evq->items.next->obj);
+	assert(is_rlist_empty(&evq->watchers));
+	free(evq);
+	return 0;
+}
+
+static file_ops evq_file_ops = {
+	.Open = NULL,
+	.Read = evq_read,
+	.Write = NULL,
+	.Ready = evq_ready,
+	.WaitQueues = evq_waitq,
+	.Watchers = evq_watchers,
+	.Close = evq_close
+};
+
+
+Fid_t sys_EventQueue()
+{
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) != 1)
+		return NOFILE;
+
+	EVQ* evq = xmalloc(sizeof(EVQ));
+	rlnode_init(&evq->items, NULL);
+	rlnode_init(&evq->ready, NULL);
+	rlnode_init(&evq->polled, NULL);
+	rlnode_init(&evq->watchers, NULL);
+	evq->nready = 0;
+	evq->npolled = 0;
+	evq->has_events = COND_INIT;
+
+	fcb->streamobj = evq;
+	fcb->streamfunc = &evq_file_ops;
+
+	return fid;
+}
+
+
+/* The event queue of a file id, or NULL */
+static EVQ* get_evq(Fid_t fd, FCB** fcb)
+{
+	*fcb = get_fcb(fd);
+	if(*fcb == NULL || (*fcb)->streamfunc != &evq_file_ops) return NULL;
+	return (*fcb)->streamobj;
+}
+
+/* The registration of a file id in a queue, or NULL */
+static evq_item* evq_find(EVQ* evq, FCB* fcb, Fid_t fd)
+{
+	for(rlnode* n = fcb->evq_items.next; n != &fcb->evq_items; n = n->next) {
+		evq_item* item = n->obj;
+		if(item->evq == evq && item->fd == fd) return item;
+	}
+	return NULL;
+}
+
+
+int sys_EventCtl(Fid_t evqfd, evq_op op, Fid_t fd, int events)
+{
+	FCB* qfcb;
+	EVQ* evq = get_evq(evqfd, &qfcb);
+	FCB* fcb = get_fcb(fd);
+
+	if(evq == NULL || fcb == NULL || fcb == qfcb)
+		return -1;
+
+	evq_item* item = evq_find(evq, fcb, fd);
+
+	switch(op) {
+		case EVQ_ADD:
+			if(item) return -1;
+			item = xmalloc(sizeof(evq_item));
+			item->evq = evq;
+			item->fcb = fcb;
+			item->fd = fd;
+			item->events = events;
+			item->queued = item->polled = 0;
+			rlnode_init(&item->item_node, item);
+			rlnode_init(&item->fcb_node, item);
+			rlnode_init(&item->ready_node, item);
+			rlist_push_back(&evq->items, &item->item_node);
+			rlist_push_back(&fcb->evq_items, &item->fcb_node);
+			evq_item_attach(item);
+			return 0;
+
+		case EVQ_MOD:
+			if(item == NULL) return -1;
+			evq_item_detach(item);
+			item->events = events;
+			evq_item_attach(item);
+			return 0;
+
+		case EVQ_DEL:
+			if(item == NULL) return -1;
+			evq_item_free(item);
+			return 0;
+	}
+
+	return -1;
+}
+
+
+int sys_EventWait(Fid_t evqfd, evq_event* events, unsigned int max, timeout_t timeout)
+{
+	FCB* fcb;
+	EVQ* evq = get_evq(evqfd, &fcb);
+
+	if(evq == NULL || events == NULL || max == 0)
+		return -1;
+
+	TimerDuration deadline = (timeout == POLL_FOREVER) ? NO_TIMEOUT : kernel_deadline(timeout);
+
+	/* The queue must not be closed while we wait */
+	FCB_incref(fcb);
+	int count = evq_wait(evq, events, max, deadline, timeout == 0);
+	FCB_decref(fcb);
+
+	return count;
+}
@@ -9,6 +9,7 @@
 #include "kernel_proc.h"
 #include "kernel_dev.h"
 #include "kernel_streams.h"
+#include "kernel_cc.h"
 
 
 /*
@@ -53,6 +54,9 @@ void boot_tinyos_kernel()
 
   if(cpu_core_id==0) {
     /* Here, we could add cleanup after the scheduler has ended. */    
+#ifdef LOCK_PROFILING
+    lockprof_report();
+#endif
   }
 }
 
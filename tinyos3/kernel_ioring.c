@@ -0,0 +1,449 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+#include "kernel_sys.h"
+
+/**
+	@file kernel_ioring.c
+
+	@brief I/O rings.
+
+	An I/O ring takes requests from a submission queue in memory shared
+	with the process, and posts their results to a completion queue in the
+	same memory. A submitted request is executed at once, in non-blocking
+	mode. If it would block, it is linked into the watcher lists of its
+	stream (see @c file_ops.Watchers), as an event queue registration is,
+	and the notification moves it to the ready list of the ring. Streams
+	without watcher lists are kept in a polled list, and their wait queues
+	are slept on along with the ring.
+
+	There are no worker threads: requests are executed by the threads in
+	@c IoRingEnter, which run the ready and the polled requests before
+	they sleep, and after they wake up. Therefore, one thread can keep
+	any number of requests in flight, and it collects their completions
+	in batches.
+  */
+
+typedef struct ioring_control_block IORING;
+
+/* A request in flight */
+typedef struct io_request {
+	IORING* ring;
+	io_sqe sqe;			/* a copy of the submission entry */
+	FCB* fcb;			/* the stream, pinned until completion */
+	int events;			/* POLLIN or POLLOUT */
+	int polled;			/* the stream has no watcher lists */
+	int queued;			/* the request is in the ready list */
+
+	stream_watcher watcher;				/* calls ioring_notify */
+	rlnode node;						/* in the waiting, ready, or polled list */
+	rlnode watch_node[MAX_POLL_WAITQ];	/* in the watcher lists of the stream */
+} io_request;
+
+/*
+	The kernel takes only sq_tail and cq_head from the shared block; the
+	sizes and addresses of the queues, and its own indices, are kept here,
+	where the process cannot change them.
+ */
+struct ioring_control_block {
+	io_ring* shared;		/* the queues, shared with the process */
+	io_sqe* sqes;			/* the submission queue */
+	io_cqe* cqes;			/* the completion queue */
+	unsigned int sq_entries, cq_entries;
+	unsigned int sq_head;	/* the next request to take */
+	unsigned int cq_tail;	/* the next completion entry to fill */
+	int overrun;			/* a completion was lost, since the process overran cq_head */
+
+	unsigned int inflight;	/* requests submitted and not completed */
+	rlnode waiting;			/* requests waiting for a notification */
+	rlnode ready;			/* requests whose stream may be ready */
+	rlnode polled;			/* requests on streams without watcher lists */
+	unsigned int npolled;
+	CondVar has_work;		/* broadcast when a request becomes ready, or completes */
+};
+
+
+static file_ops ioring_file_ops;
+
+
+/* The number of entries in the completion queue */
+static inline unsigned int ioring_completions(IORING* ring)
+{
+	return ring->cq_tail - __atomic_load_n(&ring->shared->cq_head, __ATOMIC_ACQUIRE);
+}
+
+
+/* Called by the stream of a waiting request, when its state changes */
+static void ioring_notify(void* obj)
+{
+	io_request* req = obj;
+	IORING* ring = req->ring;
+
+	if(req->queued || stream_ready(req->fcb, req->events) == 0) return;
+
+	rlist_remove(&req->node);
+	rlist_push_back(&ring->ready, &req->node);
+	req->queued = 1;
+	kernel_broadcast(&ring->has_work);
+}
+
+
+/* Link a request into the watcher lists of its stream, or the polled list */
+static void ioring_attach(io_request* req)
+{
+	file_ops* ops = req->fcb->streamfunc;
+	rlnode* lists[MAX_POLL_WAITQ];
+	unsigned int n = ops->Watchers ? ops->Watchers(req->fcb->streamobj, req->events, lists) : 0;
+
+	for(unsigned int i=0; i<n; i++)
+		rlist_push_back(lists[i], &req->watch_node[i]);
+
+	if(n == 0) {
+		req->polled = 1;
+		req->ring->npolled++;
+		rlist_push_back(&req->ring->polled, &req->node);
+	}
+	else
+		rlist_push_back(&req->ring->waiting, &req->node);
+}
+
+static void ioring_detach(io_request* req)
+{
+	for(unsigned int i=0; i<MAX_POLL_WAITQ; i++)
+		rlist_remove(&req->watch_node[i]);
+	rlist_remove(&req->node);
+	if(req->polled) req->ring->npolled--;
+	req->polled = req->queued = 0;
+}
+
+
+/* Post the result of a request, and release it */
+static void ioring_complete(io_request* req, int result)
+{
+	IORING* ring = req->ring;
+
+	ioring_detach(req);
+
+	/* Submission made sure that there is space, unless the process has overrun cq_head */
+	if(ioring_completions(ring) < ring->cq_entries) {
+		ring->cqes[ring->cq_tail & (ring->cq_entries-1)] = (io_cqe){ req->sqe.user_data, result };
+		ring->cq_tail++;
+		__atomic_store_n(&ring->shared->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+	}
+	else
+		ring->overrun = 1;
+	ring->inflight--;
+
+	if(req->fcb) FCB_decref(req->fcb);
+	free(req);
+
+	kernel_broadcast(&ring->has_work);
+}
+
+
+/* Execute the operation of a request, without blocking if the stream allows it */
+static int ioring_exec(io_request* req)
+{
+	FCB* fcb = req->fcb;
+	io_sqe* sqe = &req->sqe;
+	int rc = -1;
+
+	cur_thread()->io_nonblock = 1;
+
+	switch(sqe->opcode) {
+	case IO_READ:
+		rc = fcb->streamfunc->Read(fcb->streamobj, sqe->buf, sqe->len);
+		if(rc > 0) cur_thread()->usage.bytes_read += rc;
+		break;
+	case IO_WRITE:
+		rc = fcb->streamfunc->Write(fcb->streamobj, sqe->buf, sqe->len);
+		if(rc > 0) cur_thread()->usage.bytes_written += rc;
+		break;
+	case IO_ACCEPT:
+		/* The file id may have been closed or reused since submission */
+		if(get_fcb(sqe->fd) == fcb)
+			rc = sys_Accept(sqe->fd);
+		break;
+	default:
+		break;
+	}
+
+	cur_thread()->io_nonblock = 0;
+	return rc;
+}
+
+
+/* Try to complete a request, and return 1 if it did */
+static int ioring_try(io_request* req)
+{
+	/* Streams without watcher lists may not support non-blocking mode */
+	if(req->polled && stream_ready(req->fcb, req->events) == 0)
+		return 0;
+
+	int rc = ioring_exec(req);
+	if(rc == WOULDBLOCK)
+		return 0;
+
+	ioring_complete(req, rc);
+	return 1;
+}
+
+
+/* Start a request from a submission entry */
+static void ioring_start(IORING* ring, const io_sqe* sqe)
+{
+	io_request* req = xmalloc(sizeof(io_request));
+	req->ring = ring;
+	req->sqe = *sqe;
+	req->fcb = NULL;
+	req->polled = req->queued = 0;
+	req->watcher = (stream_watcher){ ioring_notify, req };
+	rlnode_init(&req->node, req);
+	for(unsigned int i=0; i<MAX_POLL_WAITQ; i++)
+		rlnode_init(&req->watch_node[i], &req->watcher);
+	ring->inflight++;
+
+	if(sqe->opcode == IO_NOP) {
+		ioring_complete(req, 0);
+		return;
+	}
+
+	/* Connecting sockets is not supported yet; it must not block the submitter */
+	FCB* fcb = get_fcb(sqe->fd);
+	if(fcb == NULL || sqe->opcode < IO_NOP || sqe->opcode >= IO_CONNECT
+		|| fcb->streamfunc == &ioring_file_ops
+		|| (sqe->opcode == IO_READ && fcb->streamfunc->Read == NULL)
+		|| (sqe->opcode == IO_WRITE && fcb->streamfunc->Write == NULL)) {
+		ioring_complete(req, -1);
+		return;
+	}
+
+	FCB_incref(fcb);
+	req->fcb = fcb;
+	req->events = (sqe->opcode == IO_READ || sqe->opcode == IO_ACCEPT) ? POLLIN : POLLOUT;
+
+	/* An accept on a stream that is not listening fails at once */
+	if(sqe->opcode == IO_ACCEPT && socket_listener(fcb) == NULL) {
+		ioring_complete(req, ioring_exec(req));
+		return;
+	}
+
+	ioring_attach(req);
+	ioring_try(req);
+}
+
+
+/*
+	Take up to n requests from the submission queue. Returns the number
+	taken, or -1 if the indices of the process are out of range.
+ */
+static int ioring_submit(IORING* ring, unsigned int n)
+{
+	io_ring* sh = ring->shared;
+	unsigned int tail = __atomic_load_n(&sh->sq_tail, __ATOMIC_ACQUIRE);
+	unsigned int count = 0;
+
+	if(tail - ring->sq_head > ring->sq_entries || ioring_completions(ring) > ring->cq_entries)
+		return -1;
+
+	/* Every request in flight must find space in the completion queue */
+	while(count < n && ring->sq_head != tail
+		&& ioring_completions(ring) + ring->inflight < ring->cq_entries) {
+		io_sqe sqe = ring->sqes[ring->sq_head & (ring->sq_entries-1)];
+		ring->sq_head++;
+		count++;
+		__atomic_store_n(&sh->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+
+		ioring_start(ring, &sqe);
+	}
+
+	return count;
+}
+
+
+/* Execute the ready and the polled requests */
+static void ioring_run(IORING* ring)
+{
+	while(! is_rlist_empty(&ring->ready)) {
+		io_request* req = rlist_pop_front(&ring->ready)->obj;
+		req->queued = 0;
+		rlist_push_back(&ring->waiting, &req->node);
+		ioring_try(req);
+	}
+
+	for(rlnode* n = ring->polled.next; n != &ring->polled; ) {
+		io_request* req = n->obj;
+		n = n->next;
+		ioring_try(req);
+	}
+}
+
+
+/* Sleep until a request may be executed, or completes, or the deadline passes */
+static int ioring_sleep(IORING* ring, TimerDuration deadline)
+{
+	/* The streams of the polled requests must not be closed while we sleep on them */
+	unsigned int npolled = ring->npolled;
+	CondVar** wq = xmalloc((1 + npolled*MAX_POLL_WAITQ)*sizeof(CondVar*));
+	FCB** pinned = xmalloc((npolled+1)*sizeof(FCB*));
+
+	unsigned int nwq = 0, k = 0;
+	wq[nwq++] = &ring->has_work;
+	for(rlnode* n = ring->polled.next; n != &ring->polled; n = n->next) {
+		io_request* req = n->obj;
+		file_ops* ops = req->fcb->streamfunc;
+		FCB_incref(pinned[k++] = req->fcb);
+
+		CondVar* cvs[MAX_POLL_WAITQ];
+		unsigned int m = ops->WaitQueues ? ops->WaitQueues(req->fcb->streamobj, req->events, cvs) : 0;
+		for(unsigned int i=0; i<m; i++) {
+			unsigned int j = 0;
+			while(j<nwq && wq[j]!=cvs[i]) j++;
+			if(j==nwq) wq[nwq++] = cvs[i];
+		}
+	}
+
+	int timely = kernel_wait_any_until(wq, nwq, SCHED_POLL, deadline);
+
+	for(unsigned int i=0; i<k; i++)
+		FCB_decref(pinned[i]);
+	free(pinned);
+	free(wq);
+
+	return timely;
+}
+
+
+/*
+	The ring stream.
+ */
+
+static int ioring_close(void* this)
+{
+	IORING* ring = this;
+	rlnode* lists[] = { &ring->waiting, &ring->ready, &ring->polled };
+
+	/*
+		Cancel the requests in flight. They are all unlinked first, since
+		closing their streams may notify the others.
+	 */
+	rlnode cancelled;
+	rlnode_init(&cancelled, NULL);
+	for(unsigned int i=0; i<3; i++)
+		while(! is_rlist_empty(lists[i])) {
+			io_request* req = lists[i]->next->obj;
+			ioring_detach(req);
+			rlist_push_back(&cancelled, &req->node);
+		}
+
+	while(! is_rlist_empty(&cancelled)) {
+		io_request* req = rlist_pop_front(&cancelled)->obj;
+		FCB_decref(req->fcb);
+		free(req);
+	}
+
+	free(ring->shared);
+	free(ring);
+	return 0;
+}
+
+static file_ops ioring_file_ops = {
+	.Open = NULL,
+	.Read = NULL,
+	.Write = NULL,
+	.Close = ioring_close
+};
+
+
+Fid_t sys_IoRingSetup(unsigned int entries, io_ring** ringp)
+{
+	if(ringp == NULL || entries == 0 || entries > MAX_IORING_ENTRIES
+		|| (entries & (entries-1)) != 0)
+		return NOFILE;
+
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) != 1)
+		return NOFILE;
+
+	/* The queues are laid out after the header, in one block */
+	size_t size = sizeof(io_ring) + entries*sizeof(io_sqe) + 2*entries*sizeof(io_cqe);
+	io_ring* sh = xmalloc(size);
+	memset(sh, 0, size);
+	sh->sq_entries = entries;
+	sh->cq_entries = 2*entries;
+	sh->sqes = (io_sqe*) (sh+1);
+	sh->cqes = (io_cqe*) (sh->sqes + entries);
+
+	IORING* ring = xmalloc(sizeof(IORING));
+	ring->shared = sh;
+	ring->sqes = sh->sqes;
+	ring->cqes = sh->cqes;
+	ring->sq_entries = sh->sq_entries;
+	ring->cq_entries = sh->cq_entries;
+	ring->sq_head = ring->cq_tail = 0;
+	ring->overrun = 0;
+	ring->inflight = 0;
+	rlnode_init(&ring->waiting, NULL);
+	rlnode_init(&ring->ready, NULL);
+	rlnode_init(&ring->polled, NULL);
+	ring->npolled = 0;
+	ring->has_work = COND_INIT;
+
+	fcb->streamobj = ring;
+	fcb->streamfunc = &ioring_file_ops;
+
+	*ringp = sh;
+	return fid;
+}
+
+
+/* The ring of a file id, or NULL */
+static IORING* get_ioring(Fid_t fd, FCB** fcb)
+{
+	*fcb = get_fcb(fd);
+	if(*fcb == NULL || (*fcb)->streamfunc != &ioring_file_ops) return NULL;
+	return (*fcb)->streamobj;
+}
+
+
+int sys_IoRingEnter(Fid_t fd, unsigned int to_submit, unsigned int min_complete, timeout_t timeout)
+{
+	FCB* fcb;
+	IORING* ring = get_ioring(fd, &fcb);
+	if(ring == NULL)
+		return -1;
+
+	TimerDuration deadline = (timeout == POLL_FOREVER) ? NO_TIMEOUT : kernel_deadline(timeout);
+
+	/* The ring must not be closed while we wait */
+	FCB_incref(fcb);
+	int preempt = preempt_off;
+
+	int submitted = ioring_submit(ring, to_submit);
+
+	while(submitted >= 0) {
+		ioring_run(ring);
+		if(ioring_completions(ring) >= min_complete || ring->inflight == 0 || timeout == 0)
+			break;
+		if(! ioring_sleep(ring, deadline)) {
+			ioring_run(ring);
+			break;
+		}
+	}
+
+	/* Report the completions that were lost */
+	if(ring->overrun) {
+		ring->overrun = 0;
+		submitted = -1;
+	}
+
+	if(preempt) preempt_on;
+	FCB_decref(fcb);
+
+	return submitted;
+}
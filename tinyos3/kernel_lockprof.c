@@ -0,0 +1,274 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+
+/**
+	@file kernel_lockprof.c
+
+	@brief Lock contention profiling.
+
+	When the kernel is compiled with @c LOCK_PROFILING, every lock operation
+	reports to this module, which keeps statistics per lock site. The
+	statistics can be read at any time through the stream returned by
+	@c OpenLockInfo, and are printed to @c stderr when the kernel shuts down.
+  */
+
+
+#ifdef LOCK_PROFILING
+
+/* Number of lock sites of each kind (a power of 2) */
+#define LOCKPROF_SITES 512
+
+/* The statistics of a lock site */
+typedef struct lock_site {
+	const char* name;			/* the site name, or NULL for an unused entry */
+	unsigned long count;
+	unsigned long contended;
+	unsigned long spins;
+	unsigned long yields;
+	unsigned long signals;
+	unsigned long wait_time;
+	unsigned long hold_time;
+} lock_site;
+
+/*
+	One open addressing hash table per lock kind, keyed by the address of the
+	site name. Entries are claimed with an atomic compare-and-swap and never
+	released, so that lookups need no lock. This matters, because lock
+	operations happen in interrupt handlers too.
+ */
+static lock_site lockprof_table[LOCK_KERNEL+1][LOCKPROF_SITES];
+
+/* Used when a table overflows */
+static lock_site lockprof_overflow[LOCK_KERNEL+1];
+
+/* The holder of the kernel lock, protected by the kernel monitor */
+static lock_site* kernel_holder = NULL;
+static unsigned long kernel_since;
+
+
+static lock_site* lockprof_site(lock_kind kind, const char* name)
+{
+	unsigned long h = ((unsigned long)name * 0x9E3779B97F4A7C15ul) >> 32;
+
+	for(unsigned int i=0; i<LOCKPROF_SITES; i++) {
+		lock_site* ls = & lockprof_table[kind][(h+i) & (LOCKPROF_SITES-1)];
+		const char* sname = __atomic_load_n(&ls->name, __ATOMIC_ACQUIRE);
+		if(sname == NULL) {
+			/* Try to claim the entry; if we fail, sname is the new owner */
+			if(__atomic_compare_exchange_n(&ls->name, &sname, name, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return ls;
+		}
+		if(sname == name) return ls;
+	}
+
+	lockprof_overflow[kind].name = "<other>";
+	return & lockprof_overflow[kind];
+}
+
+
+#define ADD(field, val) __atomic_fetch_add(&(field), (val), __ATOMIC_RELAXED)
+
+unsigned long lockprof_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ul + ts.tv_nsec;
+}
+
+
+void lockprof_mutex_acquired(Mutex* mx, const char* site, unsigned long t0,
+	unsigned long spins, unsigned long yields)
+{
+	lock_site* ls = lockprof_site(LOCK_MUTEX, site);
+	unsigned long now = lockprof_clock();
+
+	ADD(ls->count, 1);
+	if(t0) {
+		ADD(ls->contended, 1);
+		ADD(ls->wait_time, now-t0);
+		ADD(ls->spins, spins);
+		ADD(ls->yields, yields);
+	}
+
+	mx->prof_site = ls;
+	mx->prof_since = now;
+}
+
+void lockprof_mutex_released(Mutex* mx)
+{
+	lock_site* ls = mx->prof_site;
+	if(ls) {
+		ADD(ls->hold_time, lockprof_clock() - mx->prof_since);
+		mx->prof_site = NULL;
+	}
+}
+
+void lockprof_cond_wait(const char* site, unsigned long t0, int signalled)
+{
+	lock_site* ls = lockprof_site(LOCK_COND, site);
+	ADD(ls->count, 1);
+	if(signalled) ADD(ls->contended, 1);
+	ADD(ls->wait_time, lockprof_clock()-t0);
+}
+
+void lockprof_cond_signal(const char* site)
+{
+	lock_site* ls = lockprof_site(LOCK_COND, site);
+	ADD(ls->signals, 1);
+}
+
+void lockprof_kernel_acquired(const char* site, unsigned long t0)
+{
+	lock_site* ls = lockprof_site(LOCK_KERNEL, site);
+	unsigned long now = lockprof_clock();
+
+	ADD(ls->count, 1);
+	if(t0) {
+		ADD(ls->contended, 1);
+		ADD(ls->wait_time, now-t0);
+	}
+	kernel_holder = ls;
+	kernel_since = now;
+}
+
+void lockprof_kernel_released()
+{
+	if(kernel_holder) {
+		ADD(kernel_holder->hold_time, lockprof_clock() - kernel_since);
+		kernel_holder = NULL;
+	}
+}
+
+#undef ADD
+
+
+/* Copy the statistics of a lock site into a lockinfo record */
+static void lockprof_get(lockinfo* info, lock_kind kind, lock_site* ls)
+{
+	info->kind = kind;
+	strncpy(info->site, ls->name, LOCKINFO_MAX_SITE-1);
+	info->site[LOCKINFO_MAX_SITE-1] = '\0';
+	info->count = __atomic_load_n(&ls->count, __ATOMIC_RELAXED);
+	info->contended = __atomic_load_n(&ls->contended, __ATOMIC_RELAXED);
+	info->spins = __atomic_load_n(&ls->spins, __ATOMIC_RELAXED);
+	info->yields = __atomic_load_n(&ls->yields, __ATOMIC_RELAXED);
+	info->signals = __atomic_load_n(&ls->signals, __ATOMIC_RELAXED);
+	info->wait_time = __atomic_load_n(&ls->wait_time, __ATOMIC_RELAXED);
+	info->hold_time = __atomic_load_n(&ls->hold_time, __ATOMIC_RELAXED);
+}
+
+
+static int lockinfo_compare(const void* a, const void* b)
+{
+	const lockinfo* la = a;
+	const lockinfo* lb = b;
+	return (la->wait_time < lb->wait_time) - (la->wait_time > lb->wait_time);
+}
+
+void lockprof_report()
+{
+	lockinfo* info = xmalloc(sizeof(lockinfo)*(LOCK_KERNEL+1)*(LOCKPROF_SITES+1));
+	unsigned int n = 0;
+
+	for(lock_kind k=LOCK_MUTEX; k<=LOCK_KERNEL; k++) {
+		for(unsigned int i=0; i<LOCKPROF_SITES; i++)
+			if(lockprof_table[k][i].name)
+				lockprof_get(&info[n++], k, &lockprof_table[k][i]);
+		if(lockprof_overflow[k].name)
+			lockprof_get(&info[n++], k, &lockprof_overflow[k]);
+	}
+
+	/* The most expensive sites first */
+	qsort(info, n, sizeof(lockinfo), lockinfo_compare);
+
+	fprintf(stderr, "\nLock profile (times in usec):\n");
+	fprintf(stderr, "%-7s %-31s %10s %10s %12s %8s %9s %12s %12s\n",
+		"KIND", "SITE", "COUNT", "CONTENDED", "SPINS", "YIELDS", "SIGNALS", "WAIT", "HOLD");
+	for(unsigned int i=0; i<n; i++)
+		fprintf(stderr, "%-7s %-31s %10lu %10lu %12lu %8lu %9lu %12lu %12lu\n",
+			lock_kind_name(info[i].kind), info[i].site, info[i].count, info[i].contended,
+			info[i].spins, info[i].yields, info[i].signals,
+			info[i].wait_time/1000, info[i].hold_time/1000);
+
+	free(info);
+}
+
+#endif
+
+
+
+/*
+	The lock statistics stream.
+ */
+
+typedef struct lockinfo_control_block
+{
+	lock_kind kind;		/* the table currently scanned */
+	unsigned int cursor;	/* the next entry of the table */
+} lockinfo_cb;
+
+
+static int lockinfo_read(void* lcb, char *buf, unsigned int n)
+{
+	if(n < sizeof(lockinfo)) return -1;
+
+#ifdef LOCK_PROFILING
+	lockinfo_cb* linfo = lcb;
+
+	for(; linfo->kind <= LOCK_KERNEL; linfo->kind++, linfo->cursor=0) {
+		/* The overflow entry of each kind comes after its table */
+		while(linfo->cursor <= LOCKPROF_SITES) {
+			lock_site* ls = (linfo->cursor < LOCKPROF_SITES)
+				? & lockprof_table[linfo->kind][linfo->cursor]
+				: & lockprof_overflow[linfo->kind];
+			linfo->cursor++;
+
+			if(__atomic_load_n(&ls->name, __ATOMIC_ACQUIRE)) {
+				lockprof_get((lockinfo*)buf, linfo->kind, ls);
+				return sizeof(lockinfo);
+			}
+		}
+	}
+#endif
+
+	return 0;
+}
+
+static int lockinfo_close(void* lcb)
+{
+	free(lcb);
+	return 0;
+}
+
+static file_ops lockinfo_file_ops = {
+	.Open = NULL,
+	.Read = lockinfo_read,
+	.Write = NULL,
+	.Close = lockinfo_close
+};
+
+
+Fid_t sys_OpenLockInfo()
+{
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) != 1)
+		return NOFILE;
+
+	lockinfo_cb* linfo = xmalloc(sizeof(lockinfo_cb));
+	linfo->kind = LOCK_MUTEX;
+	linfo->cursor = 0;
+
+	fcb->streamobj = linfo;
+	fcb->streamfunc = &lockinfo_file_ops;
+
+	return fid;
+}
@@ -4,6 +4,8 @@
 //#include "kernel_pipe.h"
 #include "kernel_cc.h"
 #include <stdbool.h>
+#include <string.h>
+#include <assert.h>
 
 
 /********************** File Ops Used **************************/
@@ -12,6 +14,11 @@ static file_ops writer_file_ops = {
 	.Open = NULL,
 	.Read = reader_blocked,
 	.Write = pipe_write,
+	.WriteV = pipe_writev,
+	.Available = pipe_writer_available,
+	.Ready = pipe_writer_ready,
+	.WaitQueues = pipe_writer_waitq,
+	.Watchers = pipe_writer_watchers,
 	.Close = pipe_writer_close
 
 };
@@ -21,6 +28,11 @@ static file_ops reader_file_ops = {
 
 	.Open = NULL,
 	.Read = pipe_read,
+	.ReadV = pipe_readv,
+	.Available = pipe_reader_available,
+	.Ready = pipe_reader_ready,
+	.WaitQueues = pipe_reader_waitq,
+	.Watchers = pipe_reader_watchers,
 	.Write = writer_blocked,
 	.Close = pipe_reader_close
 
@@ -43,8 +55,17 @@ void initialize_PIPE_CB (PIPE_CB *pipe_cb, pipe_t* pipe, Fid_t* fid, FCB** fcb)
 
   	pipe_cb->buff_bytes = 0;
 
-  	/*for(int i = 0; i < PIPE_BUFFER_SIZE; i++)
-    	pipe_cb->BUFFER[i] = 0;*/
+  	pipe_cb->BUFFER = NULL;
+  	pipe_cb->capacity = PIPE_MIN_CAPACITY;
+  	pipe_cb->fixed = 0;
+  	pipe_cb->stalls = 0;
+  	pipe_cb->peak = 0;
+  	pipe_cb->lowat = 0;
+  	pipe_cb->hiwat = PIPE_DEFAULT_HIWAT;
+  	pipe_cb->msg_max = 0;
+
+  	rlnode_init(&pipe_cb->rd_watchers, NULL);
+  	rlnode_init(&pipe_cb->wr_watchers, NULL);
 }
 
 /* Allocate memory for pipe control block */
@@ -57,6 +78,7 @@ PIPE_CB* acquire_PIPE_CB()
 
 void release_PIPE_CB(PIPE_CB* pipe_cb)
 {
+  	free(pipe_cb->BUFFER);
   	free(pipe_cb);
 }
 
@@ -84,21 +106,280 @@ int sys_Pipe(pipe_t* pipe)
 }
 
 
+/************************* Ring buffer *************************/
+
+/* 
+	Copy n bytes into the ring, which must have space for them. The 
+	bytes are copied in (at most) two segments, one up to the end of 
+	the buffer, and one from its start.
+ */
+static void pipe_put(PIPE_CB* pipe_cb, const char* buf, unsigned int n)
+{
+	if (pipe_cb->BUFFER == NULL)
+		pipe_cb->BUFFER = xmalloc(pipe_cb->capacity);
+
+	unsigned int first = pipe_cb->capacity - pipe_cb->w_position;
+	if (first > n) first = n;
+
+	memcpy(pipe_cb->BUFFER + pipe_cb->w_position, buf, first);
+	memcpy(pipe_cb->BUFFER, buf + first, n - first);
+
+	pipe_cb->w_position = (pipe_cb->w_position + n) % pipe_cb->capacity;
+	pipe_cb->buff_bytes += n;
+	if (pipe_cb->buff_bytes > pipe_cb->peak)
+		pipe_cb->peak = pipe_cb->buff_bytes;
+}
+
+static void pipe_resize(PIPE_CB* pipe_cb, unsigned int capacity);
+
+/* The smallest capacity of a pipe; a message pipe must fit its largest message */
+static inline unsigned int pipe_min_capacity(PIPE_CB* pipe_cb)
+{
+	unsigned int msg = (pipe_cb->msg_max) ? PIPE_MSG_HEADER + pipe_cb->msg_max : 0;
+	return (msg > PIPE_MIN_CAPACITY) ? msg : PIPE_MIN_CAPACITY;
+}
+
+/* 
+	Remove n bytes from the ring, which must hold them. When the ring 
+	becomes empty, an adaptive pipe that has used little of its capacity 
+	since it was last empty shrinks by half. 
+
+	Also, an empty adaptive pipe above the min. capacity frees its buffer, 
+	and the next write allocates it again; a pipe that grew under a bulk 
+	transfer does not keep its large buffer when it goes idle. A pipe at 
+	the min. capacity (e.g., one used for ping-pong messages) keeps its 
+	small buffer, so that it does not allocate on every message.
+ */
+static void pipe_consume(PIPE_CB* pipe_cb, unsigned int n)
+{
+	pipe_cb->r_position = (pipe_cb->r_position + n) % pipe_cb->capacity;
+	pipe_cb->buff_bytes -= n;
+
+	if (pipe_cb->buff_bytes == 0) {
+		unsigned int min_capacity = pipe_min_capacity(pipe_cb);
+		unsigned int capacity = pipe_cb->capacity;
+		if (!pipe_cb->fixed && capacity > min_capacity) {
+			if (pipe_cb->peak <= capacity/4)
+				capacity = (capacity/2 < min_capacity) ? min_capacity : capacity/2;
+			pipe_resize(pipe_cb, capacity);
+		}
+		pipe_cb->peak = 0;
+	}
+}
+
+/* Copy n bytes out of the ring, which must hold them, in (at most) two segments */
+static void pipe_peek(PIPE_CB* pipe_cb, char* buf, unsigned int n)
+{
+	unsigned int first = pipe_cb->capacity - pipe_cb->r_position;
+	if (first > n) first = n;
+
+	memcpy(buf, pipe_cb->BUFFER + pipe_cb->r_position, first);
+	memcpy(buf + first, pipe_cb->BUFFER, n - first);
+}
+
+/* Copy n bytes out of the ring and remove them */
+static void pipe_get(PIPE_CB* pipe_cb, char* buf, unsigned int n)
+{
+	pipe_peek(pipe_cb, buf, n);
+	pipe_consume(pipe_cb, n);
+}
+
+/* Move the contents of the ring into a new buffer of the given capacity */
+static void pipe_resize(PIPE_CB* pipe_cb, unsigned int capacity)
+{
+	unsigned int n = pipe_cb->buff_bytes;
+	assert(capacity >= n);
+
+	char* buffer = NULL;
+	if (n > 0) {
+		buffer = xmalloc(capacity);
+		unsigned int first = pipe_cb->capacity - pipe_cb->r_position;
+		if (first > n) first = n;
+		memcpy(buffer, pipe_cb->BUFFER + pipe_cb->r_position, first);
+		memcpy(buffer + first, pipe_cb->BUFFER, n - first);
+	}
+
+	/* An empty ring is allocated again by the next write */
+	free(pipe_cb->BUFFER);
+	pipe_cb->BUFFER = buffer;
+	pipe_cb->r_position = 0;
+	pipe_cb->w_position = n % capacity;
+
+	/* Stalls count towards growth at the same capacity only */
+	if (capacity != pipe_cb->capacity)
+		pipe_cb->stalls = 0;
+	pipe_cb->capacity = capacity;
+}
+
+/*
+	Called by a writer that found the ring full. An adaptive pipe doubles 
+	its capacity after PIPE_GROW_STALLS such writes at the same capacity.
+ */
+static void pipe_stalled(PIPE_CB* pipe_cb)
+{
+	if (pipe_cb->fixed || pipe_cb->capacity >= PIPE_ADAPTIVE_CAPACITY)
+		return;
+
+	if (++pipe_cb->stalls >= PIPE_GROW_STALLS)
+		pipe_resize(pipe_cb, 2*pipe_cb->capacity);
+}
+
+
+/* 
+	Watermarks. Readers sleep only on an empty ring, and writers only on a 
+	full one. Therefore, we only broadcast when there are waiters and the 
+	ring has crossed the respective watermark; this is once per empty to 
+	non-empty, or full to low transition, instead of once per call.
+ */
+
+/* The fill level at which sleeping writers are woken */
+static inline unsigned int pipe_lowat(PIPE_CB* pipe_cb)
+{
+	if (pipe_cb->lowat == 0)
+		return pipe_cb->capacity/2;
+	return (pipe_cb->lowat < pipe_cb->capacity) ? pipe_cb->lowat : pipe_cb->capacity-1;
+}
+
+/* The fill level at which sleeping readers are woken */
+static inline unsigned int pipe_hiwat(PIPE_CB* pipe_cb)
+{
+	return (pipe_cb->hiwat < pipe_cb->capacity) ? pipe_cb->hiwat : pipe_cb->capacity;
+}
+
+/* Called after data were added to the ring */
+static void pipe_data_added(PIPE_CB* pipe_cb)
+{
+	if (pipe_cb->buff_bytes >= pipe_hiwat(pipe_cb) && kernel_has_waiters(&pipe_cb->has_data))
+		kernel_broadcast(&pipe_cb->has_data);
+	stream_notify(&pipe_cb->rd_watchers);
+}
+
+/* Called after data were removed from the ring */
+static void pipe_data_removed(PIPE_CB* pipe_cb)
+{
+	if (pipe_cb->buff_bytes <= pipe_lowat(pipe_cb) && kernel_has_waiters(&pipe_cb->has_space))
+		kernel_broadcast(&pipe_cb->has_space);
+	stream_notify(&pipe_cb->wr_watchers);
+}
+
+
+/************************* Message pipes *************************/
+
+/*
+	In a message pipe, each message is stored in the ring as a header with
+	its length, followed by its bytes. A write puts the whole message into
+	the ring at once, or waits until it fits; since the copy is done under
+	the kernel lock, the messages of different writers never interleave.
+	A read removes exactly one message.
+ */
+
+static int pipe_msg_writev(PIPE_CB* pipe_cb, const iovec_t* iov, unsigned int iovcnt)
+{
+	unsigned int len = 0;
+	for (unsigned int i = 0; i < iovcnt; i++) {
+		if (iov[i].len > pipe_cb->msg_max - len)
+			return -1;
+		len += iov[i].len;
+	}
+
+	/* An empty message would read as end of file */
+	if (len == 0)
+		return 0;
+
+	unsigned int need = PIPE_MSG_HEADER + len;
+
+	if (pipe_cb->capacity - pipe_cb->buff_bytes < need)
+		pipe_stalled(pipe_cb);
+
+	while (pipe_cb->capacity - pipe_cb->buff_bytes < need && pipe_cb->reader != NULL) {
+		if (io_nonblocking())
+			return WOULDBLOCK;
+		kernel_wait(&pipe_cb->has_space, SCHED_PIPE);
+	}
+
+	if (pipe_cb->reader == NULL)
+		return -1;
+
+	pipe_put(pipe_cb, (const char*) &len, PIPE_MSG_HEADER);
+	for (unsigned int i = 0; i < iovcnt; i++)
+		pipe_put(pipe_cb, iov[i].base, iov[i].len);
+
+	pipe_data_added(pipe_cb);
+
+	return len;
+}
+
+
+/* The length of the next message, which must be in the ring */
+static unsigned int pipe_msg_next(PIPE_CB* pipe_cb)
+{
+	unsigned int len;
+	pipe_peek(pipe_cb, (char*) &len, PIPE_MSG_HEADER);
+	return len;
+}
+
+static int pipe_msg_readv(PIPE_CB* pipe_cb, const iovec_t* iov, unsigned int iovcnt)
+{
+	while (pipe_cb->buff_bytes == 0 && pipe_cb->writer != NULL) {
+		if (io_nonblocking())
+			return WOULDBLOCK;
+		kernel_wait(&pipe_cb->has_data, SCHED_PIPE);
+	}
+
+	if (pipe_cb->buff_bytes == 0)
+		return 0;
+
+	/* A message that does not fit stays in the pipe */
+	unsigned int len = pipe_msg_next(pipe_cb);
+	unsigned int room = 0;
+	for (unsigned int i = 0; i < iovcnt && room < len; i++)
+		room += iov[i].len;
+	if (room < len)
+		return -1;
+
+	pipe_consume(pipe_cb, PIPE_MSG_HEADER);
+	for (unsigned int i = 0, done = 0; done < len; i++) {
+		unsigned int n = (iov[i].len < len - done) ? iov[i].len : len - done;
+		pipe_get(pipe_cb, iov[i].base, n);
+		done += n;
+	}
+
+	pipe_data_removed(pipe_cb);
+
+	return len;
+}
+
+
 /************************* Writer Ops *************************/
 int pipe_write(void* pipecb_t, const char *buf, unsigned int n) 
 {
-	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
+	iovec_t iov = { (void*) buf, n };
+	return pipe_writev(pipecb_t, &iov, 1);
+}
 
-	int next;
-	int i;
+
+/* 
+	Write as many bytes of the segments as fit into the ring, and wake 
+	up the reader once for all of them.
+ */
+int pipe_writev(void* pipecb_t, const iovec_t* iov, unsigned int iovcnt)
+{
+	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
 
 	if (pipe_cb->writer == NULL || pipe_cb->reader == NULL){
 			
 		return -1;
 	}
 
-        while (pipe_cb->buff_bytes == PIPE_BUFFER_SIZE && pipe_cb->reader != NULL){  	// if the head + 1 == tail, circular buffer is full
-    		kernel_broadcast(&pipe_cb->has_data);
+	if (pipe_cb->msg_max)
+		return pipe_msg_writev(pipe_cb, iov, iovcnt);
+
+	if (pipe_cb->buff_bytes == pipe_cb->capacity)
+		pipe_stalled(pipe_cb);
+
+        while (pipe_cb->buff_bytes == pipe_cb->capacity && pipe_cb->reader != NULL){  	// if the head + 1 == tail, circular buffer is full
+		if (io_nonblocking())
+			return WOULDBLOCK;
 		kernel_wait(&pipe_cb->has_space, SCHED_PIPE);        	
     	}
 
@@ -106,27 +387,68 @@ int pipe_write(void* pipecb_t, const char *buf, unsigned int n)
     		return -1;
     	}
 
-    	int bytes_to_write;
+	unsigned int bytes_written = 0;
+	for (unsigned int i = 0; i < iovcnt && pipe_cb->buff_bytes < pipe_cb->capacity; i++) {
+		unsigned int bytes_to_write = pipe_cb->capacity - pipe_cb->buff_bytes;
+		if (iov[i].len < bytes_to_write)
+			bytes_to_write = iov[i].len;
 
-    	if (n < (PIPE_BUFFER_SIZE - pipe_cb->buff_bytes)) {
-    		bytes_to_write = n;
+		pipe_put(pipe_cb, iov[i].base, bytes_to_write);
+		bytes_written += bytes_to_write;
+	}
 
-    	} else {
-    		bytes_to_write = PIPE_BUFFER_SIZE - pipe_cb->buff_bytes;
-    	}
+	pipe_data_added(pipe_cb);
+	
+	return bytes_written;
+}
 
 
-    	for (i = 0 ; i < bytes_to_write; i++){
-		next = pipe_cb->w_position;
-    		pipe_cb->BUFFER[next] = buf[i];  									// Load data and then move
-    		pipe_cb->w_position = (next+1)%PIPE_BUFFER_SIZE; 
-    		pipe_cb->buff_bytes++;
-	}
+/* 
+	The free space of the ring, or 0 if the reader has closed. For a message
+	pipe, the size of the largest message that fits.
+ */
+int pipe_writer_available(void* pipecb_t, unsigned int* readable, unsigned int* writable)
+{
+	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
+	unsigned int space = pipe_cb->capacity - pipe_cb->buff_bytes;
 
+	if (pipe_cb->msg_max)
+		space = (space <= PIPE_MSG_HEADER) ? 0 
+			: (space - PIPE_MSG_HEADER < pipe_cb->msg_max) ? space - PIPE_MSG_HEADER : pipe_cb->msg_max;
 
-    	kernel_broadcast(&pipe_cb->has_data);
-	
-	return i;
+	*readable = 0;
+	*writable = (pipe_cb->reader == NULL) ? 0 : space;
+	return 0;
+}
+
+
+/* 
+	Writable if there is space (for a message pipe, for a message of the 
+	max. size), an error if the reader has closed 
+ */
+int pipe_writer_ready(void* pipecb_t)
+{
+	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
+
+	if (pipe_cb->reader == NULL)
+		return POLLERR;
+	if (pipe_cb->msg_max)
+		return (pipe_cb->capacity - pipe_cb->buff_bytes >= PIPE_MSG_HEADER + pipe_cb->msg_max) ? POLLOUT : 0;
+	return (pipe_cb->buff_bytes < pipe_cb->capacity) ? POLLOUT : 0;
+}
+
+/* Readers broadcast has_space when they read, or close */
+unsigned int pipe_writer_waitq(void* pipecb_t, int events, CondVar** wq)
+{
+	wq[0] = & ((PIPE_CB *) pipecb_t)->has_space;
+	return 1;
+}
+
+/* ... and notify wr_watchers along with it */
+unsigned int pipe_writer_watchers(void* pipecb_t, int events, rlnode** lists)
+{
+	lists[0] = & ((PIPE_CB *) pipecb_t)->wr_watchers;
+	return 1;
 }
 
 
@@ -148,6 +470,7 @@ int pipe_writer_close(void* _pipecb)
 	if (pipe_cb->reader != NULL){
 
 		kernel_broadcast(&pipe_cb->has_data);
+		stream_notify(&pipe_cb->rd_watchers);
 
 	} else {
 
@@ -160,48 +483,86 @@ int pipe_writer_close(void* _pipecb)
 
 /********************* Reader Ops *********************/
 int pipe_read(void* pipecb_t, char *buf, unsigned int n) 
+{
+	iovec_t iov = { buf, n };
+	return pipe_readv(pipecb_t, &iov, 1);
+}
+
+
+/* Read the available bytes into the segments, waking up the writer once */
+int pipe_readv(void* pipecb_t, const iovec_t* iov, unsigned int iovcnt)
 {
 	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
-	int next;
-	int i;
 
 	if (pipe_cb->reader == NULL){
       
     	return -1;
   	}
 
+	if (pipe_cb->msg_max)
+		return pipe_msg_readv(pipe_cb, iov, iovcnt);
+
     	while ((pipe_cb->buff_bytes == 0) && pipe_cb->writer != NULL ) { // if the head == tail, we don't have any data
-		kernel_broadcast(&pipe_cb->has_space);
+		if (io_nonblocking())
+			return WOULDBLOCK;
 		kernel_wait(&pipe_cb->has_data, SCHED_PIPE);
     	}
 
     	if (pipe_cb->buff_bytes == 0) 
 		return 0;
-	
 
-	//if (pipe_cb->w_position == pipe_cb->r_position || pipe_cb->buff_bytes == 0) //&& pipe_cb->writer == NULL
-    	//return -1;
+	unsigned int bytes_read = 0;
+	for (unsigned int i = 0; i < iovcnt && pipe_cb->buff_bytes > 0; i++) {
+		unsigned int bytes_to_read = pipe_cb->buff_bytes;
+		if (iov[i].len < bytes_to_read)
+			bytes_to_read = iov[i].len;
 
-    	int bytes_to_read;
+		pipe_get(pipe_cb, iov[i].base, bytes_to_read);
+		bytes_read += bytes_to_read;
+	}
 
-    	if (n < pipe_cb->buff_bytes) {
-    		bytes_to_read = n;
+	pipe_data_removed(pipe_cb);
 
-    	} else {
-      		bytes_to_read = pipe_cb->buff_bytes;
-    	}
+    return bytes_read;
+}
 
-    	for (i = 0; i < bytes_to_read; i++) {
-		next = (pipe_cb->r_position + 1)%PIPE_BUFFER_SIZE; // next is where tail will point to after this read.
-    		buf[i] = pipe_cb->BUFFER[pipe_cb->r_position]; 	// Read data and then move
-    		pipe_cb->r_position = next;  // tail to next offset.
-	
-		pipe_cb->buff_bytes--;	
-	}
 
-	kernel_broadcast(&pipe_cb->has_space);
+/* The bytes in the ring, or the length of the next message of a message pipe */
+int pipe_reader_available(void* pipecb_t, unsigned int* readable, unsigned int* writable)
+{
+	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
 
-    return i;
+	if (pipe_cb->msg_max)
+		*readable = (pipe_cb->buff_bytes > 0) ? pipe_msg_next(pipe_cb) : 0;
+	else
+		*readable = pipe_cb->buff_bytes;
+	*writable = 0;
+	return 0;
+}
+
+
+/* Readable if there are data up to the high watermark, or at EOF */
+int pipe_reader_ready(void* pipecb_t)
+{
+	PIPE_CB * pipe_cb = (PIPE_CB *) pipecb_t;
+
+	if (pipe_cb->writer == NULL)
+		return POLLIN | POLLHUP;
+	return ((unsigned int) pipe_cb->buff_bytes >= pipe_hiwat(pipe_cb)) ? POLLIN : 0;
+}
+
+/* Writers broadcast has_data when they write, or close */
+unsigned int pipe_reader_waitq(void* pipecb_t, int events, CondVar** wq)
+{
+	wq[0] = & ((PIPE_CB *) pipecb_t)->has_data;
+	return 1;
+}
+
+/* ... and notify rd_watchers along with it */
+unsigned int pipe_reader_watchers(void* pipecb_t, int events, rlnode** lists)
+{
+	lists[0] = & ((PIPE_CB *) pipecb_t)->rd_watchers;
+	return 1;
 }
 
 
@@ -223,6 +584,7 @@ int pipe_reader_close(void* _pipecb)
 	if (pipe_cb->writer != NULL){
 
 		kernel_broadcast(&pipe_cb->has_space);
+		stream_notify(&pipe_cb->wr_watchers);
 
 	} else {
 
@@ -232,3 +594,557 @@ int pipe_reader_close(void* _pipecb)
 	return 0;
 }
 
+
+
+/********************* Splice *********************/
+
+/* The pipe read by a stream, or NULL */
+static PIPE_CB* stream_read_pipe(FCB* fcb)
+{
+	if (fcb->streamfunc == &reader_file_ops)
+		return fcb->streamobj;
+	return socket_read_pipe(fcb);
+}
+
+/* The pipe written by a stream, or NULL */
+static PIPE_CB* stream_write_pipe(FCB* fcb)
+{
+	if (fcb->streamfunc == &writer_file_ops)
+		return fcb->streamobj;
+	return socket_write_pipe(fcb);
+}
+
+
+/*
+	Move up to n bytes from one pipe to another. As with pipe_read, we
+	block until there are data (or return 0 at end of file), and as with
+	pipe_write, until there is space. The data are copied from ring to 
+	ring, in (at most) two segments of the input ring.
+ */
+static int pipe_splice(PIPE_CB* in, PIPE_CB* out, unsigned int n)
+{
+	if (out->buff_bytes == out->capacity)
+		pipe_stalled(out);
+
+	while (1) {
+		if (in->reader == NULL || out->writer == NULL || out->reader == NULL)
+			return -1;
+
+		if (in->buff_bytes == 0) {
+			if (in->writer == NULL)
+				return 0;
+			if (io_nonblocking())
+				return WOULDBLOCK;
+			kernel_wait(&in->has_data, SCHED_PIPE);
+			continue;
+		}
+
+		if (out->buff_bytes == out->capacity) {
+			if (io_nonblocking())
+				return WOULDBLOCK;
+			kernel_wait(&out->has_space, SCHED_PIPE);
+			continue;
+		}
+
+		break;
+	}
+
+	unsigned int count = in->buff_bytes;
+	if (count > out->capacity - out->buff_bytes)
+		count = out->capacity - out->buff_bytes;
+	if (count > n)
+		count = n;
+
+	for (unsigned int done = 0; done < count; ) {
+		unsigned int seg = in->capacity - in->r_position;
+		if (seg > count - done) seg = count - done;
+
+		pipe_put(out, in->BUFFER + in->r_position, seg);
+		pipe_consume(in, seg);
+		done += seg;
+	}
+
+	pipe_data_removed(in);
+	pipe_data_added(out);
+
+	return count;
+}
+
+
+/* Syscall for splicing, returns the number of bytes moved, 0 at end of file, or -1 on error */
+int sys_Splice(Fid_t fd_in, Fid_t fd_out, unsigned int n)
+{
+	FCB* fcb_in = get_fcb(fd_in);
+	FCB* fcb_out = get_fcb(fd_out);
+
+	if (fcb_in == NULL || fcb_out == NULL)
+		return -1;
+
+	PIPE_CB* in = stream_read_pipe(fcb_in);
+	PIPE_CB* out = stream_write_pipe(fcb_out);
+
+	/* Splicing bytes would break the message boundaries */
+	if (in == NULL || out == NULL || in == out || in->msg_max || out->msg_max)
+		return -1;
+
+	if (n == 0)
+		return 0;
+
+	/* The streams must not be closed while we wait */
+	FCB_incref(fcb_in);
+	FCB_incref(fcb_out);
+
+	/* Either stream in non-blocking mode makes the splice non-blocking */
+	cur_thread()->io_nonblock = ((fcb_in->flags | fcb_out->flags) & FCB_NONBLOCK) != 0;
+	int retcode = pipe_splice(in, out, n);
+	cur_thread()->io_nonblock = 0;
+
+	if (retcode > 0) {
+		cur_thread()->usage.bytes_read += retcode;
+		cur_thread()->usage.bytes_written += retcode;
+	}
+
+	FCB_decref(fcb_out);
+	FCB_decref(fcb_in);
+
+	return retcode;
+}
+
+
+/* Syscall for pipe capacity, returns the capacity on success or -1 on error */
+int sys_SetPipeCapacity(Fid_t fd, unsigned int bytes)
+{
+	FCB* fcb = get_fcb(fd);
+	if (fcb == NULL)
+		return -1;
+
+	PIPE_CB* pipe_cb = stream_read_pipe(fcb);
+	if (pipe_cb == NULL)
+		pipe_cb = stream_write_pipe(fcb);
+	if (pipe_cb == NULL)
+		return -1;
+
+	/* Back to adaptive sizing */
+	if (bytes == 0) {
+		pipe_cb->fixed = 0;
+		pipe_cb->stalls = 0;
+		return pipe_cb->capacity;
+	}
+
+	if (bytes < pipe_min_capacity(pipe_cb) || bytes > PIPE_MAX_CAPACITY 
+		|| bytes < (unsigned int) pipe_cb->buff_bytes)
+		return -1;
+
+	pipe_resize(pipe_cb, bytes);
+	pipe_cb->fixed = 1;
+
+	/* Writers may find more space now */
+	kernel_broadcast(&pipe_cb->has_space);
+	stream_notify(&pipe_cb->wr_watchers);
+
+	return pipe_cb->capacity;
+}
+
+
+int sys_SetPipeWatermarks(Fid_t fd, unsigned int low, unsigned int high)
+{
+	FCB* fcb = get_fcb(fd);
+	if (fcb == NULL)
+		return -1;
+
+	PIPE_CB* pipe_cb = stream_read_pipe(fcb);
+	if (pipe_cb == NULL)
+		pipe_cb = stream_write_pipe(fcb);
+	if (pipe_cb == NULL || low >= PIPE_MAX_CAPACITY || high > PIPE_MAX_CAPACITY)
+		return -1;
+
+	/* 
+		A message reader must be woken by any message, and a message writer
+		waits for space for a whole message, not for a watermark.
+	 */
+	if (pipe_cb->msg_max)
+		return -1;
+
+	pipe_cb->lowat = low;
+	pipe_cb->hiwat = (high == 0) ? PIPE_DEFAULT_HIWAT : high;
+
+	/* Sleepers may be past the new watermarks */
+	pipe_data_added(pipe_cb);
+	pipe_data_removed(pipe_cb);
+
+	return 0;
+}
+
+
+/* Syscall for message pipes, returns 0 on success and -1 on error */
+int sys_MessagePipe(pipe_t* pipe, unsigned int max_size)
+{
+	if (max_size == 0 || max_size > PIPE_MAX_CAPACITY - PIPE_MSG_HEADER)
+		return -1;
+
+	if (sys_Pipe(pipe) == -1)
+		return -1;
+
+	PIPE_CB* pipe_cb = get_fcb(pipe->read)->streamobj;
+	pipe_cb->msg_max = max_size;
+	pipe_cb->capacity = pipe_min_capacity(pipe_cb);
+
+	return 0;
+}
+
+
+
+/********************* Broadcast pipes *********************/
+
+/*
+	A broadcast pipe has one writer and any number of readers. The data
+	are kept once, in the ring of a PIPE_CB, and every reader has its own
+	cursor into them. Cursors are positions in the stream of all bytes 
+	written, and the byte at position p is in BUFFER[p % capacity]; for 
+	this reason, the capacity of the ring is fixed.
+
+	The ring holds the bytes from position written-buff_bytes onwards. In
+	BCAST_BLOCK mode, that is the cursor of the slowest reader, and the 
+	writer waits while the ring is full. In BCAST_SKIP mode, the writer
+	drops the oldest bytes to make space, and readers whose cursor falls 
+	behind the ring skip ahead.
+ */
+
+typedef struct broadcast_control_block {
+	PIPE_CB ring;			/* the ring; ring.reader is unused */
+	unsigned long written;	/* the bytes written so far */
+	bcast_mode mode;
+	rlnode readers;			/* the cursors of the readers */
+	unsigned int nreaders;
+} BCAST_CB;
+
+typedef struct broadcast_reader {
+	BCAST_CB* bc;
+	unsigned long pos;		/* the next byte to read */
+	rlnode reader_node;
+} BCAST_READER;
+
+
+/* The position of the oldest byte in the ring */
+static inline unsigned long bcast_oldest(BCAST_CB* bc)
+{
+	return bc->written - bc->ring.buff_bytes;
+}
+
+/* Drop from the ring the bytes that all readers are done with */
+static void bcast_trim(BCAST_CB* bc)
+{
+	unsigned long oldest = bc->written;
+	for (rlnode* n = bc->readers.next; n != &bc->readers; n = n->next) {
+		BCAST_READER* r = n->obj;
+		if (r->pos < oldest) oldest = r->pos;
+	}
+
+	unsigned long keep = bc->written - oldest;
+	if (keep < (unsigned long) bc->ring.buff_bytes) {
+		pipe_consume(&bc->ring, bc->ring.buff_bytes - keep);
+		pipe_data_removed(&bc->ring);
+	}
+}
+
+static void bcast_release(BCAST_CB* bc)
+{
+	free(bc->ring.BUFFER);
+	free(bc);
+}
+
+
+static int bcast_writev(void* bccb, const iovec_t* iov, unsigned int iovcnt)
+{
+	BCAST_CB* bc = bccb;
+	PIPE_CB* ring = &bc->ring;
+
+	if (bc->mode == BCAST_BLOCK) {
+		while (ring->buff_bytes == ring->capacity && bc->nreaders > 0) {
+			if (io_nonblocking())
+				return WOULDBLOCK;
+			kernel_wait(&ring->has_space, SCHED_PIPE);
+		}
+	}
+
+	if (bc->nreaders == 0)
+		return -1;
+
+	/* A blocking writer fills the free space, a skipping one up to the whole ring */
+	unsigned int room = (bc->mode == BCAST_BLOCK) ? ring->capacity - ring->buff_bytes : ring->capacity;
+	unsigned int bytes_written = 0;
+
+	for (unsigned int i = 0; i < iovcnt && bytes_written < room; i++) {
+		unsigned int n = room - bytes_written;
+		if (iov[i].len < n) n = iov[i].len;
+
+		unsigned int space = ring->capacity - ring->buff_bytes;
+		if (space < n)
+			pipe_consume(ring, n - space);
+
+		pipe_put(ring, iov[i].base, n);
+		bc->written += n;
+		bytes_written += n;
+	}
+
+	pipe_data_added(ring);
+
+	return bytes_written;
+}
+
+static int bcast_write(void* bccb, const char* buf, unsigned int n)
+{
+	iovec_t iov = { (void*) buf, n };
+	return bcast_writev(bccb, &iov, 1);
+}
+
+
+static int bcast_readv(void* rcb, const iovec_t* iov, unsigned int iovcnt)
+{
+	BCAST_READER* r = rcb;
+	BCAST_CB* bc = r->bc;
+	PIPE_CB* ring = &bc->ring;
+
+	while (1) {
+		if (r->pos < bcast_oldest(bc))
+			r->pos = bcast_oldest(bc);
+		if (r->pos < bc->written)
+			break;
+		if (ring->writer == NULL)
+			return 0;
+		if (io_nonblocking())
+			return WOULDBLOCK;
+		kernel_wait(&ring->has_data, SCHED_PIPE);
+	}
+
+	unsigned int bytes_read = 0;
+	for (unsigned int i = 0; i < iovcnt && r->pos < bc->written; i++) {
+		unsigned int n = bc->written - r->pos;
+		if (iov[i].len < n) n = iov[i].len;
+
+		unsigned int first = ring->capacity - r->pos % ring->capacity;
+		if (first > n) first = n;
+		memcpy(iov[i].base, ring->BUFFER + r->pos % ring->capacity, first);
+		memcpy((char*) iov[i].base + first, ring->BUFFER, n - first);
+
+		r->pos += n;
+		bytes_read += n;
+	}
+
+	bcast_trim(bc);
+
+	return bytes_read;
+}
+
+static int bcast_read(void* rcb, char* buf, unsigned int n)
+{
+	iovec_t iov = { buf, n };
+	return bcast_readv(rcb, &iov, 1);
+}
+
+
+static int bcast_writer_available(void* bccb, unsigned int* readable, unsigned int* writable)
+{
+	BCAST_CB* bc = bccb;
+
+	*readable = 0;
+	if (bc->nreaders == 0)
+		*writable = 0;
+	else
+		*writable = (bc->mode == BCAST_BLOCK) ? bc->ring.capacity - bc->ring.buff_bytes : bc->ring.capacity;
+	return 0;
+}
+
+static int bcast_reader_available(void* rcb, unsigned int* readable, unsigned int* writable)
+{
+	BCAST_READER* r = rcb;
+	unsigned long oldest = bcast_oldest(r->bc);
+
+	*readable = r->bc->written - ((r->pos < oldest) ? oldest : r->pos);
+	*writable = 0;
+	return 0;
+}
+
+static int bcast_writer_ready(void* bccb)
+{
+	BCAST_CB* bc = bccb;
+
+	if (bc->nreaders == 0)
+		return POLLERR;
+	if (bc->mode == BCAST_SKIP)
+		return POLLOUT;
+	return ((unsigned int) bc->ring.buff_bytes < bc->ring.capacity) ? POLLOUT : 0;
+}
+
+static int bcast_reader_ready(void* rcb)
+{
+	BCAST_READER* r = rcb;
+
+	if (r->pos < r->bc->written)
+		return POLLIN;
+	return (r->bc->ring.writer == NULL) ? POLLIN | POLLHUP : 0;
+}
+
+static unsigned int bcast_writer_waitq(void* bccb, int events, CondVar** wq)
+{
+	return pipe_writer_waitq(& ((BCAST_CB*) bccb)->ring, events, wq);
+}
+
+static unsigned int bcast_reader_waitq(void* rcb, int events, CondVar** wq)
+{
+	return pipe_reader_waitq(& ((BCAST_READER*) rcb)->bc->ring, events, wq);
+}
+
+static unsigned int bcast_writer_watchers(void* bccb, int events, rlnode** lists)
+{
+	return pipe_writer_watchers(& ((BCAST_CB*) bccb)->ring, events, lists);
+}
+
+static unsigned int bcast_reader_watchers(void* rcb, int events, rlnode** lists)
+{
+	return pipe_reader_watchers(& ((BCAST_READER*) rcb)->bc->ring, events, lists);
+}
+
+
+static int bcast_writer_close(void* bccb)
+{
+	BCAST_CB* bc = bccb;
+
+	bc->ring.writer = NULL;
+
+	if (bc->nreaders > 0) {
+		kernel_broadcast(&bc->ring.has_data);
+		stream_notify(&bc->ring.rd_watchers);
+	} else {
+		bcast_release(bc);
+	}
+
+	return 0;
+}
+
+static int bcast_reader_close(void* rcb)
+{
+	BCAST_READER* r = rcb;
+	BCAST_CB* bc = r->bc;
+
+	rlist_remove(&r->reader_node);
+	bc->nreaders--;
+	free(r);
+
+	if (bc->nreaders == 0 && bc->ring.writer == NULL) {
+		bcast_release(bc);
+		return 0;
+	}
+
+	bcast_trim(bc);
+
+	/* Without readers, writes fail */
+	if (bc->nreaders == 0) {
+		kernel_broadcast(&bc->ring.has_space);
+		stream_notify(&bc->ring.wr_watchers);
+	}
+
+	return 0;
+}
+
+
+static file_ops bcast_writer_file_ops = {
+	.Open = NULL,
+	.Read = reader_blocked,
+	.Write = bcast_write,
+	.WriteV = bcast_writev,
+	.Available = bcast_writer_available,
+	.Ready = bcast_writer_ready,
+	.WaitQueues = bcast_writer_waitq,
+	.Watchers = bcast_writer_watchers,
+	.Close = bcast_writer_close
+};
+
+static file_ops bcast_reader_file_ops = {
+	.Open = NULL,
+	.Read = bcast_read,
+	.ReadV = bcast_readv,
+	.Write = writer_blocked,
+	.Available = bcast_reader_available,
+	.Ready = bcast_reader_ready,
+	.WaitQueues = bcast_reader_waitq,
+	.Watchers = bcast_reader_watchers,
+	.Close = bcast_reader_close
+};
+
+
+/* Make fcb a new reader, which will read the bytes written from now on */
+static void bcast_add_reader(BCAST_CB* bc, FCB* fcb)
+{
+	BCAST_READER* r = xmalloc(sizeof(BCAST_READER));
+	r->bc = bc;
+	r->pos = bc->written;
+	rlnode_init(&r->reader_node, r);
+	rlist_push_back(&bc->readers, &r->reader_node);
+	bc->nreaders++;
+
+	fcb->streamobj = r;
+	fcb->streamfunc = &bcast_reader_file_ops;
+}
+
+
+/* Syscall for broadcast pipes, returns 0 on success and -1 on error */
+int sys_BroadcastPipe(pipe_t* pipe, unsigned int capacity, bcast_mode mode)
+{
+	if (capacity == 0)
+		capacity = BCAST_DEFAULT_CAPACITY;
+	if (capacity < PIPE_MIN_CAPACITY || capacity > PIPE_MAX_CAPACITY
+		|| (mode != BCAST_BLOCK && mode != BCAST_SKIP))
+		return -1;
+
+	Fid_t fid[2];
+	FCB* fcb[2];
+
+	if (FCB_reserve(2, fid, fcb) != 1)
+		return -1;
+
+	BCAST_CB* bc = xmalloc(sizeof(BCAST_CB));
+	initialize_PIPE_CB(&bc->ring, pipe, fid, fcb);
+	bc->ring.reader = NULL;
+	bc->ring.capacity = capacity;
+	bc->ring.fixed = 1;
+	bc->written = 0;
+	bc->mode = mode;
+	rlnode_init(&bc->readers, NULL);
+	bc->nreaders = 0;
+
+	bcast_add_reader(bc, fcb[0]);
+	fcb[1]->streamobj = bc;
+	fcb[1]->streamfunc = &bcast_writer_file_ops;
+
+	return 0;
+}
+
+
+/* Syscall for broadcast readers, returns a new reader or NOFILE */
+Fid_t sys_BroadcastReader(Fid_t fd)
+{
+	FCB* fcb = get_fcb(fd);
+	if (fcb == NULL)
+		return NOFILE;
+
+	BCAST_CB* bc;
+	if (fcb->streamfunc == &bcast_writer_file_ops)
+		bc = fcb->streamobj;
+	else if (fcb->streamfunc == &bcast_reader_file_ops)
+		bc = ((BCAST_READER*) fcb->streamobj)->bc;
+	else
+		return NOFILE;
+
+	/* The pipe cannot take new readers once the writer has gone */
+	if (bc->ring.writer == NULL)
+		return NOFILE;
+
+	Fid_t fid;
+	FCB* rfcb;
+	if (FCB_reserve(1, &fid, &rfcb) != 1)
+		return NOFILE;
+
+	bcast_add_reader(bc, rfcb);
+	return fid;
+}
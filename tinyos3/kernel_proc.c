@@ -16,18 +16,89 @@
 
  */
 
-/* The process table */
-PCB PT[MAX_PROC];
+/* 
+  The process table. 
+
+  PCBs are allocated in chunks of PT_CHUNK_SIZE, when the free PCBs run
+  out. Chunk c holds the PCBs of pids c*PT_CHUNK_SIZE up to 
+  (c+1)*PT_CHUNK_SIZE-1, therefore the PCB of a pid is found in O(1).
+  A chunk is never released until the next boot.
+ */
+#define PT_CHUNK_SIZE 256
+#define PT_CHUNKS (MAX_PROC/PT_CHUNK_SIZE)
+
+PCB* PT[PT_CHUNKS];
+static unsigned int pt_chunks;    /* the number of allocated chunks */
 unsigned int process_count;
 
+/* 
+  An index of the non-free PCBs, as a two-level bitmap: bit p of 
+  pcb_used is set iff PT[p] is not FREE, and bit w of pcb_used_summary
+  is set iff word w of pcb_used is not zero. This allows visiting the
+  used PCBs without touching the free ones.
+ */
+#define PCB_USED_WORDS ((MAX_PROC+BITS_PER_WORD-1)/BITS_PER_WORD)
+#define PCB_SUMMARY_WORDS ((PCB_USED_WORDS+BITS_PER_WORD-1)/BITS_PER_WORD)
+
+static unsigned long pcb_used[PCB_USED_WORDS];
+static unsigned long pcb_used_summary[PCB_SUMMARY_WORDS];
+
+static inline void mark_pcb_used(Pid_t pid)
+{
+  unsigned int w = pid/BITS_PER_WORD;
+  pcb_used[w] |= 1ul << (pid%BITS_PER_WORD);
+  pcb_used_summary[w/BITS_PER_WORD] |= 1ul << (w%BITS_PER_WORD);
+}
+
+static inline void mark_pcb_free(Pid_t pid)
+{
+  unsigned int w = pid/BITS_PER_WORD;
+  pcb_used[w] &= ~(1ul << (pid%BITS_PER_WORD));
+  if(pcb_used[w]==0)
+    pcb_used_summary[w/BITS_PER_WORD] &= ~(1ul << (w%BITS_PER_WORD));
+}
+
+/*
+  Return the smallest non-free pid which is >= pid, or MAX_PROC if
+  there is none.
+ */
+static Pid_t next_used_pid(Pid_t pid)
+{
+  if(pid >= MAX_PROC) return MAX_PROC;
+
+  /* Look in the word of pid first */
+  unsigned int w = pid/BITS_PER_WORD;
+  unsigned long bits = pcb_used[w] & (~0ul << (pid%BITS_PER_WORD));
+  if(bits)
+    return w*BITS_PER_WORD + __builtin_ctzl(bits);
+
+  /* Then, find the next non-zero word through the summary */
+  w++;
+  if(w >= PCB_USED_WORDS) return MAX_PROC;
+
+  unsigned int sw = w/BITS_PER_WORD;
+  unsigned long sbits = pcb_used_summary[sw] & (~0ul << (w%BITS_PER_WORD));
+  while(sbits == 0) {
+    if(++sw >= PCB_SUMMARY_WORDS) return MAX_PROC;
+    sbits = pcb_used_summary[sw];
+  }
+
+  unsigned int nw = sw*BITS_PER_WORD + __builtin_ctzl(sbits);
+  return nw*BITS_PER_WORD + __builtin_ctzl(pcb_used[nw]);
+}
+
 PCB* get_pcb(Pid_t pid)
 {
-  return PT[pid].pstate==FREE ? NULL : &PT[pid];
+  if(pid<0 || pid>=MAX_PROC) return NULL;
+  PCB* chunk = PT[pid/PT_CHUNK_SIZE];
+  if(chunk==NULL) return NULL;
+  PCB* pcb = & chunk[pid%PT_CHUNK_SIZE];
+  return pcb->pstate==FREE ? NULL : pcb;
 }
 
 Pid_t get_pid(PCB* pcb)
 {
-  return pcb==NULL ? NOPROC : pcb-PT;
+  return pcb==NULL ? NOPROC : pcb->pid;
 }
 
 /* Initialize a PTCB */
@@ -42,7 +113,8 @@ void initialize_PTCB(PTCB* ptcb)
   ptcb->exit_cv = COND_INIT;
   ptcb->refcount = 0;
 
-  rlnode_init(& ptcb->ptcb_list_node, ptcb);
+  ptcb->tid = NOTHREAD;
+  rlnode_init(& ptcb->exit_node, ptcb);
 }
 
 /* Initialize a PCB */
@@ -52,48 +124,90 @@ static inline void initialize_PCB(PCB* pcb)
   pcb->argl = 0;
   pcb->args = NULL;
 
-  for(int i=0;i<MAX_FILEID;i++)
-    pcb->FIDT[i] = NULL;
+  pcb->FIDT = NULL;
+  pcb->fid_used = NULL;
+  pcb->fidt_size = 0;
 
   rlnode_init(& pcb->children_list, NULL);
   rlnode_init(& pcb->exited_list, NULL);
   rlnode_init(& pcb->children_node, pcb);
   rlnode_init(& pcb->exited_node, pcb);
   pcb->child_exit = COND_INIT;
+  pcb->exit_wait = COND_INIT;
 
-  rlnode_init(&pcb->ptcb_list, NULL);
+  pcb->thread_table = NULL;
+  pcb->thread_table_size = 0;
+  pcb->thread_table_free = NO_THREAD_HANDLE;
   pcb->thread_count = 0;
+  pcb->joinable_count = 0;
+  rlnode_init(& pcb->exited_threads, NULL);
+  pcb->thread_exit = COND_INIT;
 }
 
 
 static PCB* pcb_freelist;
 
-void initialize_processes()
+/* 
+  Allocate and initialize the next chunk of PCBs, and add them to the 
+  free list so that the lowest pid is acquired first. Returns 0 if the
+  process table is full.
+*/
+static int grow_process_table()
 {
-  /* initialize the PCBs */
-  for(Pid_t p=0; p<MAX_PROC; p++) {
-    initialize_PCB(&PT[p]);
+  if(pt_chunks == PT_CHUNKS) return 0;
+
+  PCB* chunk = (PCB*)xmalloc(PT_CHUNK_SIZE*sizeof(PCB));
+  for(int i=PT_CHUNK_SIZE-1; i>=0; i--) {
+    initialize_PCB(&chunk[i]);
+    chunk[i].pid = pt_chunks*PT_CHUNK_SIZE + i;
+    chunk[i].parent = pcb_freelist;
+    pcb_freelist = &chunk[i];
   }
 
-  /* use the parent field to build a free list */
-  PCB* pcbiter;
-  pcb_freelist = NULL;
-  for(pcbiter = PT+MAX_PROC; pcbiter!=PT; ) {
-    --pcbiter;
-    pcbiter->parent = pcb_freelist;
-    pcb_freelist = pcbiter;
+  PT[pt_chunks++] = chunk;
+  return 1;
+}
+
+void initialize_processes()
+{
+  /* drop the chunks of a previous boot */
+  for(unsigned int c=0; c<pt_chunks; c++) {
+    free(PT[c]);
+    PT[c] = NULL;
   }
+  pt_chunks = 0;
+  pcb_freelist = NULL;
 
   process_count = 0;                                    
+  memset(pcb_used, 0, sizeof(pcb_used));
+  memset(pcb_used_summary, 0, sizeof(pcb_used_summary));
 
   /* Execute a null "idle" process */
   if(Exec(NULL,0,NULL)!=0)
     FATAL("The scheduler process does not have pid==0");
 }
 
+/*
+  PTCBs are allocated in slabs of PTCB_SLAB_SIZE. Released PTCBs are kept
+  in a free list (linked by the next_free field) for reuse.
+
+  Must be called with kernel_mutex held
+*/
+#define PTCB_SLAB_SIZE 64
+static PTCB* ptcb_freelist = NULL;
+
 PTCB* acquire_PTCB()
 {
-  PTCB* ptcb = (PTCB*)xmalloc(sizeof(PTCB));              // Allocate space
+  if(ptcb_freelist == NULL) {
+    PTCB* slab = (PTCB*)xmalloc(PTCB_SLAB_SIZE*sizeof(PTCB));
+    for(int i=PTCB_SLAB_SIZE-1; i>=0; i--) {
+      slab[i].next_free = ptcb_freelist;
+      ptcb_freelist = &slab[i];
+    }
+  }
+
+  PTCB* ptcb = ptcb_freelist;
+  ptcb_freelist = ptcb->next_free;
   return ptcb;
 }
 
@@ -104,11 +218,14 @@ PCB* acquire_PCB()
 {
   PCB* pcb = NULL;
 
-  if(pcb_freelist != NULL) {
+  if(pcb_freelist != NULL || grow_process_table()) {
     pcb = pcb_freelist;
     pcb->pstate = ALIVE;
     pcb_freelist = pcb_freelist->parent;
+    memset(&pcb->usage, 0, sizeof(rusage_t));
+    memset(&pcb->children_usage, 0, sizeof(rusage_t));
     process_count++;
+    mark_pcb_used(get_pid(pcb));
   }
 
   return pcb;
@@ -116,7 +233,76 @@ PCB* acquire_PCB()
 
 void release_PTCB(PTCB* ptcb)
 {
-  free(ptcb);
+  ptcb->next_free = ptcb_freelist;
+  ptcb_freelist = ptcb;
+}
+
+
+/*
+ *
+ * Thread handles
+ *
+ */
+
+/* The initial size of a thread handle table */
+#define THREAD_TABLE_INIT 8
+
+/* The max. number of slots, so that slot+1 fits in THREAD_HANDLE_BITS */
+#define MAX_THREAD_HANDLES ((1u<<THREAD_HANDLE_BITS)-1)
+
+#define TID_SLOT_MASK ((((Tid_t)1)<<THREAD_HANDLE_BITS)-1)
+
+Tid_t acquire_tid(PCB* pcb, PTCB* ptcb)
+{
+  if(pcb->thread_table_free == NO_THREAD_HANDLE) {
+    /* Grow the table, doubling its size */
+    unsigned int oldsize = pcb->thread_table_size;
+    unsigned int newsize = (oldsize==0) ? THREAD_TABLE_INIT : 2*oldsize;
+    if(newsize > MAX_THREAD_HANDLES) newsize = MAX_THREAD_HANDLES;
+    if(newsize == oldsize) return NOTHREAD;
+
+    pcb->thread_table = xrealloc(pcb->thread_table, newsize*sizeof(thread_handle));
+    for(unsigned int i=newsize; i>oldsize; ) {
+      i--;
+      pcb->thread_table[i].ptcb = NULL;
+      pcb->thread_table[i].gen = 0;
+      pcb->thread_table[i].next_free = pcb->thread_table_free;
+      pcb->thread_table_free = i;
+    }
+    pcb->thread_table_size = newsize;
+  }
+
+  unsigned int slot = pcb->thread_table_free;
+  thread_handle* h = & pcb->thread_table[slot];
+  pcb->thread_table_free = h->next_free;
+  h->ptcb = ptcb;
+
+  ptcb->tid = (((Tid_t) h->gen) << THREAD_HANDLE_BITS) | (slot+1);
+  return ptcb->tid;
+}
+
+PTCB* get_ptcb(PCB* pcb, Tid_t tid)
+{
+  Tid_t slot = (tid & TID_SLOT_MASK) - 1;   /* NOTHREAD wraps around */
+  if(slot >= pcb->thread_table_size) return NULL;
+
+  thread_handle* h = & pcb->thread_table[slot];
+  if(h->ptcb == NULL || (Tid_t)h->gen != (tid >> THREAD_HANDLE_BITS)) return NULL;
+  return h->ptcb;
+}
+
+void release_thread(PCB* pcb, PTCB* ptcb)
+{
+  unsigned int slot = (ptcb->tid & TID_SLOT_MASK) - 1;
+  thread_handle* h = & pcb->thread_table[slot];
+  assert(h->ptcb == ptcb);
+
+  h->ptcb = NULL;
+  h->gen++;
+  h->next_free = pcb->thread_table_free;
+  pcb->thread_table_free = slot;
+
+  release_PTCB(ptcb);
 }
 
 /*
@@ -128,6 +314,7 @@ void release_PCB(PCB* pcb)
   pcb->parent = pcb_freelist;
   pcb_freelist = pcb;
   process_count--;
+  mark_pcb_free(get_pid(pcb));
 }
 
 
@@ -169,20 +356,16 @@ void start_process_thread()                         // corresponding to start_ma
 } 
 
 /*
-	System call to create a new process.
+	Create a new process, child of the current process. Returns NULL if 
+  we have run out of PIDs.
  */
-Pid_t sys_Exec(Task call, int argl, void* args)
+static PCB* create_process(Task call, int argl, void* args)
 {
   PCB *curproc, *newproc;
-  PTCB* new_process_thread;
   
   /* The new process PCB */
   newproc = acquire_PCB();
 
-  /* The new process PTCB */
-  new_process_thread = acquire_PTCB();
-  initialize_PTCB(new_process_thread);
-
   if(newproc == NULL) goto finish;  /* We have run out of PIDs! */
 
   if(get_pid(newproc)<=1) {
@@ -200,11 +383,7 @@ Pid_t sys_Exec(Task call, int argl, void* args)
     rlist_push_front(& curproc->children_list, & newproc->children_node);
 
     /* Inherit file streams from parent */
-    for(int i=0; i<MAX_FILEID; i++) {
-       newproc->FIDT[i] = curproc->FIDT[i];
-       if(newproc->FIDT[i])
-          FCB_incref(newproc->FIDT[i]);
-    }
+    FIDT_copy(newproc, curproc);
   }
 
 
@@ -226,18 +405,52 @@ Pid_t sys_Exec(Task call, int argl, void* args)
     the initialization of the PCB.
    */
   if(call != NULL) {
+    /* The new process PTCB */
+    PTCB* new_process_thread = acquire_PTCB();
+    initialize_PTCB(new_process_thread);
+    acquire_tid(newproc, new_process_thread);
+
     newproc->main_thread = spawn_thread(newproc, new_process_thread, start_main_thread);
+    new_process_thread->tcb = newproc->main_thread;
     new_process_thread->task = call;
     new_process_thread->argl = argl;
     new_process_thread->args = args;
     newproc->thread_count++;
-    rlist_push_back(&newproc->ptcb_list, &new_process_thread->ptcb_list_node);
+    newproc->joinable_count++;
     wakeup(newproc->main_thread);
   }
 
 
 finish:
-  return get_pid(newproc);
+  return newproc;
+}
+
+
+/*
+	System call to create a new process.
+ */
+Pid_t sys_Exec(Task call, int argl, void* args)
+{
+  return get_pid(create_process(call, argl, args));
+}
+
+
+/*
+  System call to create many new processes in one go.
+ */
+int sys_ExecMany(Task call, unsigned int n, const exec_args* argv, Pid_t* pids)
+{
+  if(call==NULL || pids==NULL) return -1;
+
+  unsigned int i;
+  for(i=0; i<n; i++) {
+    PCB* newproc = argv ? create_process(call, argv[i].argl, argv[i].args)
+                        : create_process(call, 0, NULL);
+    if(newproc == NULL) break;
+    pids[i] = get_pid(newproc);
+  }
+
+  return i;
 }
 
 
@@ -259,14 +472,22 @@ static void cleanup_zombie(PCB* pcb, int* status)
   if(status != NULL)
     *status = pcb->exitval;
 
+  /* All threads of a zombie have exited */
+  PCB* parent = pcb->parent;
+  rusage_add(& parent->children_usage, & pcb->usage);
+  rusage_add(& parent->children_usage, & pcb->children_usage);
+
   rlist_remove(& pcb->children_node);
   rlist_remove(& pcb->exited_node);
 
+  /* Other threads waiting for this process will find it gone */
+  kernel_broadcast(& pcb->exit_wait);
+
   release_PCB(pcb);
 }
 
 
-static Pid_t wait_for_specific_child(Pid_t cpid, int* status)
+static Pid_t wait_for_specific_child(Pid_t cpid, int* status, TimerDuration deadline)
 {
 
   /* Legality checks */
@@ -284,8 +505,21 @@ static Pid_t wait_for_specific_child(Pid_t cpid, int* status)
   }
 
   /* Ok, child is a legal child of mine. Wait for it to exit. */
-  while(child->pstate == ALIVE)
-    kernel_wait(& parent->child_exit, SCHED_USER);
+  while(child->pstate == ALIVE) {
+    int woken = kernel_wait_until(& child->exit_wait, SCHED_USER, deadline);
+
+    /* Another thread may have cleaned up the child meanwhile */
+    if(get_pcb(cpid) != child || child->parent != parent) {
+      cpid = NOPROC;
+      goto finish;
+    }
+
+    /* Timed out */
+    if(!woken && child->pstate == ALIVE) {
+      cpid = NOPROC;
+      goto finish;
+    }
+  }
   
   cleanup_zombie(child, status);
   
@@ -294,7 +528,7 @@ finish:
 }
 
 
-static Pid_t wait_for_any_child(int* status)
+static Pid_t wait_for_any_child(int* status, TimerDuration deadline)
 {
   Pid_t cpid;
 
@@ -309,7 +543,12 @@ static Pid_t wait_for_any_child(int* status)
     has_exited = ! is_rlist_empty(& parent->exited_list);
     if( has_exited ) break;
 
-    kernel_wait(& parent->child_exit, SCHED_USER);    
+    /* On timeout, check once more for an exited child */
+    if(! kernel_wait_until(& parent->child_exit, SCHED_USER, deadline)) {
+      if(is_rlist_empty(& parent->exited_list))
+        return NOPROC;
+      break;
+    }
   }
 
   if(no_children)
@@ -328,16 +567,54 @@ Pid_t sys_WaitChild(Pid_t cpid, int* status)
 {
   /* Wait for specific child. */
   if(cpid != NOPROC) {
-    return wait_for_specific_child(cpid, status);
+    return wait_for_specific_child(cpid, status, NO_TIMEOUT);
   }
   /* Wait for any child */
   else {
-    return wait_for_any_child(status);
+    return wait_for_any_child(status, NO_TIMEOUT);
   }
 
 }
 
 
+Pid_t sys_WaitChildTimeout(Pid_t cpid, int* status, timeout_t timeout)
+{
+  TimerDuration deadline = kernel_deadline(timeout);
+
+  if(cpid != NOPROC)
+    return wait_for_specific_child(cpid, status, deadline);
+  else
+    return wait_for_any_child(status, deadline);
+}
+
+
+int sys_WaitChildren(Pid_t* pids, int* exitvals, unsigned int n)
+{
+  if(pids==NULL || n==0) return -1;
+
+  PCB* parent = CURPROC;
+
+  /* Wait until some child has exited */
+  while(is_rlist_empty(& parent->exited_list)) {
+    if(is_rlist_empty(& parent->children_list))
+      return 0;
+    kernel_wait(& parent->child_exit, SCHED_USER);
+  }
+
+  /* Reap as many as requested */
+  unsigned int count = 0;
+  while(count<n && ! is_rlist_empty(& parent->exited_list)) {
+    PCB* child = parent->exited_list.next->pcb;
+    assert(child->pstate == ZOMBIE);
+    pids[count] = get_pid(child);
+    cleanup_zombie(child, exitvals ? &exitvals[count] : NULL);
+    count++;
+  }
+
+  return count;
+}
+
+
 void sys_Exit(int exitval)
 {
   PCB *curproc = CURPROC;  /* cache for efficiency */
@@ -367,56 +644,81 @@ static file_ops info_file_ops = {
 
 };
 
-int procinfo_read (void* pinfocb_t, char *buf, unsigned int n)
+void get_process_usage(PCB* pcb, rusage_t* usage)
 {
-  procinfo_cb* pinfo = (procinfo_cb*) pinfocb_t;
-
-  procinfo* prinfo = &pinfo->prinfo;
-
-  while(pinfo->cursor < MAX_PROC-1){
-
-    if(PT[pinfo->cursor].pstate == FREE){
-      pinfo->cursor++;
-    }
-
-    else{
-      prinfo->pid = get_pid(&PT[pinfo->cursor]);
-      prinfo->ppid = get_pid(PT[pinfo->cursor].parent);
-    
+  *usage = pcb->usage;
+  for(unsigned int i=0; i<pcb->thread_table_size; i++) {
+    PTCB* ptcb = pcb->thread_table[i].ptcb;
+    if(ptcb != NULL && !ptcb->exited)
+      rusage_add(usage, & ptcb->tcb->usage);
+  }
+}
 
-      if (PT[pinfo->cursor].pstate == ALIVE) {
-        prinfo->alive = 1;
-      } 
 
-      else {
-        prinfo->alive = 0;
-      }
+int sys_GetRusage(rusage_who who, rusage_t* usage)
+{
+  if(usage == NULL) return -1;
+
+  switch(who) {
+    case USAGE_PROCESS:
+      get_process_usage(CURPROC, usage);
+      break;
+    case USAGE_THREAD:
+      *usage = cur_thread()->usage;
+      break;
+    case USAGE_CHILDREN:
+      *usage = CURPROC->children_usage;
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
 
-      prinfo->thread_count = PT[pinfo->cursor].thread_count;
-      prinfo->main_task = PT[pinfo->cursor].main_task;
-      prinfo->argl = PT[pinfo->cursor].argl;
 
-      /*if(PT[pinfo].argl > PROCINFO_MAX_ARGS_SIZE)
-        memcpy(pinfo->prinfo->args, PT[pinfo->cursor].args, PROCINFO_MAX_ARGS_SIZE);
-      else*/
-      memset(prinfo->args,0,PROCINFO_MAX_ARGS_SIZE);
+/* Fill a procinfo record from a PCB */
+static void procinfo_get(procinfo* prinfo, PCB* pcb)
+{
+  prinfo->pid = get_pid(pcb);
+  prinfo->ppid = get_pid(pcb->parent);
+  prinfo->alive = (pcb->pstate == ALIVE);
+  prinfo->thread_count = pcb->thread_count;
+  get_process_usage(pcb, &prinfo->usage);
+  prinfo->main_task = pcb->main_task;
+  prinfo->argl = pcb->argl;
+
+  memset(prinfo->args, 0, PROCINFO_MAX_ARGS_SIZE);
+  if(pcb->args)
+    memcpy(prinfo->args, pcb->args,
+      (pcb->argl < PROCINFO_MAX_ARGS_SIZE) ? pcb->argl : PROCINFO_MAX_ARGS_SIZE);
+}
 
-      if(PT[pinfo->cursor].argl < PROCINFO_MAX_ARGS_SIZE){
-        memcpy(prinfo->args, PT[pinfo->cursor].args, PT[pinfo->cursor].argl);
-      }
 
-      else{
-        memcpy(prinfo->args, (char*)PT[pinfo->cursor].args, PROCINFO_MAX_ARGS_SIZE);
-      }
+/*
+  Return as many procinfo records as fit into the buffer, visiting only 
+  the PCBs that are in use.
+ */
+int procinfo_read (void* pinfocb_t, char *buf, unsigned int n)
+{
+  procinfo_cb* pinfo = (procinfo_cb*) pinfocb_t;
 
-      memcpy(buf, (char*)prinfo,sizeof(procinfo));
-      pinfo->cursor++;
+  if(n < sizeof(procinfo)) return -1;
 
-      return sizeof(procinfo);
+  unsigned int count = 0;
+  while(count < n/sizeof(procinfo)) {
+    Pid_t pid = next_used_pid(pinfo->cursor);
+    if(pid >= MAX_PROC) {
+      pinfo->cursor = MAX_PROC;
+      break;
     }
-    
+
+    procinfo_get(& pinfo->prinfo, get_pcb(pid));
+    memcpy(buf + count*sizeof(procinfo), &pinfo->prinfo, sizeof(procinfo));
+    count++;
+    pinfo->cursor = pid+1;
   }
-  return 0;
+
+  return count*sizeof(procinfo);
 }
 
 int procinfo_close (void* pinfo)
@@ -481,3 +783,127 @@ Fid_t sys_OpenInfo()
 
   return fid;
 }
+
+
+/*
+  The thread information stream.
+ */
+
+typedef struct threadinfo_control_block
+{
+  Pid_t pid;          /* the process currently scanned */
+  unsigned int slot;  /* the next slot of its thread table */
+} threadinfo_cb;
+
+
+static const char* sched_cause_name[] = {
+  [SCHED_QUANTUM] = "QUANTUM",
+  [SCHED_IO] = "IO",
+  [SCHED_MUTEX] = "MUTEX",
+  [SCHED_PIPE] = "PIPE",
+  [SCHED_POLL] = "POLL",
+  [SCHED_IDLE] = "IDLE",
+  [SCHED_USER] = "USER"
+};
+
+
+/* Fill a threadinfo record from a TCB */
+static void threadinfo_get(threadinfo* tinfo, PCB* pcb, PTCB* ptcb)
+{
+  TCB* tcb = ptcb->tcb;
+
+  memset(tinfo, 0, sizeof(threadinfo));
+  tinfo->pid = get_pid(pcb);
+  tinfo->tid = ptcb->tid;
+  tinfo->usage = tcb->usage;
+
+  switch(tcb->state) {
+    case INIT: tinfo->state = THREAD_NEW; break;
+    case READY: tinfo->state = THREAD_READY; break;
+    case STOPPED: tinfo->state = THREAD_BLOCKED; break;
+    default: tinfo->state = THREAD_RUNNING; break;
+  }
+
+  /* The thread may wake up as we look, so we read the channel only once */
+  const char* wchan = __atomic_load_n(&tcb->wchan, __ATOMIC_RELAXED);
+  if(tinfo->state == THREAD_BLOCKED && wchan != NULL) {
+    strncpy(tinfo->wchan, wchan, THREADINFO_MAX_NAME-1);
+    strncpy(tinfo->cause, sched_cause_name[tcb->curr_cause], THREADINFO_MAX_NAME-1);
+    TimerDuration now = bios_clock();
+    if(now > tcb->wait_start)
+      tinfo->wait_time = now - tcb->wait_start;
+  }
+}
+
+
+/*
+  Return as many threadinfo records as fit into the buffer, visiting only 
+  the PCBs that are in use.
+ */
+static int threadinfo_read(void* tcb_t, char *buf, unsigned int n)
+{
+  threadinfo_cb* tinfo = tcb_t;
+
+  if(n < sizeof(threadinfo)) return -1;
+
+  unsigned int count = 0;
+  while(count < n/sizeof(threadinfo)) {
+    Pid_t pid = next_used_pid(tinfo->pid);
+    if(pid >= MAX_PROC) {
+      tinfo->pid = MAX_PROC;
+      break;
+    }
+    if(pid != tinfo->pid) {
+      tinfo->pid = pid;
+      tinfo->slot = 0;
+    }
+
+    PCB* pcb = get_pcb(pid);
+    if(tinfo->slot >= pcb->thread_table_size) {
+      tinfo->pid = pid+1;
+      tinfo->slot = 0;
+      continue;
+    }
+
+    PTCB* ptcb = pcb->thread_table[tinfo->slot++].ptcb;
+    if(ptcb == NULL || ptcb->exited || ptcb->tcb == NULL)
+      continue;
+
+    threadinfo_get((threadinfo*)(buf + count*sizeof(threadinfo)), pcb, ptcb);
+    count++;
+  }
+
+  return count*sizeof(threadinfo);
+}
+
+static int threadinfo_close(void* tinfo)
+{
+  free(tinfo);
+  return 0;
+}
+
+static file_ops threadinfo_file_ops = {
+  .Open = NULL,
+  .Read = threadinfo_read,
+  .Write = NULL,
+  .Close = threadinfo_close
+};
+
+
+Fid_t sys_OpenThreadInfo()
+{
+  Fid_t fid;
+  FCB* fcb;
+
+  if(FCB_reserve(1, &fid, &fcb) != 1)
+    return NOFILE;
+
+  threadinfo_cb* tinfo = xmalloc(sizeof(threadinfo_cb));
+  tinfo->pid = 0;
+  tinfo->slot = 0;
+
+  fcb->streamobj = tinfo;
+  fcb->streamfunc = &threadinfo_file_ops;
+
+  return fid;
+}
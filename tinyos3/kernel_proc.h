@@ -30,6 +30,26 @@ typedef enum pid_state_e {
   ZOMBIE  /**< @brief The PID is held by a zombie */
 } pid_state;
 
+/**
+  @brief A slot of the thread handle table of a process.
+
+  A @c Tid_t contains the index of a slot (plus one, so that no tid is
+  equal to @c NOTHREAD) in its low @c THREAD_HANDLE_BITS bits, and the
+  generation of the slot in the rest. The generation is incremented 
+  whenever the slot is freed.
+ */
+typedef struct thread_handle {
+  PTCB* ptcb;             /**< @brief The thread, or NULL for a free slot */
+  unsigned int gen;       /**< @brief The generation of the slot */
+  unsigned int next_free; /**< @brief The next free slot, for free slots */
+} thread_handle;
+
+/** @brief The number of bits of a @c Tid_t that hold the slot index */
+#define THREAD_HANDLE_BITS 20
+
+/** @brief Marks the end of the free slot list */
+#define NO_THREAD_HANDLE ((unsigned int)-1)
+
 /**
   @brief Process Control Block.
 
@@ -37,6 +57,7 @@ typedef enum pid_state_e {
  */
 typedef struct process_control_block {
   pid_state  pstate;      /**< @brief The pid state for this PCB */
+  Pid_t pid;              /**< @brief The pid of this PCB */
 
   PCB* parent;            /**< @brief Parent's pcb. */
   int exitval;            /**< @brief The exit value of the process */
@@ -52,20 +73,81 @@ typedef struct process_control_block {
   rlnode children_node;   /**< @brief Intrusive node for @c children_list */
   rlnode exited_node;     /**< @brief Intrusive node for @c exited_list */
 
-  CondVar child_exit;     /**< @brief Condition variable for @c WaitChild. 
+  CondVar child_exit;     /**< @brief Condition variable for @c WaitChild on any child. 
 
                              This condition variable is  broadcast each time a child
                              process terminates. It is used in the implementation of
-                             @c WaitChild() */
+                             @c WaitChild(NOPROC,...) and @c WaitChildren() */
+
+  CondVar exit_wait;      /**< @brief Condition variable for @c WaitChild on this process.
+
+                             This condition variable is broadcast when this process
+                             terminates, and when it is cleaned up. Only the threads
+                             of the parent waiting for this specific process sleep 
+                             on it. */
 
-  FCB* FIDT[MAX_FILEID];  /**< @brief The fileid table of the process */
+  FCB** FIDT;             /**< @brief The fileid table of the process, grown on demand */
+  unsigned long* fid_used;  /**< @brief A bitmap of the non-NULL entries of @c FIDT */
+  unsigned int fidt_size;   /**< @brief The number of entries of @c FIDT */
 
-  rlnode ptcb_list;
+  thread_handle* thread_table;  /**< @brief The thread handle table, indexed by tid */
+  unsigned int thread_table_size;   /**< @brief The number of slots in @c thread_table */
+  unsigned int thread_table_free;   /**< @brief The first free slot, or @c NO_THREAD_HANDLE */
   int thread_count;
 
+  int joinable_count;       /**< @brief The live threads that are not detached */
+  rlnode exited_threads;    /**< @brief Exited threads that have not been joined yet */
+  CondVar thread_exit;      /**< @brief Condition variable for @c ThreadJoinAny.
+
+                             This condition variable is broadcast each time a joinable
+                             thread exits, or a thread is detached. */
+
+  rusage_t usage;           /**< @brief The resource usage of the exited threads */
+  rusage_t children_usage;  /**< @brief The resource usage of the cleaned-up children */
+
 } PCB;
 
 
+/**
+  @brief Compute the resource usage of a process.
+
+  This is the usage of the exited threads of the process, plus the
+  usage of its live threads.
+ */
+void get_process_usage(PCB* pcb, rusage_t* usage);
+
+
+/**
+  @brief Acquire a thread handle.
+
+  A free slot of the thread handle table of @c pcb is assigned to
+  @c ptcb, and the resulting tid is stored in @c ptcb->tid. The table
+  grows as needed.
+
+  @returns the new tid
+ */
+Tid_t acquire_tid(PCB* pcb, PTCB* ptcb);
+
+/**
+  @brief Validate a thread handle.
+
+  This takes O(1) time. Since every tid carries the generation of its
+  slot, a stale tid is rejected even after its slot has been reused.
+
+  @returns the PTCB of thread @c tid of process @c pcb, or NULL if @c tid
+    is not a valid thread of @c pcb.
+ */
+PTCB* get_ptcb(PCB* pcb, Tid_t tid);
+
+/**
+  @brief Release a thread.
+
+  The handle of @c ptcb is freed (making its tid invalid), and the PTCB is
+  returned to the PTCB free list.
+ */
+void release_thread(PCB* pcb, PTCB* ptcb);
+
+
 /**
   @brief Initialize the process table.
 
@@ -80,6 +162,8 @@ void initialize_PTCB(PTCB* ptcb);
 
 PTCB* acquire_PTCB();
 
+void release_PTCB(PTCB* ptcb);
+
 
 typedef struct procinfo_control_block
 {
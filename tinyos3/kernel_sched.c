@@ -81,9 +81,22 @@ TCB* cur_thread()
 /*
   A counter for active threads. By "active", we mean 'existing',
   with the exception of idle threads (they don't count).
+
+  The count is kept as two monotonic per-core counters, so that spawning
+  and releasing threads takes no lock and causes no traffic between cores.
+ */
+static percore_counter threads_spawned, threads_released;
+
+/* 
+  The number of active threads. Since a thread is released after it is 
+  spawned, reading the releases first can only over-estimate the count; 
+  in particular, it never returns 0 while threads exist.
  */
-volatile unsigned int active_threads = 0;
-Mutex active_threads_spinlock = MUTEX_INIT;
+static inline unsigned long active_threads()
+{
+	unsigned long released = percore_read(&threads_released);
+	return percore_read(&threads_spawned) - released;
+}
 
 /* This is specific to Intel Pentium! */
 #define SYSTEM_PAGE_SIZE (1 << 12)
@@ -179,6 +192,10 @@ TCB* spawn_thread(PCB* pcb,PTCB* ptcb, void (*func)())
 	tcb->rts = QUANTUM;
 	tcb->last_cause = SCHED_IDLE;
 	tcb->curr_cause = SCHED_IDLE;
+	memset(&tcb->usage, 0, sizeof(rusage_t));
+	tcb->wchan = NULL;
+	tcb->wait_start = 0;
+	tcb->io_nonblock = 0;
 
 	/* initialization of priority to run the thread */ 
 	//tcb->priority = PRIORITY_QUEUES -1;  
@@ -195,15 +212,14 @@ TCB* spawn_thread(PCB* pcb,PTCB* ptcb, void (*func)())
 #endif
 
 	/* increase the count of active threads */
-	Mutex_Lock(&active_threads_spinlock);
-	active_threads++;
-	Mutex_Unlock(&active_threads_spinlock);
+	percore_add(&threads_spawned, 1);
 
 	return tcb;
 }
 
 /*
-  This is called with sched_spinlock locked !
+  This is called with preemption off, but not with sched_spinlock locked,
+  as unmapping the thread memory takes a system call.
  */
 void release_TCB(TCB* tcb)
 {
@@ -213,9 +229,7 @@ void release_TCB(TCB* tcb)
 
 	free_thread(tcb, THREAD_SIZE);
 
-	Mutex_Lock(&active_threads_spinlock);
-	active_threads--;
-	Mutex_Unlock(&active_threads_spinlock);
+	percore_add(&threads_released, 1);
 }
 
 /*
@@ -282,6 +296,7 @@ static void sched_queue_add(TCB* tcb)
 {
 	/* Insert at the end of the scheduling list */
 	rlist_push_back(&SCHED, &tcb->sched_node);  //[tcb->priority]
+	tcb->usage_stamp = bios_clock();
 
 	/* Restart possibly halted cores */
 	cpu_core_restart_one();
@@ -390,11 +405,41 @@ int wakeup(TCB* tcb)
 	return ret;
 }
 
+/*
+  Make a whole list of threads ready, taking the scheduler lock once.
+ */
+int wakeup_all(rlnode* threads)
+{
+	int count = 0;
+
+	/* Preemption off */
+	int oldpre = preempt_off;
+
+	Mutex_Lock(&sched_spinlock);
+
+	while (!is_rlist_empty(threads)) {
+		/* Unlink the node first: it may live in the stack of the woken thread */
+		TCB* tcb = rlist_pop_front(threads)->tcb;
+		if (tcb->state == STOPPED || tcb->state == INIT) {
+			sched_make_ready(tcb);
+			count++;
+		}
+	}
+
+	Mutex_Unlock(&sched_spinlock);
+
+	/* Restore preemption state */
+	if (oldpre)
+		preempt_on;
+
+	return count;
+}
+
 /*
   Atomically put the current process to sleep, after unlocking mx.
  */
 void sleep_releasing(Thread_state state, Mutex* mx, enum SCHED_CAUSE cause,
-	TimerDuration timeout)
+	const char* wchan, TimerDuration timeout)
 {
 	assert(state == STOPPED || state == EXITED);
 
@@ -405,20 +450,27 @@ void sleep_releasing(Thread_state state, Mutex* mx, enum SCHED_CAUSE cause,
 
 	/* mark the thread as stopped or exited */
 	tcb->state = state;
+	tcb->wchan = wchan;
+	tcb->wait_start = bios_clock();
 
 	/* register the timeout (if any) for the sleeping thread */
 	if (state != EXITED)
 		sched_register_timeout(tcb, timeout);
 
-	/* Release mx */
-	if (mx != NULL)
-		Mutex_Unlock(mx);
-
 	/* Release the schduler spinlock before calling yield() !!! */
 	Mutex_Unlock(&sched_spinlock);
 
+	/* 
+	   Release mx. Our state is already changed, so a wakeup from now on is not
+	   lost. We must not hold the scheduler spinlock here, as unlocking mx may
+	   wake up a requeued thread.
+	 */
+	if (mx != NULL)
+		Mutex_Unlock(mx);
+
 	/* call this to schedule someone else */
 	yield(cause);
+	tcb->wchan = NULL;
 
 	/* Restore preemption state */
 	if (preempt)
@@ -445,6 +497,10 @@ void yield(enum SCHED_CAUSE cause)
 	if (current->state == RUNNING)
 		current->state = READY;
 
+	/* Account the time-slice, which started at current->rts */
+	if (current->type != IDLE_THREAD)
+		current->usage.run_time += current->rts - remaining;
+
 	/* Update CURTHREAD scheduler data */
 	current->rts = remaining;
 	current->last_cause = current->curr_cause;
@@ -504,6 +560,13 @@ void yield(enum SCHED_CAUSE cause)
 	TCB* next = sched_queue_select(current);
 	assert(next != NULL);
 
+	if (current != next && current->type != IDLE_THREAD) {
+		if (cause == SCHED_QUANTUM)
+			current->usage.involuntary++;
+		else
+			current->usage.voluntary++;
+	}
+
 	/* Save the current TCB for the gain phase */
 	CURCORE.previous_thread = current;
 
@@ -521,6 +584,24 @@ void yield(enum SCHED_CAUSE cause)
 	gain(preempt);
 }
 
+/*
+  Exited threads are not released in gain(), while the scheduler lock is
+  held, but are kept in a per-core list and released in batches, once the
+  lock is released. The idle thread releases them all, so that no TCB
+  stays around while the core has nothing to do.
+ */
+#define RECLAIM_BATCH 16
+
+static void reclaim_TCBs()
+{
+	CCB* curcore = &CURCORE;
+	while (!is_rlist_empty(&curcore->reclaim_list)) {
+		TCB* tcb = rlist_pop_front(&curcore->reclaim_list)->tcb;
+		release_TCB(tcb);
+	}
+	curcore->reclaim_count = 0;
+}
+
 /*
   This function must be called at the beginning of each new timeslice.
   This is done mostly from inside yield().
@@ -547,6 +628,9 @@ void gain(int preempt)
 	/* Take care of the previous thread */
 	TCB* prev = CURCORE.previous_thread;
 	if (current != prev) {
+		if (current->type != IDLE_THREAD)
+			current->usage.ready_time += bios_clock() - current->usage_stamp;
+
 		prev->phase = CTX_CLEAN;
 		switch (prev->state) {
 		case READY:
@@ -554,7 +638,8 @@ void gain(int preempt)
 				sched_queue_add(prev);
 			break;
 		case EXITED:
-			release_TCB(prev);
+			rlist_push_back(&CURCORE.reclaim_list, &prev->sched_node);
+			CURCORE.reclaim_count++;
 			break;
 		case STOPPED:
 			break;
@@ -565,6 +650,11 @@ void gain(int preempt)
 
 	Mutex_Unlock(&sched_spinlock);
 
+	/* Release exited threads, with preemption still off */
+	if (CURCORE.reclaim_count >= RECLAIM_BATCH
+		|| (current->type == IDLE_THREAD && CURCORE.reclaim_count > 0))
+		reclaim_TCBs();
+
 	/* Reset preemption as needed */
 	if (preempt)
 		preempt_on;
@@ -579,7 +669,7 @@ static void idle_thread()
 	yield(SCHED_IDLE);
 
 	/* We come here whenever we cannot find a ready thread for our core */
-	while (active_threads > 0) {
+	while (active_threads() > 0) {
 		cpu_core_halt();
 		yield(SCHED_IDLE);
 	}
@@ -610,6 +700,8 @@ void run_scheduler()
 	curcore->id = cpu_core_id;
 
 	curcore->current_thread = &curcore->idle_thread;
+	rlnode_init(&curcore->reclaim_list, NULL);
+	curcore->reclaim_count = 0;
 
 	curcore->idle_thread.owner_pcb = get_pcb(0);
 	curcore->idle_thread.type = IDLE_THREAD;
@@ -636,6 +728,7 @@ void run_scheduler()
 
 	/* Finished scheduling */
 	assert(CURTHREAD == &CURCORE.idle_thread);
+	assert(is_rlist_empty(&CURCORE.reclaim_list));
 	cpu_interrupt_handler(ALARM, NULL);
 	cpu_interrupt_handler(ICI, NULL);
 }
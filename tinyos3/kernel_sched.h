@@ -109,7 +109,11 @@ typedef struct process_thread_control_block {
 
   int refcount;
 
-  rlnode ptcb_list_node;
+  Tid_t tid;          /**< @brief The handle of this thread in its process */
+
+  rlnode exit_node;   /**< @brief Intrusive node for the @c exited_threads list of the process */
+
+  struct process_thread_control_block* next_free;  /**< @brief Link for the free list of PTCBs */
 
 } PTCB;
 
@@ -143,6 +147,14 @@ typedef struct thread_control_block {
 	enum SCHED_CAUSE curr_cause; /**< @brief The endcause for the current time-slice */
 	enum SCHED_CAUSE last_cause; /**< @brief The endcause for the last time-slice */
 
+	rusage_t usage; /**< @brief The resource usage of this thread */
+	TimerDuration usage_stamp; /**< @brief The time this thread was last made ready */
+
+	const char* wchan; /**< @brief The wait channel of a sleeping thread, or NULL */
+	TimerDuration wait_start; /**< @brief The time this thread last went to sleep */
+
+	int io_nonblock; /**< @brief Set during an operation on a non-blocking stream */
+
 #ifndef NVALGRIND
 	unsigned valgrind_stack_id; /**< @brief Valgrind helper for stacks. 
 
@@ -170,15 +182,20 @@ typedef struct thread_control_block {
 
 /** @brief Core control block.
 
-  Per-core info in memory (basically scheduler-related). 
+  Per-core info in memory (basically scheduler-related). Each CCB is 
+  cache-line aligned, so that cores do not share cache lines when 
+  updating their own CCB.
  */
-typedef struct core_control_block {
+typedef struct __cacheline_aligned core_control_block {
 	uint id; /**< @brief The core id */
 
 	TCB* current_thread; /**< @brief Points to the thread currently owning the core */
 	TCB* previous_thread; /**< @brief Points to the thread that previously owned the core */
 	TCB idle_thread; /**< @brief Used by the scheduler to handle the core's idle thread */
 
+	rlnode reclaim_list; /**< @brief Exited threads of this core, whose TCBs are not yet released */
+	unsigned int reclaim_count; /**< @brief The length of @c reclaim_list */
+
 } CCB;
 
 /** @brief the array of Core Control Blocks (CCB) for the kernel */
@@ -240,18 +257,39 @@ TCB* spawn_thread(PCB* pcb, PTCB* ptcb, void (*func)());
 */
 int wakeup(TCB* tcb);
 
-/** 
+/**
+  @brief Wakeup a batch of blocked threads.
+
+  Each node of the list @c threads must be keyed by a TCB (that is, @c node->tcb).
+  All nodes are removed from the list, and each thread whose state is @c STOPPED
+  or @c INIT is made @c READY. The whole batch is released under a single
+  acquisition of the scheduler lock, so that the woken threads do not
+  contend with each other (or with the caller) on the way out.
+
+  Since no thread can be scheduled before this call returns, the list nodes
+  may be stored in the stacks of the sleeping threads.
+
+  @param threads a list of nodes keyed by the TCBs to wake up. It is empty on return.
+  @returns the number of threads that were made @c READY
+*/
+int wakeup_all(rlnode* threads);
+
+/**
   @brief Block the current thread.
 
 	This call will block the current thread, changing its state to @c STOPPED
 	or @c EXITED. Also, the mutex @c mx, if not `NULL`, will be unlocked, atomically
 	with the blocking of the thread. 
 
-	In particular, what is meant by 'atomically' is that the thread state will change
-	to @c newstate atomically with the mutex unlocking. Note that, the state of
-	the current thread is @c RUNNING. 
-	Therefore, no other state change (such as a wakeup, a yield, another sleep etc) 
-	can happen "between" the thread's state change and the unlocking.
+	In particular, what is meant by 'atomically' is that no wakeup can be lost
+	between the unlocking and the blocking. The thread state is changed to
+	@c newstate (under the scheduler spinlock) before @c mx is unlocked. A thread 
+	that locks @c mx afterwards and calls @c wakeup() finds the thread @c STOPPED 
+	and makes it @c READY; since the context of the thread has not been saved yet
+	(its phase is @c CTX_DIRTY), it is not added to the scheduler queue; the 
+	thread yields as a @c READY thread instead. The mutex is unlocked 
+	after the scheduler spinlock is released, since unlocking it may wake up a 
+	thread requeued on it.
   
 	If the @c newstate is @c EXITED, the thread will block and also will eventually be
 	cleaned-up by the scheduler. Its TCB should not be accessed in any way after this
@@ -265,12 +303,18 @@ int wakeup(TCB* tcb);
 	be made ready by the scheduler after the timeout duration has passed, even without a call to
 	@c wakeup() by another thread.
 
+	The wait channel names the place the thread sleeps at, e.g. the function 
+	that called @c kernel_wait. It is kept in the TCB, together with the start
+	time of the sleep, until the thread wakes up.
+
 	@param newstate the new state for the current thread, which must be either stopped or exited
 	@param mx the mutex to unlock.
 	@param cause the cause of the sleep
-	@param timeout a timeout for the sleep, or 
+	@param wchan the wait channel of the sleep
+	@param timeout a timeout for the sleep, or @c NO_TIMEOUT
    */
-void sleep_releasing(Thread_state newstate, Mutex* mx, enum SCHED_CAUSE cause, TimerDuration timeout);
+void sleep_releasing(Thread_state newstate, Mutex* mx, enum SCHED_CAUSE cause, 
+	const char* wchan, TimerDuration timeout);
 
 /**
   @brief Give up the CPU.
@@ -304,6 +348,19 @@ void initialize_scheduler(void);
   */
 #define QUANTUM (10000L)
 
+/**
+  @brief Add the resource usage in @c from to @c to.
+  */
+static inline void rusage_add(rusage_t* to, const rusage_t* from)
+{
+	to->run_time += from->run_time;
+	to->ready_time += from->ready_time;
+	to->voluntary += from->voluntary;
+	to->involuntary += from->involuntary;
+	to->bytes_read += from->bytes_read;
+	to->bytes_written += from->bytes_written;
+}
+
 /** @} */
 
 #endif
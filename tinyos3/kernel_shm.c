@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+
+/**
+	@file kernel_shm.c
+
+	@brief Shared memory regions.
+
+	All processes share the address space of the host process, so a
+	shared memory region is just a block of memory, owned by a stream.
+	Every file id of the stream (in any process, through @c Dup2 or
+	@c Exec) keeps the region alive, and the region is freed when the
+	last one is closed.
+  */
+
+/* Regions are aligned to cache lines, so that users can lay out their data by them */
+#define SHM_ALIGN 64
+
+typedef struct shm_control_block {
+	void* base;
+	unsigned int size;
+} SHM_CB;
+
+
+static int shm_close(void* shmcb)
+{
+	SHM_CB* shm = shmcb;
+	free(shm->base);
+	free(shm);
+	return 0;
+}
+
+static file_ops shm_file_ops = {
+	.Open = NULL,
+	.Read = NULL,
+	.Write = NULL,
+	.Close = shm_close
+};
+
+
+Fid_t sys_ShmCreate(unsigned int size)
+{
+	if(size == 0 || size > MAX_SHM_SIZE)
+		return NOFILE;
+
+	size_t alloc = (size + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+	void* base = aligned_alloc(SHM_ALIGN, alloc);
+	if(base == NULL)
+		return NOFILE;
+
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) != 1) {
+		free(base);
+		return NOFILE;
+	}
+
+	memset(base, 0, alloc);
+
+	SHM_CB* shm = xmalloc(sizeof(SHM_CB));
+	shm->base = base;
+	shm->size = size;
+
+	fcb->streamobj = shm;
+	fcb->streamfunc = &shm_file_ops;
+
+	return fid;
+}
+
+
+void* sys_ShmAttach(Fid_t fd, unsigned int* size)
+{
+	FCB* fcb = get_fcb(fd);
+	if(fcb == NULL || fcb->streamfunc != &shm_file_ops)
+		return NULL;
+
+	SHM_CB* shm = fcb->streamobj;
+	if(size) *size = shm->size;
+	return shm->base;
+}
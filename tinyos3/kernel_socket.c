@@ -9,6 +9,12 @@ static file_ops socket_file_ops = {
 	.Open = NULL,
 	.Read = socket_read,
 	.Write = socket_write,
+	.ReadV = socket_readv,
+	.WriteV = socket_writev,
+	.Available = socket_available,
+	.Ready = socket_ready,
+	.WaitQueues = socket_waitq,
+	.Watchers = socket_watchers,
 	.Close = socket_close
 };
 
@@ -55,6 +61,134 @@ int socket_write(void* socketcb_t, const char *buf, unsigned int n){
 }
 
 
+int socket_readv(void* socketcb_t, const iovec_t* iov, unsigned int iovcnt){
+
+	SOCKET_CB* socket_cb = (SOCKET_CB*) socketcb_t;
+
+	if(socket_cb->type == SOCKET_PEER){
+		return pipe_readv(socket_cb->peer_s->read_pipe, iov, iovcnt);
+	}
+	return -1;
+}
+
+
+int socket_writev(void* socketcb_t, const iovec_t* iov, unsigned int iovcnt){
+
+	SOCKET_CB* socket_cb = (SOCKET_CB*) socketcb_t;
+
+	if(socket_cb->type == SOCKET_PEER){
+		return pipe_writev(socket_cb->peer_s->write_pipe, iov, iovcnt);
+	}
+	return -1;
+}
+
+
+int socket_available(void* socketcb_t, unsigned int* readable, unsigned int* writable){
+
+	SOCKET_CB* socket_cb = (SOCKET_CB*) socketcb_t;
+	unsigned int none;
+
+	if(socket_cb->type == SOCKET_PEER){
+		if(socket_cb->peer_s->read_pipe->reader == NULL)
+			*readable = 0;
+		else
+			pipe_reader_available(socket_cb->peer_s->read_pipe, readable, &none);
+		if(socket_cb->peer_s->write_pipe->writer == NULL)
+			*writable = 0;
+		else
+			pipe_writer_available(socket_cb->peer_s->write_pipe, &none, writable);
+		return 0;
+	}
+	return -1;
+}
+
+
+/* A listener is readable when a connection request is queued */
+int socket_ready(void* socketcb_t){
+
+	SOCKET_CB* socket_cb = (SOCKET_CB*) socketcb_t;
+	int ready = 0;
+
+	switch(socket_cb->type){
+		case SOCKET_PEER:
+			if(socket_cb->peer_s->read_pipe->reader != NULL)
+				ready |= pipe_reader_ready(socket_cb->peer_s->read_pipe);
+			if(socket_cb->peer_s->write_pipe->writer != NULL)
+				ready |= pipe_writer_ready(socket_cb->peer_s->write_pipe);
+			break;
+		case SOCKET_LISTENER:
+			if(! is_rlist_empty(&socket_cb->listener_s->queue))
+				ready |= POLLIN;
+			break;
+		default:
+			break;
+	}
+	return ready;
+}
+
+
+unsigned int socket_waitq(void* socketcb_t, int events, CondVar** wq){
+
+	SOCKET_CB* socket_cb = (SOCKET_CB*) socketcb_t;
+	unsigned int n = 0;
+
+	switch(socket_cb->type){
+		case SOCKET_PEER:
+			if(events & POLLIN)
+				n += pipe_reader_waitq(socket_cb->peer_s->read_pipe, events, wq+n);
+			if(events & POLLOUT)
+				n += pipe_writer_waitq(socket_cb->peer_s->write_pipe, events, wq+n);
+			break;
+		case SOCKET_LISTENER:
+			wq[n++] = &socket_cb->listener_s->req_available;
+			break;
+		default:
+			break;
+	}
+	return n;
+}
+
+
+/* Peer sockets are watched through their pipes; other sockets are polled */
+unsigned int socket_watchers(void* socketcb_t, int events, rlnode** lists){
+
+	SOCKET_CB* socket_cb = (SOCKET_CB*) socketcb_t;
+	unsigned int n = 0;
+
+	if(socket_cb->type == SOCKET_PEER){
+		if(events & POLLIN)
+			n += pipe_reader_watchers(socket_cb->peer_s->read_pipe, events, lists+n);
+		if(events & POLLOUT)
+			n += pipe_writer_watchers(socket_cb->peer_s->write_pipe, events, lists+n);
+	}
+	return n;
+}
+
+
+/* The pipes of a peer socket, or NULL for other streams */
+PIPE_CB* socket_read_pipe(FCB* fcb)
+{
+	if(fcb->streamfunc != &socket_file_ops) return NULL;
+	SOCKET_CB* socket_cb = fcb->streamobj;
+	return (socket_cb->type == SOCKET_PEER) ? socket_cb->peer_s->read_pipe : NULL;
+}
+
+PIPE_CB* socket_write_pipe(FCB* fcb)
+{
+	if(fcb->streamfunc != &socket_file_ops) return NULL;
+	SOCKET_CB* socket_cb = fcb->streamobj;
+	return (socket_cb->type == SOCKET_PEER) ? socket_cb->peer_s->write_pipe : NULL;
+}
+
+/* The listener of a listening socket, or NULL for other streams */
+L_SOCKET* socket_listener(FCB* fcb)
+{
+	if(fcb->streamfunc != &socket_file_ops) return NULL;
+	SOCKET_CB* socket_cb = fcb->streamobj;
+	return (socket_cb->type == SOCKET_LISTENER) ? socket_cb->listener_s : NULL;
+}
+
+
 int socket_close(void* socketcb){
 
 	return 0;
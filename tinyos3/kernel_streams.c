@@ -8,28 +8,54 @@
 
 #define MAX_FILES MAX_PROC
 
+/*
+  The file table. FCBs are allocated in chunks of FT_CHUNK_SIZE, when the
+  free FCBs run out.
+ */
+#define FT_CHUNK_SIZE 256
+#define FT_CHUNKS (MAX_FILES/FT_CHUNK_SIZE)
 
-FCB FT[MAX_FILES];
+FCB* FT[FT_CHUNKS];
+static unsigned int ft_chunks;    /* the number of allocated chunks */
 rlnode FCB_freelist;
 
 
-void initialize_files()
+/* Allocate the next chunk of FCBs. Returns 0 if the file table is full. */
+static int grow_file_table()
 {
-  rlnode_init(&FCB_freelist,NULL);
-  for(int i=0;i<MAX_FILES;i++) {
+  if(ft_chunks == FT_CHUNKS) return 0;
 
-    FT[i].refcount = 0;
-    rlnode_init(& FT[i].freelist_node, &FT[i]);
-    rlist_push_back(&FCB_freelist, & FT[i].freelist_node);
+  FCB* chunk = (FCB*)xmalloc(FT_CHUNK_SIZE*sizeof(FCB));
+  for(int i=0;i<FT_CHUNK_SIZE;i++) {
+    chunk[i].refcount = 0;
+    rlnode_init(& chunk[i].freelist_node, &chunk[i]);
+    rlist_push_back(&FCB_freelist, & chunk[i].freelist_node);
   }
+
+  FT[ft_chunks++] = chunk;
+  return 1;
+}
+
+
+void initialize_files()
+{
+  /* drop the chunks of a previous boot */
+  for(unsigned int c=0; c<ft_chunks; c++) {
+    free(FT[c]);
+    FT[c] = NULL;
+  }
+  ft_chunks = 0;
+  rlnode_init(&FCB_freelist,NULL);
 }
 
 
 FCB* acquire_FCB()
 {
-  if(! is_rlist_empty(& FCB_freelist)) {
+  if(! is_rlist_empty(& FCB_freelist) || grow_file_table()) {
     FCB* fcb = rlist_pop_front(& FCB_freelist)->fcb;
     fcb->refcount = 0;
+    fcb->flags = 0;
+    rlnode_init(& fcb->evq_items, NULL);
     return fcb;
   }
   else
@@ -53,6 +79,8 @@ int FCB_decref(FCB* fcb)
   assert(fcb);
   fcb->refcount --;
   if(fcb->refcount==0) {
+    if(! is_rlist_empty(& fcb->evq_items))
+      evq_detach(fcb);
     int retval = fcb->streamfunc->Close(fcb->streamobj);
     release_FCB(fcb);
     return retval;
@@ -63,17 +91,143 @@ int FCB_decref(FCB* fcb)
 
 
 
+/*
+  The fileid table of a process.
+
+  The table grows on demand (doubling, starting at FIDT_MIN_SIZE fids) up
+  to MAX_FILEID fids. Next to it, a bitmap of the used fids allows finding
+  a free fid, or visiting the used ones, a word at a time.
+ */
+#define FIDT_MIN_SIZE BITS_PER_WORD
+#define FIDT_WORDS(size) (((size)+BITS_PER_WORD-1)/BITS_PER_WORD)
+
+/* Grow the table of pcb so that it contains fid */
+static void FIDT_grow(PCB* pcb, Fid_t fid)
+{
+  unsigned int size = pcb->fidt_size ? pcb->fidt_size : FIDT_MIN_SIZE;
+  while(size <= (unsigned int)fid) size *= 2;
+  if(size > MAX_FILEID) size = MAX_FILEID;
+  assert((unsigned int)fid < size);
+
+  unsigned int oldsize = pcb->fidt_size;
+  pcb->FIDT = xrealloc(pcb->FIDT, size*sizeof(FCB*));
+  memset(pcb->FIDT+oldsize, 0, (size-oldsize)*sizeof(FCB*));
+
+  pcb->fid_used = xrealloc(pcb->fid_used, FIDT_WORDS(size)*sizeof(unsigned long));
+  memset(pcb->fid_used+FIDT_WORDS(oldsize), 0, 
+    (FIDT_WORDS(size)-FIDT_WORDS(oldsize))*sizeof(unsigned long));
+
+  pcb->fidt_size = size;
+}
+
+
+/* 
+  Return the first fid >= fid whose bit in the bitmap is equal to used,
+  or fidt_size if there is none. 
+ */
+static Fid_t FIDT_scan(PCB* pcb, Fid_t fid, int used)
+{
+  for(unsigned int w = fid/BITS_PER_WORD; w < FIDT_WORDS(pcb->fidt_size); w++) {
+    unsigned long bits = used ? pcb->fid_used[w] : ~pcb->fid_used[w];
+    if(w == fid/BITS_PER_WORD) bits &= ~0ul << (fid%BITS_PER_WORD);
+    if(bits) {
+      Fid_t f = w*BITS_PER_WORD + __builtin_ctzl(bits);
+      return (f < (Fid_t)pcb->fidt_size) ? f : (Fid_t)pcb->fidt_size;
+    }
+  }
+  return pcb->fidt_size;
+}
+
+
+void FIDT_set(PCB* pcb, Fid_t fid, FCB* fcb)
+{
+  assert(fid>=0 && fid<MAX_FILEID);
+
+  if(fid >= (Fid_t)pcb->fidt_size) {
+    if(fcb==NULL) return;
+    FIDT_grow(pcb, fid);
+  }
+
+  pcb->FIDT[fid] = fcb;
+  if(fcb)
+    pcb->fid_used[fid/BITS_PER_WORD] |= 1ul << (fid%BITS_PER_WORD);
+  else
+    pcb->fid_used[fid/BITS_PER_WORD] &= ~(1ul << (fid%BITS_PER_WORD));
+}
+
+
+Fid_t FIDT_next(PCB* pcb, Fid_t fid)
+{
+  if(fid < 0) fid = 0;
+  if(fid >= (Fid_t)pcb->fidt_size) return NOFILE;
+  Fid_t f = FIDT_scan(pcb, fid, 1);
+  return (f < (Fid_t)pcb->fidt_size) ? f : NOFILE;
+}
+
+
+/* Return the first free fid >= fid, or NOFILE if there is none */
+static Fid_t FIDT_next_free(PCB* pcb, Fid_t fid)
+{
+  /* fids beyond the end of the table are free */
+  if(fid < (Fid_t)pcb->fidt_size)
+    fid = FIDT_scan(pcb, fid, 0);
+  return (fid < MAX_FILEID) ? fid : NOFILE;
+}
+
+
+void FIDT_copy(PCB* dst, PCB* src)
+{
+  assert(dst->fidt_size == 0);
+  if(src->fidt_size == 0) return;
+
+  FIDT_grow(dst, src->fidt_size-1);
+  memcpy(dst->FIDT, src->FIDT, src->fidt_size*sizeof(FCB*));
+  memcpy(dst->fid_used, src->fid_used, FIDT_WORDS(src->fidt_size)*sizeof(unsigned long));
+
+  /* Only the used entries are visited */
+  for(Fid_t f = FIDT_next(dst, 0); f != NOFILE; f = FIDT_next(dst, f+1))
+    FCB_incref(dst->FIDT[f]);
+}
+
+
+int FIDT_close_range(PCB* pcb, Fid_t lowfd, Fid_t highfd)
+{
+  int retcode = 0;
+
+  /* Note that a Close may block, therefore the table is re-examined each time */
+  for(Fid_t f = FIDT_next(pcb, lowfd); f != NOFILE && f <= highfd; f = FIDT_next(pcb, f+1)) {
+    FCB* fcb = pcb->FIDT[f];
+    FIDT_set(pcb, f, NULL);
+    if(FCB_decref(fcb) != 0) retcode = -1;
+  }
+
+  return retcode;
+}
+
+
+void FIDT_release(PCB* pcb)
+{
+  FIDT_close_range(pcb, 0, MAX_FILEID-1);
+
+  free(pcb->FIDT);
+  free(pcb->fid_used);
+  pcb->FIDT = NULL;
+  pcb->fid_used = NULL;
+  pcb->fidt_size = 0;
+}
+
+
+
 int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
 {
     PCB* cur = CURPROC;
-    size_t f=0;
+    Fid_t f=0;
     uint i;
 
     /* Find distinct fids */
     for(i=0; i<num; i++) {
-	     while(f<MAX_FILEID && cur->FIDT[f]!=NULL)
-	         f++;
-	     if(f==MAX_FILEID) break;
+	     f = FIDT_next_free(cur, f);
+	     if(f==NOFILE) break;
 	     fid[i] = f; f++;
     }
 
@@ -93,7 +247,7 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
       }
     /* Found all */
     for(i=0; i<num; i++) {
-	     cur->FIDT[fid[i]]=fcb[i];
+	     FIDT_set(cur, fid[i], fcb[i]);
 	     FCB_incref(fcb[i]);
     }
     return 1;
@@ -106,7 +260,7 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
     PCB* cur = CURPROC;
     for(size_t i=0; i<num ; i++) {
 	     assert(cur->FIDT[fid[i]]==fcb[i]);
-	     cur->FIDT[fid[i]] = NULL;
+	     FIDT_set(cur, fid[i], NULL);
 	     release_FCB(fcb[i]);
     }
 }
@@ -125,9 +279,30 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
 
 FCB* get_fcb(Fid_t fid)
 {
-  if(fid < 0 || fid >= MAX_FILEID) return NULL;
+  PCB* cur = CURPROC;
+  if(fid < 0 || fid >= (Fid_t)cur->fidt_size) return NULL;
+
+  return cur->FIDT[fid];
+}
+
+
+/*
+  Stream operations are bracketed by io_begin() and io_end(), so that the
+  drivers can see the mode of the stream through io_nonblocking().
+ */
+static inline void io_begin(FCB* fcb)
+{
+  cur_thread()->io_nonblock = (fcb->flags & FCB_NONBLOCK) != 0;
+}
+
+static inline void io_end()
+{
+  cur_thread()->io_nonblock = 0;
+}
 
-  return CURPROC->FIDT[fid];
+int io_nonblocking()
+{
+  return cur_thread()->io_nonblock;
 }
 
 
@@ -149,8 +324,13 @@ int sys_Read(Fid_t fd, char *buf, unsigned int size)
        while we are using it! */
     FCB_incref(fcb);
   
+    io_begin(fcb);
     if(devread)
       retcode = devread(sobj, buf, size);
+    io_end();
+
+    if(retcode > 0)
+      cur_thread()->usage.bytes_read += retcode;
 
     /* Need to decrease the reference to FCB */
     FCB_decref(fcb);
@@ -183,8 +363,13 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
     FCB_incref(fcb);
   
 
+    io_begin(fcb);
     if(devwrite)
       retcode = devwrite(sobj, buf, size);
+    io_end();
+
+    if(retcode > 0)
+      cur_thread()->usage.bytes_written += retcode;
 
     /* Need to decrease the reference to FCB */
     FCB_decref(fcb);
@@ -196,6 +381,242 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
 }
 
 
+/* Check the segment array of a ReadV/WriteV call */
+static int iov_valid(const iovec_t* iov, unsigned int iovcnt)
+{
+  if(iovcnt > MAX_IOV) return 0;
+  if(iovcnt > 0 && iov == NULL) return 0;
+  for(unsigned int i=0; i<iovcnt; i++)
+    if(iov[i].base == NULL && iov[i].len > 0) return 0;
+  return 1;
+}
+
+
+/*
+  Transfer the segments one at a time, for streams without a native
+  ReadV or WriteV. We stop at the first short transfer, so that the 
+  bytes transferred are always a prefix of the segments.
+ */
+static int readv_fallback(void* sobj, int (*devread)(void*, char*, uint),
+  const iovec_t* iov, unsigned int iovcnt)
+{
+  int total = 0;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    int rc = devread(sobj, iov[i].base, iov[i].len);
+    if(rc < 0) return (total > 0) ? total : rc;
+    total += rc;
+    if((unsigned int)rc < iov[i].len) break;
+  }
+  return total;
+}
+
+static int writev_fallback(void* sobj, int (*devwrite)(void*, const char*, uint),
+  const iovec_t* iov, unsigned int iovcnt)
+{
+  int total = 0;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    int rc = devwrite(sobj, iov[i].base, iov[i].len);
+    if(rc < 0) return (total > 0) ? total : rc;
+    total += rc;
+    if((unsigned int)rc < iov[i].len) break;
+  }
+  return total;
+}
+
+
+int sys_ReadV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt)
+{
+  int retcode = -1;
+
+  if(! iov_valid(iov, iovcnt)) return -1;
+
+  FCB* fcb = get_fcb(fd);
+
+  if(fcb) {
+    void* sobj = fcb->streamobj;
+    file_ops* ops = fcb->streamfunc;
+
+    FCB_incref(fcb);
+
+    io_begin(fcb);
+    if(ops->ReadV)
+      retcode = ops->ReadV(sobj, iov, iovcnt);
+    else if(ops->Read)
+      retcode = readv_fallback(sobj, ops->Read, iov, iovcnt);
+    io_end();
+
+    if(retcode > 0)
+      cur_thread()->usage.bytes_read += retcode;
+
+    FCB_decref(fcb);
+  }
+
+  return retcode;
+}
+
+
+int sys_WriteV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt)
+{
+  int retcode = -1;
+
+  if(! iov_valid(iov, iovcnt)) return -1;
+
+  FCB* fcb = get_fcb(fd);
+
+  if(fcb) {
+    void* sobj = fcb->streamobj;
+    file_ops* ops = fcb->streamfunc;
+
+    FCB_incref(fcb);
+
+    io_begin(fcb);
+    if(ops->WriteV)
+      retcode = ops->WriteV(sobj, iov, iovcnt);
+    else if(ops->Write)
+      retcode = writev_fallback(sobj, ops->Write, iov, iovcnt);
+    io_end();
+
+    if(retcode > 0)
+      cur_thread()->usage.bytes_written += retcode;
+
+    FCB_decref(fcb);
+  }
+
+  return retcode;
+}
+
+
+int sys_SetNonBlocking(Fid_t fd, int nonblocking)
+{
+  FCB* fcb = get_fcb(fd);
+  if(fcb == NULL) return -1;
+
+  int previous = (fcb->flags & FCB_NONBLOCK) != 0;
+  if(nonblocking)
+    fcb->flags |= FCB_NONBLOCK;
+  else
+    fcb->flags &= ~FCB_NONBLOCK;
+  return previous;
+}
+
+
+int sys_Available(Fid_t fd, unsigned int* readable, unsigned int* writable)
+{
+  FCB* fcb = get_fcb(fd);
+  if(fcb == NULL || fcb->streamfunc->Available == NULL) return -1;
+
+  unsigned int r = 0, w = 0;
+  if(fcb->streamfunc->Available(fcb->streamobj, &r, &w) == -1)
+    return -1;
+
+  if(readable) *readable = r;
+  if(writable) *writable = w;
+  return 0;
+}
+
+
+void watchers_notify(rlnode* watchers)
+{
+  for(rlnode* n = watchers->next; n != watchers; n = n->next) {
+    stream_watcher* w = n->obj;
+    w->notify(w->obj);
+  }
+}
+
+
+/*
+  Poll.
+
+  Poll scans the streams, and if none is ready, sleeps on the wait queues
+  of all of them at once, then scans again. The streams are pinned while
+  we sleep, since the wait queues live in their stream objects.
+ */
+
+int stream_ready(FCB* fcb, int events)
+{
+  file_ops* ops = fcb->streamfunc;
+  int ready;
+
+  if(ops->Ready)
+    ready = ops->Ready(fcb->streamobj);
+  else
+    ready = (ops->Read ? POLLIN : 0) | (ops->Write ? POLLOUT : 0);
+
+  return ready & ((events & (POLLIN|POLLOUT)) | POLLERR | POLLHUP);
+}
+
+static unsigned int poll_scan(pollfd* fds, FCB** fcbs, unsigned int n)
+{
+  unsigned int count = 0;
+  for(unsigned int i=0; i<n; i++) {
+    if(fds[i].fd < 0)
+      fds[i].revents = 0;
+    else if(fcbs[i] == NULL)
+      fds[i].revents = POLLNVAL;
+    else
+      fds[i].revents = stream_ready(fcbs[i], fds[i].events);
+    if(fds[i].revents) count++;
+  }
+  return count;
+}
+
+/* Collect the distinct wait queues of the streams */
+static unsigned int poll_waitqs(pollfd* fds, FCB** fcbs, unsigned int n, CondVar** wq)
+{
+  unsigned int nwq = 0;
+  for(unsigned int i=0; i<n; i++) {
+    if(fcbs[i] == NULL || fcbs[i]->streamfunc->WaitQueues == NULL) continue;
+
+    CondVar* cvs[MAX_POLL_WAITQ];
+    unsigned int m = fcbs[i]->streamfunc->WaitQueues(fcbs[i]->streamobj, fds[i].events, cvs);
+    for(unsigned int k=0; k<m; k++) {
+      unsigned int j = 0;
+      while(j<nwq && wq[j]!=cvs[k]) j++;
+      if(j==nwq) wq[nwq++] = cvs[k];
+    }
+  }
+  return nwq;
+}
+
+
+int sys_Poll(pollfd* fds, unsigned int n, timeout_t timeout)
+{
+  if((fds == NULL && n > 0) || n > MAX_FILEID) return -1;
+
+  FCB* local_fcbs[16];
+  FCB** fcbs = (n <= 16) ? local_fcbs : xmalloc(n*sizeof(FCB*));
+  CondVar** wq = NULL;
+
+  for(unsigned int i=0; i<n; i++) {
+    fcbs[i] = (fds[i].fd < 0) ? NULL : get_fcb(fds[i].fd);
+    if(fcbs[i]) FCB_incref(fcbs[i]);
+  }
+
+  TimerDuration deadline = (timeout == POLL_FOREVER) ? NO_TIMEOUT : kernel_deadline(timeout);
+  int preempt = preempt_off;
+
+  unsigned int count;
+  while((count = poll_scan(fds, fcbs, n)) == 0 && timeout != 0) {
+    if(wq == NULL) wq = xmalloc((n*MAX_POLL_WAITQ + 1)*sizeof(CondVar*));
+    unsigned int nwq = poll_waitqs(fds, fcbs, n, wq);
+
+    if(! kernel_wait_any_until(wq, nwq, SCHED_POLL, deadline)) {
+      count = poll_scan(fds, fcbs, n);
+      break;
+    }
+  }
+
+  if(preempt) preempt_on;
+
+  for(unsigned int i=0; i<n; i++)
+    if(fcbs[i]) FCB_decref(fcbs[i]);
+  if(fcbs != local_fcbs) free(fcbs);
+  free(wq);
+
+  return count;
+}
+
+
 int sys_Close(int fd)
 {
   int retcode = (fd>=0 && fd<MAX_FILEID) ? 0 : -1;  /* Closing a closed fd is legal! */
@@ -203,7 +624,7 @@ int sys_Close(int fd)
   FCB* fcb = get_fcb(fd);
 
   if(fcb) {
-    CURPROC->FIDT[fd] = NULL;
+    FIDT_set(CURPROC, fd, NULL);
     retcode = FCB_decref(fcb);    
   }
 
@@ -211,6 +632,14 @@ int sys_Close(int fd)
 }
 
 
+int sys_CloseRange(Fid_t lowfd, Fid_t highfd)
+{
+  if(lowfd<0 || highfd<lowfd) return -1;
+
+  return FIDT_close_range(CURPROC, lowfd, highfd);
+}
+
+
 /*
   Copy file descriptor oldfd into file descriptor newfd.
 
@@ -234,7 +663,7 @@ int sys_Dup2(int oldfd, int newfd)
     if(new)
       FCB_decref(new);
     FCB_incref(old);
-    CURPROC->FIDT[newfd] = old;
+    FIDT_set(CURPROC, newfd, old);
   }
 
   return retcode;
@@ -12,7 +12,27 @@
 #include <stdbool.h>
 
 //--------------------------------- PIPE OPS -----------------------------------------
-#define PIPE_BUFFER_SIZE 4096
+
+/* The initial (and smallest) capacity of a pipe */
+#define PIPE_MIN_CAPACITY 512
+
+/* The largest capacity a pipe grows to by itself */
+#define PIPE_ADAPTIVE_CAPACITY (64*1024)
+
+/* The largest capacity that can be set by SetPipeCapacity */
+#define PIPE_MAX_CAPACITY (1024*1024)
+
+/* A pipe grows after this many writes that found it full */
+#define PIPE_GROW_STALLS 2
+
+/* The default high watermark: readers are woken up as soon as there are data */
+#define PIPE_DEFAULT_HIWAT 1
+
+/* The capacity of a broadcast pipe, unless given */
+#define BCAST_DEFAULT_CAPACITY (16*1024)
+
+/* The length header of each message in the ring of a message pipe */
+#define PIPE_MSG_HEADER sizeof(unsigned int)
 
 typedef struct pipe_control_block {
 
@@ -23,10 +43,23 @@ typedef struct pipe_control_block {
 
   int r_position, w_position;     /* write, read position in buffer (it depends on your implementation
                                        of bounded buffer, i.e. alternatively pointers can be used) */
-  char BUFFER[PIPE_BUFFER_SIZE];    /* bounded (cyclic) byte buffer */
+  char* BUFFER;               /* bounded (cyclic) byte buffer, allocated on first write */
+  unsigned int capacity;      /* the size of BUFFER */
 
   int buff_bytes;
 
+  int fixed;                  /* the capacity was set by SetPipeCapacity, and does not adapt */
+  unsigned int stalls;        /* writes that found the buffer full, since the last resize */
+  unsigned int peak;          /* the max. of buff_bytes since the buffer was last empty */
+
+  unsigned int lowat;         /* writers waiting on a full buffer are woken when it drains to this, 0 for capacity/2 */
+  unsigned int hiwat;         /* readers waiting on an empty buffer are woken when it fills to this */
+
+  unsigned int msg_max;       /* the max. message size of a message pipe, 0 for a byte stream */
+
+  rlnode rd_watchers;         /* event queue registrations of the read end */
+  rlnode wr_watchers;         /* event queue registrations of the write end */
+
 } PIPE_CB;
 
 
@@ -40,6 +73,26 @@ int pipe_write(void* pipecb_t, const char *buf, unsigned int n);
 
 int pipe_read(void* pipecb_t, char *buf, unsigned int n);
 
+int pipe_writev(void* pipecb_t, const iovec_t* iov, unsigned int iovcnt);
+
+int pipe_readv(void* pipecb_t, const iovec_t* iov, unsigned int iovcnt);
+
+int pipe_writer_available(void* pipecb_t, unsigned int* readable, unsigned int* writable);
+
+int pipe_reader_available(void* pipecb_t, unsigned int* readable, unsigned int* writable);
+
+int pipe_writer_ready(void* pipecb_t);
+
+int pipe_reader_ready(void* pipecb_t);
+
+unsigned int pipe_writer_waitq(void* pipecb_t, int events, CondVar** wq);
+
+unsigned int pipe_reader_waitq(void* pipecb_t, int events, CondVar** wq);
+
+unsigned int pipe_writer_watchers(void* pipecb_t, int events, rlnode** lists);
+
+unsigned int pipe_reader_watchers(void* pipecb_t, int events, rlnode** lists);
+
 int pipe_writer_close(void* _pipecb);
 
 int pipe_reader_close(void* _pipecb);
@@ -48,6 +101,18 @@ int writer_blocked(void* pipecb_t, const char *buf, unsigned int n);
 
 int reader_blocked(void* pipecb_t, char *buf, unsigned int n);
 
+int sys_Splice(Fid_t fd_in, Fid_t fd_out, unsigned int n);
+
+int sys_SetPipeCapacity(Fid_t fd, unsigned int bytes);
+
+int sys_SetPipeWatermarks(Fid_t fd, unsigned int low, unsigned int high);
+
+int sys_MessagePipe(pipe_t* pipe, unsigned int max_size);
+
+int sys_BroadcastPipe(pipe_t* pipe, unsigned int capacity, bcast_mode mode);
+
+Fid_t sys_BroadcastReader(Fid_t fd);
+
 //--------------------------------- SOCKET OPS ----------------------------------------------
 
 typedef struct listener_socket L_SOCKET;
@@ -108,7 +173,22 @@ void release_SOCKET_CB(SOCKET_CB* socket_cb);
 void initialize_SOCKET_CB(SOCKET_CB* socket_cb, port_t port);
 
 int socket_read(void* socketcb_t, char *buf, unsigned int n);
+
+/** @brief The pipe that a peer socket reads from, or NULL if @c fcb is not a peer socket */
+PIPE_CB* socket_read_pipe(FCB* fcb);
+
+/** @brief The pipe that a peer socket writes to, or NULL if @c fcb is not a peer socket */
+PIPE_CB* socket_write_pipe(FCB* fcb);
+
+/** @brief The listener of a socket, or NULL if @c fcb is not a listening socket */
+L_SOCKET* socket_listener(FCB* fcb);
 int socket_write(void* socketcb_t, const char *buf, unsigned int n);
+int socket_readv(void* socketcb_t, const iovec_t* iov, unsigned int iovcnt);
+int socket_writev(void* socketcb_t, const iovec_t* iov, unsigned int iovcnt);
+int socket_available(void* socketcb_t, unsigned int* readable, unsigned int* writable);
+int socket_ready(void* socketcb_t);
+unsigned int socket_waitq(void* socketcb_t, int events, CondVar** wq);
+unsigned int socket_watchers(void* socketcb_t, int events, rlnode** lists);
 int socket_close(void* socketcb);
 
 /** @} */
@@ -160,8 +240,60 @@ typedef struct file_control_block
   void* streamobj;			/**< @brief The stream object (e.g., a device) */
   file_ops* streamfunc;		/**< @brief The stream implementation methods */
   rlnode freelist_node;		/**< @brief Intrusive list node */
+  unsigned int flags;		/**< @brief Stream flags, e.g., @c FCB_NONBLOCK */
+  rlnode evq_items;		/**< @brief The event queue registrations of this stream */
 } FCB;
 
+/** @brief The stream is in non-blocking mode.
+  @see SetNonBlocking */
+#define FCB_NONBLOCK 1
+
+
+/**
+  @brief An entry of the watcher lists of streams.
+
+  The nodes of a watcher list (see @c file_ops.Watchers) point to a
+  @c stream_watcher, whose @c notify is called with @c obj when the
+  state of the stream changes. Event queues and I/O rings are watchers.
+*/
+typedef struct stream_watcher {
+  void (*notify)(void* obj);
+  void* obj;
+} stream_watcher;
+
+/**
+  @brief Push the readiness of a stream to its watchers.
+
+  Streams keep lists of watchers (see @c file_ops.Watchers), and call this
+  when their state changes, e.g., a pipe when data are written into it.
+  The watchers must not change the list.
+  @see EventQueue
+  @see IoRingSetup
+*/
+void watchers_notify(rlnode* watchers);
+
+/** @brief Call @c watchers_notify, if there are watchers. */
+static inline void stream_notify(rlnode* watchers)
+{
+  if(! is_rlist_empty(watchers)) watchers_notify(watchers);
+}
+
+/**
+  @brief The poll events of a stream.
+
+  Return the events of @c events that hold for the stream, plus @c POLLERR
+  and @c POLLHUP, which are always reported. A stream without a @c Ready
+  operation is always ready for the operations it has.
+*/
+int stream_ready(FCB* fcb, int events);
+
+/**
+  @brief Drop the event queue registrations of a stream.
+
+  This is called when the stream is closed.
+*/
+void evq_detach(FCB* fcb);
+
 
 /** 
   @brief Initialization for files and streams.
@@ -233,6 +365,41 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb);
 void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb);
 
 
+/** @brief Set an entry of the fileid table of a process.
+
+   The table of @c pcb is grown as needed, to contain @c fid. The
+   reference count of @c fcb is not changed.
+
+   @param pcb the process
+   @param fid a legal fid, i.e., @c 0<=fid<MAX_FILEID
+   @param fcb the new entry, or NULL to free the fid
+*/
+void FIDT_set(PCB* pcb, Fid_t fid, FCB* fcb);
+
+
+/** @brief Return the first used fid of a process which is @c >=fid,
+   or NOFILE if there is none. */
+Fid_t FIDT_next(PCB* pcb, Fid_t fid);
+
+
+/** @brief Copy the fileid table of @c src into the (empty) table of @c dst.
+
+   The reference count of every FCB in the table is increased.
+*/
+void FIDT_copy(PCB* dst, PCB* src);
+
+
+/** @brief Close the used fids of a process in the range @c lowfd to @c highfd.
+
+   @returns 0 on success, or -1 if some @c Close operation failed.
+*/
+int FIDT_close_range(PCB* pcb, Fid_t lowfd, Fid_t highfd);
+
+
+/** @brief Close all fids of a process and free its fileid table. */
+void FIDT_release(PCB* pcb);
+
+
 /** @brief Translate an fid to an FCB.
 
 	This routine will return NULL if the fid is not legal.
@@ -6,13 +6,18 @@
 
 #define SYSCALLS \
 SYSCALL(Exec, int, (Task task, int argl, void* args), (task, argl, args))\
+SYSCALL(ExecMany, int, (Task task, unsigned int n, const exec_args* argv, Pid_t* pids), (task, n, argv, pids))\
 SYSCALLV(Exit, (int exitval), (exitval))\
 SYSCALL(GetPid, int, (void), ())\
 SYSCALL(GetPPid, int, (void), ())\
 SYSCALL(WaitChild, Pid_t, (Pid_t proc, int* exitval), (proc, exitval))\
+SYSCALL(WaitChildTimeout, Pid_t, (Pid_t proc, int* exitval, timeout_t timeout), (proc, exitval, timeout))\
+SYSCALL(WaitChildren, int, (Pid_t* pids, int* exitvals, unsigned int n), (pids, exitvals, n))\
 SYSCALL(CreateThread, Tid_t, (Task task, int argl, void* args), (task, argl, args))\
 SYSCALL(ThreadSelf, Tid_t, (void), ())\
 SYSCALL(ThreadJoin, int, (Tid_t tid, int* exitval), (tid, exitval))\
+SYSCALL(ThreadJoinTimeout, int, (Tid_t tid, int* exitval, timeout_t timeout), (tid, exitval, timeout))\
+SYSCALL(ThreadJoinAny, Tid_t, (int* exitval), (exitval))\
 SYSCALL(ThreadDetach, int, (Tid_t tid), (tid))\
 SYSCALLV(ThreadExit, (int exitval), (exitval))\
 SYSCALL(GetTerminalDevices, unsigned int, (), ())\
@@ -20,15 +25,37 @@ SYSCALL(OpenTerminal, Fid_t, (unsigned int termno), (termno))\
 SYSCALL(OpenNull, Fid_t, (), ())\
 SYSCALL(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
 SYSCALL(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
+SYSCALL(ReadV,int,(Fid_t fd, const iovec_t* iov, unsigned int iovcnt), (fd,iov,iovcnt))\
+SYSCALL(WriteV,int,(Fid_t fd, const iovec_t* iov, unsigned int iovcnt), (fd,iov,iovcnt))\
+SYSCALL(SetNonBlocking,int,(Fid_t fd, int nonblocking),(fd,nonblocking))\
+SYSCALL(Available,int,(Fid_t fd, unsigned int* readable, unsigned int* writable),(fd,readable,writable))\
+SYSCALL(Poll,int,(pollfd* fds, unsigned int n, timeout_t timeout),(fds,n,timeout))\
+SYSCALL(EventQueue,Fid_t,(),())\
+SYSCALL(EventCtl,int,(Fid_t evq, evq_op op, Fid_t fd, int events),(evq,op,fd,events))\
+SYSCALL(EventWait,int,(Fid_t evq, evq_event* events, unsigned int max, timeout_t timeout),(evq,events,max,timeout))\
 SYSCALL(Close,int,(Fid_t fd),(fd))\
+SYSCALL(CloseRange,int,(Fid_t lowfd, Fid_t highfd),(lowfd,highfd))\
 SYSCALL(Dup2,int, (Fid_t oldfd, Fid_t newfd), (oldfd,newfd))\
 SYSCALL(Pipe, int, (pipe_t* pipe), (pipe))\
+SYSCALL(MessagePipe, int, (pipe_t* pipe, unsigned int max_size), (pipe, max_size))\
+SYSCALL(BroadcastPipe, int, (pipe_t* pipe, unsigned int capacity, bcast_mode mode), (pipe, capacity, mode))\
+SYSCALL(BroadcastReader, Fid_t, (Fid_t fd), (fd))\
+SYSCALL(Splice, int, (Fid_t fd_in, Fid_t fd_out, unsigned int n), (fd_in, fd_out, n))\
+SYSCALL(SetPipeCapacity, int, (Fid_t fd, unsigned int bytes), (fd, bytes))\
+SYSCALL(SetPipeWatermarks, int, (Fid_t fd, unsigned int low, unsigned int high), (fd, low, high))\
+SYSCALL(ShmCreate, Fid_t, (unsigned int size), (size))\
+SYSCALL(ShmAttach, void*, (Fid_t fd, unsigned int* size), (fd, size))\
 SYSCALL(Socket, Fid_t, (port_t port), (port))\
 SYSCALL(Listen, int, (Fid_t sock), (sock))\
 SYSCALL(Accept, Fid_t, (Fid_t lsock), (lsock))\
 SYSCALL(Connect, int, (Fid_t sock, port_t port, timeout_t timeout), (sock, port, timeout))\
 SYSCALL(ShutDown, int, (Fid_t sock, shutdown_mode how), (sock, how))\
+SYSCALL(IoRingSetup, Fid_t, (unsigned int entries, io_ring** ring), (entries, ring))\
+SYSCALL(IoRingEnter, int, (Fid_t ring, unsigned int to_submit, unsigned int min_complete, timeout_t timeout), (ring, to_submit, min_complete, timeout))\
+SYSCALL(GetRusage, int, (rusage_who who, rusage_t* usage), (who, usage))\
 SYSCALL(OpenInfo, Fid_t, (), ())\
+SYSCALL(OpenThreadInfo, Fid_t, (), ())\
+SYSCALL(OpenLockInfo, Fid_t, (), ())\
 
 
 
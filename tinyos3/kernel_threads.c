@@ -9,24 +9,32 @@
   */
 Tid_t sys_CreateThread(Task task, int argl, void* args)
 {
+  PCB* curproc = CURPROC;
+
+  if(task == NULL)
+    return NOTHREAD;
+
   PTCB* new_process_thread = acquire_PTCB();                                                    // we allocate space for PTCB
   initialize_PTCB(new_process_thread);                                                          // initialization of PTCB
 
-  if(task != NULL) {
-    TCB *new_thread = spawn_thread(CURPROC, new_process_thread, start_process_thread);  
-    new_process_thread->tcb = new_thread;
-    new_thread->ptcb = new_process_thread;
-    new_process_thread->task = task;
-    new_process_thread->argl = argl;
-    new_process_thread->args = args;
-    rlnode_init(&new_process_thread->ptcb_list_node, new_process_thread);
-    rlist_push_back(&CURPROC->ptcb_list, &new_process_thread->ptcb_list_node);                  // filling the list with PTCBs 
-    wakeup(new_process_thread->tcb);
+  /* Out of thread handles */
+  if(acquire_tid(curproc, new_process_thread) == NOTHREAD) {
+    release_PTCB(new_process_thread);
+    return NOTHREAD;
   }
+
+  TCB *new_thread = spawn_thread(curproc, new_process_thread, start_process_thread);  
+  new_process_thread->tcb = new_thread;
+  new_process_thread->task = task;
+  new_process_thread->argl = argl;
+  new_process_thread->args = args;
   
-  CURPROC->thread_count++;                                                                      // the number of threads has encreased by one
+  curproc->thread_count++;                                                                      // the number of threads has encreased by one
+  curproc->joinable_count++;
 
-  return (Tid_t)new_process_thread;
+  wakeup(new_thread);
+
+  return new_process_thread->tid;
 }
 
 
@@ -35,47 +43,93 @@ Tid_t sys_CreateThread(Task task, int argl, void* args)
  */
 Tid_t sys_ThreadSelf()
 {
-  return (Tid_t) cur_thread()->ptcb;
+  return cur_thread()->ptcb->tid;
 }
 
 
-/**
-  @brief Join the given thread.
-  */
-int sys_ThreadJoin(Tid_t tid, int* exitval)
+/*
+  Join the given thread, waiting until the deadline at most.
+ */
+static int thread_join(Tid_t tid, int* exitval, TimerDuration deadline)
 {
   PCB* curproc = CURPROC;                                 
-  PTCB* ptcb = (PTCB*)tid;
+  PTCB* ptcb = get_ptcb(curproc, tid);
 
-  if (rlist_find(&curproc->ptcb_list, ptcb, NULL) == NULL)
+  /* Legality checks */
+  if (ptcb == NULL || ptcb == cur_thread()->ptcb || ptcb->detached)
     return -1;
 
-  if (ptcb == (PTCB*)sys_ThreadSelf())
+  ptcb->refcount++;
+    
+  while (ptcb->exited != 1 && ptcb->detached != 1) {                
+    if (! kernel_wait_until(& ptcb->exit_cv, SCHED_USER, deadline))
+      break;
+  }
+
+  ptcb->refcount--;                                 
+
+  /* Timed out */
+  if (ptcb->exited != 1 && ptcb->detached != 1)
     return -1;
 
-  /* Legality checks */
+  /* The last thread to leave releases an exited thread */
+  int detached = ptcb->detached;
+  if (exitval != NULL && !detached)
+    *exitval = ptcb->exitval;     
 
-    ptcb->refcount++;
-    
-    while (ptcb->exited != 1 && ptcb->detached != 1) {                
-        kernel_wait(& ptcb->exit_cv, SCHED_USER);
-    }
+  /* A joined thread is not returned by ThreadJoinAny */
+  rlist_remove(& ptcb->exit_node);
 
-    ptcb->refcount--;                                 
+  if (ptcb->refcount == 0 && ptcb->exited)
+    release_thread(curproc, ptcb);
 
-    if (ptcb->detached == 1) 
-      return -1;
+  return detached ? -1 : 0;
+}
 
-    if (exitval != NULL) {
-      *exitval = ptcb->exitval;     
-     }  
 
-    if (ptcb->refcount == 0) {
-      rlist_remove(& ptcb->ptcb_list_node);
-      free(ptcb);
-    }
+/**
+  @brief Join the given thread.
+  */
+int sys_ThreadJoin(Tid_t tid, int* exitval)
+{
+  return thread_join(tid, exitval, NO_TIMEOUT);
+}
 
-  return 0;
+
+/**
+  @brief Join the given thread, with a timeout.
+  */
+int sys_ThreadJoinTimeout(Tid_t tid, int* exitval, timeout_t timeout)
+{
+  return thread_join(tid, exitval, kernel_deadline(timeout));
+}
+
+
+/**
+  @brief Join any thread of the current process.
+  */
+Tid_t sys_ThreadJoinAny(int* exitval)
+{
+  PCB* curproc = CURPROC;
+  PTCB* self = cur_thread()->ptcb;
+
+  while (is_rlist_empty(& curproc->exited_threads)) {
+    /* Is there any other thread to wait for? */
+    if (curproc->joinable_count == (self->detached ? 0 : 1))
+      return NOTHREAD;
+    kernel_wait(& curproc->thread_exit, SCHED_USER);
+  }
+
+  PTCB* ptcb = rlist_pop_front(& curproc->exited_threads)->ptcb;
+  Tid_t tid = ptcb->tid;
+  if (exitval != NULL)
+    *exitval = ptcb->exitval;
+
+  /* Threads that still join it specifically will release it */
+  if (ptcb->refcount == 0)
+    release_thread(curproc, ptcb);
+
+  return tid;
 }
 
 
@@ -85,16 +139,20 @@ int sys_ThreadJoin(Tid_t tid, int* exitval)
 int sys_ThreadDetach(Tid_t tid)
 {
   PCB* curproc = CURPROC;
-  PTCB* ptcb = (PTCB*)tid;
+  PTCB* ptcb = get_ptcb(curproc, tid);
 
-  if (rlist_find(&curproc->ptcb_list, ptcb, NULL) == NULL)
+  if (ptcb == NULL)
     return -1;
 
   if((ptcb->exited == 1))                                 // Once the thread exits, it won't be detached 
     return -1;
   
+  if (! ptcb->detached) {
+    curproc->joinable_count--;
+    kernel_broadcast(& curproc->thread_exit);
+  }
+
   ptcb->detached = 1;                                     // Flag = 1, this thread can not be joined
-  ptcb->refcount = 0;
   kernel_broadcast(& ptcb->exit_cv);
   
   return 0;
@@ -107,11 +165,25 @@ int sys_ThreadDetach(Tid_t tid)
 void sys_ThreadExit(int exitval)
 {
   PCB *curproc = CURPROC;  /* cache for efficiency */
-  PTCB* ptcb = (PTCB*)sys_ThreadSelf();
+  PTCB* ptcb = cur_thread()->ptcb;
 
   ptcb->exited = 1;
   ptcb->exitval = exitval;
-  kernel_broadcast(& cur_thread()->ptcb->exit_cv);
+
+  /* From now on, the usage of this thread is part of the process usage */
+  rusage_add(& curproc->usage, & cur_thread()->usage);
+  kernel_broadcast(& ptcb->exit_cv);
+
+  /* A joinable thread waits for ThreadJoinAny, too */
+  if (! ptcb->detached) {
+    curproc->joinable_count--;
+    rlist_push_back(& curproc->exited_threads, & ptcb->exit_node);
+    kernel_broadcast(& curproc->thread_exit);
+  }
+
+  /* A detached thread is released at once, unless joiners are still leaving */
+  if (ptcb->detached && ptcb->refcount == 0)
+    release_thread(curproc, ptcb);
 
   /* First, store the exit status */
   curproc->thread_count--;
@@ -119,11 +191,14 @@ void sys_ThreadExit(int exitval)
   if (curproc->thread_count == 0) {
 
     /* free ptcbs */
-    while(!is_rlist_empty(& curproc->ptcb_list)) {
-
-      PTCB* ptcb_temp = rlist_pop_front(& curproc->ptcb_list)->ptcb;
-      free(ptcb_temp);
-    }
+    for(unsigned int i=0; i<curproc->thread_table_size; i++)
+      if(curproc->thread_table[i].ptcb != NULL)
+        release_PTCB(curproc->thread_table[i].ptcb);
+    free(curproc->thread_table);
+    rlnode_init(& curproc->exited_threads, NULL);
+    curproc->thread_table = NULL;
+    curproc->thread_table_size = 0;
+    curproc->thread_table_free = NO_THREAD_HANDLE;
 
 
     if(get_pid(curproc)!=1) {
@@ -143,8 +218,10 @@ void sys_ThreadExit(int exitval)
         kernel_broadcast(& initpcb->child_exit);
       }
 
-      /* Put me into my parent's exited list */
+      /* Put me into my parent's exited list, and wake up only the threads
+         that wait for me, or for any child */
       rlist_push_front(& curproc->parent->exited_list, &curproc->exited_node);
+      kernel_broadcast(& curproc->exit_wait);
       kernel_broadcast(& curproc->parent->child_exit);
 
     }
@@ -163,12 +240,7 @@ void sys_ThreadExit(int exitval)
     }
 
     /* Clean up FIDT */
-    for(int i=0;i<MAX_FILEID;i++) {
-      if(curproc->FIDT[i] != NULL) {
-        FCB_decref(curproc->FIDT[i]);
-        curproc->FIDT[i] = NULL;
-      }
-    }
+    FIDT_release(curproc);
 
     /* Disconnect my main_thread */
     curproc->main_thread = NULL;
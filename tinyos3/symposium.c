@@ -177,16 +177,22 @@ int SymposiumOfProcesses(int argl, void* args)
   SymposiumTable_init(&S, symp);
   
   /* Execute philosophers */
+  philosopher_args Args[N];
+  exec_args argv[N];
+  Pid_t pids[N];
   for(int i=0;i<N;i++) {
-    philosopher_args Args;
-    Args.i = i;
-    Args.S = &S;
-    Exec(PhilosopherProcess, sizeof(Args), &Args);
+    Args[i].i = i;
+    Args[i].S = &S;
+    argv[i].argl = sizeof(philosopher_args);
+    argv[i].args = &Args[i];
   }  
+  int n = ExecMany(PhilosopherProcess, N, argv, pids);
 
   /* Wait for philosophers to exit */  
-  for(int i=0;i<N;i++) {
-    WaitChild(NOPROC, NULL);
+  for(int i=0; i<n; ) {
+    int rc = WaitChildren(pids, NULL, N);
+    if(rc <= 0) break;
+    i += rc;
   }
 
   SymposiumTable_destroy(&S);
@@ -46,8 +46,9 @@ typedef unsigned long timeout_t;
 typedef int Fid_t;  
 
 /** @brief The maximum number of open files per process. 
-   Only values 0 to MAX_FILEID-1 are legal for file descriptors. */
-#define MAX_FILEID 16
+   Only values 0 to MAX_FILEID-1 are legal for file descriptors. 
+   The fileid table of a process grows on demand up to this size. */
+#define MAX_FILEID 1024
 
 /** @brief The invalid file id. */
 #define NOFILE  (-1)
@@ -72,11 +73,25 @@ typedef uintptr_t Tid_t;
     mutexes are suitable for use in user-space, as well as in the implementation 
     of the kernel.
 
+    A mutex also keeps a queue of threads that were signalled on a condition
+    variable while the mutex was held (see @c Cond_Signal). Rather than
+    waking up only to collide on the mutex, these threads sleep until
+    @c Mutex_Unlock wakes them up, one at a time.
+
     @see Mutex_Lock
     @see Mutex_Unlock
     @see MUTEX_INIT
 */
-typedef char Mutex;
+typedef struct {
+  char lock;            /**< The spinlock word */
+  char waitq_lock;      /**< A spinlock to protect `waitq` */
+  char cond_waits;      /**< Set once the mutex has been used with a condition variable */
+  void *waitq;          /**< Threads waiting for the mutex to be unlocked */
+#ifdef LOCK_PROFILING
+  void *prof_site;      /**< The lock site of the current holder */
+  unsigned long prof_since;  /**< The time the current holder acquired the mutex */
+#endif
+} Mutex;
 
 /**
   @brief This macro is used to initialize mutexes. 
@@ -85,8 +100,14 @@ typedef char Mutex;
   @code
    Mutex my_mutex = MUTEX_INIT;
   @endcode
+
+  When a mutex is nested in the initializer of an enclosing structure,
+  use @c MUTEX_INITIALIZER instead.
  */
-#define MUTEX_INIT 0
+#define MUTEX_INIT ((Mutex) MUTEX_INITIALIZER)
+
+/** @brief A brace-enclosed initializer for mutexes, as used inside @c MUTEX_INIT. */
+#define MUTEX_INITIALIZER { 0, 0, 0, NULL }
 
 
 /** @brief Lock a mutex.
@@ -103,7 +124,8 @@ void Mutex_Lock(Mutex*);
 
 /** @brief Unlock a mutex that you locked. 
   
-    This operation is non-blocking.
+    This operation is non-blocking. If threads have been requeued on the
+    mutex by a condition variable, the first of them is woken up.
     @see Mutex
     @see Mutex_Lock
 */
@@ -133,7 +155,7 @@ typedef struct {
   CondVar my_cv = COND_INIT;
   @endcode
  */
-#define COND_INIT ((CondVar){ NULL, MUTEX_INIT })
+#define COND_INIT ((CondVar){ NULL, MUTEX_INITIALIZER })
 
 
 /** @brief Wait on a condition variable. 
@@ -186,6 +208,10 @@ int Cond_TimedWait(Mutex* mx, CondVar* cv, timeout_t timeout);
    This call wakes up exactly one thread sleeping on this condition
    variable (if any). Note that the woken thread does not preempt the
    calling thread; i.e., this is a Mesa-style implementation.
+
+   If the mutex the thread waits with is locked at the time of the call
+   (typically, by the caller), the thread is not made ready; instead it is 
+   requeued on the mutex and woken up when the mutex is unlocked.
    @see Cond_Wait
    @see Cond_Broadcast
    */
@@ -195,11 +221,132 @@ void Cond_Signal(CondVar*);
 
   Broadcast wakes up all threads sleeping on this condition variable.
   The calling thread is not preempted by the awoken threads.
+  Threads whose mutex is locked are requeued on it, so that they are
+  woken up one at a time, as the mutex is unlocked.
 
   @see Cond_Wait
   @see Cond_Signal
 */
-void Cond_Broadcast(CondVar*); 
+void Cond_Broadcast(CondVar*);
+
+
+/* 
+  When the kernel is built for lock profiling, every lock operation passes 
+  its call site along, so that statistics are kept per lock site. 
+  @see OpenLockInfo
+*/
+#ifdef LOCK_PROFILING
+void Mutex_Lock_at(Mutex*, const char* site);
+int Cond_Wait_at(Mutex*, CondVar*, const char* site);
+int Cond_TimedWait_at(Mutex*, CondVar*, timeout_t, const char* site);
+void Cond_Signal_at(CondVar*, const char* site);
+void Cond_Broadcast_at(CondVar*, const char* site);
+
+#define Mutex_Lock(mx) Mutex_Lock_at((mx), __FUNCTION__)
+#define Cond_Wait(mx, cv) Cond_Wait_at((mx), (cv), __FUNCTION__)
+#define Cond_TimedWait(mx, cv, t) Cond_TimedWait_at((mx), (cv), (t), __FUNCTION__)
+#define Cond_Signal(cv) Cond_Signal_at((cv), __FUNCTION__)
+#define Cond_Broadcast(cv) Cond_Broadcast_at((cv), __FUNCTION__)
+#endif
+
+
+/** @brief Barriers.
+
+  A barrier blocks a group of threads, until all of them have reached it.
+  The barrier is implemented by the scheduler: when the last thread arrives,
+  all waiting threads are made ready in a single batch, and none of them
+  needs to re-acquire a lock on the way out. A barrier can be reused for
+  any number of successive episodes.
+
+  @see Barrier_Sync
+  @see BARRIER_INIT
+ */
+typedef struct {
+  void *waitset;          /**< The set of waiting threads */
+  Mutex lock;             /**< A mutex to protect the barrier */
+  unsigned int count;     /**< The number of threads arrived in the current episode */
+  unsigned int epoch;     /**< The number of completed episodes */
+} Barrier;
+
+/** @brief  This macro is used to initialize barriers.
+
+   It is used as follows:
+  @code
+  Barrier my_barrier = BARRIER_INIT;
+  @endcode
+ */
+#define BARRIER_INIT ((Barrier){ NULL, MUTEX_INITIALIZER, 0, 0 })
+
+
+/** @brief Wait at a barrier.
+
+  The calling thread blocks until @c n threads (including itself) have called
+  @c Barrier_Sync on this barrier. The last thread to arrive does not block,
+  but releases all others.
+
+  All threads of an episode must pass the same value for @c n.
+
+  @param bar the barrier
+  @param n the number of threads that synchronize at the barrier
+  */
+void Barrier_Sync(Barrier* bar, unsigned int n);
+
+
+/** @brief Counting semaphores.
+
+  A semaphore holds a non-negative counter. @c Sem_Wait decrements the counter,
+  blocking while it is zero, and @c Sem_Post increments it. When a thread is blocked
+  on the semaphore, @c Sem_Post hands the unit directly to the first waiter (in FIFO
+  order), so a woken thread never has to contend for it again.
+
+  @see Sem_Wait
+  @see Sem_TimedWait
+  @see Sem_Post
+  @see SEMAPHORE_INIT
+ */
+typedef struct {
+  void *waitset;          /**< The set of waiting threads */
+  Mutex lock;             /**< A mutex to protect the semaphore */
+  int value;              /**< The semaphore counter */
+} Semaphore;
+
+/** @brief  This macro is used to initialize semaphores.
+
+   It is used as follows:
+  @code
+  Semaphore my_sem = SEMAPHORE_INIT(1);
+  @endcode
+ */
+#define SEMAPHORE_INIT(n) ((Semaphore){ NULL, MUTEX_INITIALIZER, (n) })
+
+
+/** @brief Decrement a semaphore, waiting as long as needed.
+
+  @param sem the semaphore
+  @see Sem_Post
+  */
+void Sem_Wait(Semaphore* sem);
+
+
+/** @brief Decrement a semaphore, waiting up to a timeout.
+
+  @param sem the semaphore
+  @param timeout The time in milliseconds to wait blocked on the semaphore.
+  @returns 1 if the semaphore was decremented, 0 if the timeout expired
+  @see Sem_Post
+  */
+int Sem_TimedWait(Semaphore* sem, timeout_t timeout);
+
+
+/** @brief Increment a semaphore.
+
+  If threads are blocked on the semaphore, the first one is woken up instead.
+  This operation is non-blocking.
+
+  @param sem the semaphore
+  @see Sem_Wait
+  */
+void Sem_Post(Semaphore* sem);
 
 
 /*******************************************
@@ -241,6 +388,35 @@ typedef int (*Task)(int, void*);
 Pid_t Exec(Task task, int argl, void* args);
 
 
+/** @brief The argument of a process created by @c ExecMany. 
+  @see ExecMany
+ */
+typedef struct exec_args {
+  int argl;         /**< @brief The length of byte array @c args */
+  void* args;       /**< @brief The byte array copied as argument to the task */
+} exec_args;
+
+
+/** @brief Create many new processes.
+
+  This call is equivalent to calling @c Exec(task, argv[i].argl, argv[i].args)
+  for @c i=0,...,n-1 and storing the returned pids in @c pids[i], but it 
+  is done in a single system call. If @c argv is NULL, every child is passed
+  an empty argument (0, NULL).
+
+  @param task the main function of the new processes
+  @param n the number of processes to create
+  @param argv an array of @c n arguments, or NULL
+  @param pids an array of size at least @c n, to receive the new pids
+  @return the number of processes created, which is less than @c n only
+    if the maximum number of processes has been reached, or -1 on error. 
+    Possible errors:
+    - @c task is NULL or @c pids is NULL.
+  @see WaitChildren
+  */
+int ExecMany(Task task, unsigned int n, const exec_args* argv, Pid_t* pids);
+
+
 /** @brief Exit the current process.
 
   When this function is called by a process thread, the process terminates
@@ -279,6 +455,41 @@ void Exit(int val);
 */
 Pid_t WaitChild(Pid_t pid, int* exitval);
 
+
+/** @brief Wait for a child process to exit, with a timeout.
+
+   This is like @c WaitChild, but it gives up after @c timeout 
+   milliseconds.
+
+   @param pid the process ID of the child to wait on, or @c NOPROC to
+           designate waiting for any child.
+   @param exitval a location to store the exit status of the child, or NULL
+   @param timeout the max. time to wait, in milliseconds
+   @return the pid of the exited child, or @c NOPROC on error or timeout. 
+   The possible errors are those of @c WaitChild.
+   @see WaitChild
+*/
+Pid_t WaitChildTimeout(Pid_t pid, int* exitval, timeout_t timeout);
+
+
+/** @brief Wait on many terminating children.
+
+   This function waits until some child process of the current process 
+   has exited, and then cleans up as many exited children as possible, 
+   up to @c n of them, in a single call. This is equivalent to (but 
+   cheaper than) a sequence of calls @c WaitChild(NOPROC, &exitvals[i]).
+
+   @param pids an array of size at least @c n, to receive the pids of 
+     the exited children
+   @param exitvals an array of size at least @c n, to receive their exit
+     statuses, or NULL
+   @param n the maximum number of children to clean up
+   @return the number of children cleaned up (at least 1), or 0 if the 
+    current process has no children, or -1 on error. Possible errors:
+    - @c pids is NULL or @c n is 0.
+*/
+int WaitChildren(Pid_t* pids, int* exitvals, unsigned int n);
+
 /** @brief Return the PID of the caller.
 
  This function returns the pid of the current process 
@@ -352,6 +563,40 @@ Tid_t ThreadSelf();
 int ThreadJoin(Tid_t tid, int* exitval);
 
 
+/**
+  @brief Join the given thread, with a timeout.
+
+  This is like @c ThreadJoin, but it gives up after @c timeout 
+  milliseconds. A thread that was not joined because of a timeout
+  can be joined later.
+
+  @param tid the thread to join
+  @param exitval a location where to store the exit value of the joined 
+              thread, or NULL.
+  @param timeout the max. time to wait, in milliseconds
+  @returns 0 on success and -1 on error or timeout. The possible errors are 
+    those of @c ThreadJoin.
+  @see ThreadJoin
+  */
+int ThreadJoinTimeout(Tid_t tid, int* exitval, timeout_t timeout);
+
+
+/**
+  @brief Join any thread of the current process.
+
+  This function waits until some undetached thread of the process (other
+  than the caller) has exited, and joins it. Exited threads that have not 
+  been joined are returned first, in the order they exited. 
+
+  @param exitval a location where to store the exit value of the joined 
+              thread, or NULL.
+  @returns the tid of the joined thread, or NOTHREAD if there is no 
+    undetached thread to join, besides the caller.
+  @see ThreadJoin
+  */
+Tid_t ThreadJoinAny(int* exitval);
+
+
 /**
   @brief Detach the given thread.
 
@@ -431,6 +676,9 @@ Fid_t OpenNull();
         Possible errors are:
          - The file descriptor is invalid.
          - There was a I/O runtime problem.
+        On a non-blocking stream, @c WOULDBLOCK is returned if there are no data
+        to read.
+  @see SetNonBlocking
  */
 int Read(Fid_t fd, char *buf, unsigned int size);
 
@@ -454,10 +702,229 @@ int Read(Fid_t fd, char *buf, unsigned int size);
    Possible errors are:
    - The file id is invalid.
    - There was a I/O runtime problem.
+   On a non-blocking stream, @c WOULDBLOCK is returned if no bytes can be
+   written without sleeping.
+  @see SetNonBlocking
  */
 int Write(Fid_t fd, const char* buf, unsigned int size);
 
 
+/** @brief A buffer segment for scatter-gather I/O.
+  @see ReadV
+  @see WriteV
+ */
+typedef struct io_segment {
+  void* base;         /**< @brief The start of the segment */
+  unsigned int len;   /**< @brief The size of the segment in bytes */
+} iovec_t;
+
+/** @brief The max. number of segments of a @c ReadV or @c WriteV call. */
+#define MAX_IOV 64
+
+
+/** @brief Read bytes from a stream into many buffers.
+
+   This is like @c Read, but the data are placed into the segments of
+   @c iov in order, filling each segment before moving to the next. 
+   A single call returns the data that a @c Read of the total size would
+   return.
+
+  @param fd  the file ID of the stream to read from
+  @param iov an array of @c iovcnt segments
+  @param iovcnt the number of segments, at most @c MAX_IOV
+  @return the total number of bytes copied, 0 if we have reached EOF, or -1,
+        indicating some error. Possible errors are:
+         - The file descriptor is invalid.
+         - @c iovcnt is larger than @c MAX_IOV, or a segment is NULL.
+         - There was a I/O runtime problem.
+  @see Read
+ */
+int ReadV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt);
+
+
+/** @brief Write bytes to a stream from many buffers.
+
+   This is like @c Write, but the data are taken from the segments of
+   @c iov in order. For pipes and sockets, the segments are written with
+   a single wake-up of the reader, e.g., a header and a payload arrive 
+   together.
+
+  @param fd  the file ID of the stream to write to
+  @param iov an array of @c iovcnt segments
+  @param iovcnt the number of segments, at most @c MAX_IOV
+  @return the total number of bytes copied, or -1 on error. 
+   Possible errors are:
+   - The file id is invalid.
+   - @c iovcnt is larger than @c MAX_IOV, or a segment is NULL.
+   - There was a I/O runtime problem.
+  @see Write
+ */
+int WriteV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt);
+
+
+/** @brief Returned by I/O calls on a non-blocking stream, instead of sleeping.
+
+  This value is distinct from -1, so that a program can tell a stream that 
+  has nothing to offer yet from a failed one.
+  @see SetNonBlocking
+ */
+#define WOULDBLOCK (-2)
+
+
+/** @brief Set or clear the non-blocking mode of a stream.
+
+  In non-blocking mode, the calls @c Read, @c Write, @c ReadV, @c WriteV 
+  and @c Splice return @c WOULDBLOCK in every case where they would 
+  otherwise put the calling thread to sleep. When some bytes can be 
+  transferred, they return as many as possible, without sleeping.
+
+  The mode is a property of the stream, not the file id. Therefore, it is
+  shared by all file ids (of any process) that refer to the stream, e.g.,
+  after @c Dup2. A new stream is in blocking mode.
+
+  @param fd the file id of the stream
+  @param nonblocking if non-zero, set non-blocking mode, else set blocking mode
+  @return the previous mode (1 for non-blocking, 0 for blocking), or -1 if 
+    the file id is invalid.
+ */
+int SetNonBlocking(Fid_t fd, int nonblocking);
+
+
+/** @brief Query the bytes that can be transferred on a stream without sleeping.
+
+  On return, @c *readable is the number of bytes that are buffered in the stream
+  and can be read at once, and @c *writable is the number of bytes that can be 
+  written at once. For a stream that is not readable (writable), such as the write 
+  (read) end of a pipe, the respective value is 0. For the null device both values
+  are @c UINT_MAX. Either pointer may be NULL.
+
+  This query never sleeps and does not change the stream.
+
+  @param fd the file id of the stream
+  @param readable location to store the number of readable bytes, or NULL
+  @param writable location to store the number of writable bytes, or NULL
+  @return 0 on success, or -1 on error. Possible errors are:
+    - The file id is invalid.
+    - The stream does not support this query (e.g., a terminal).
+ */
+int Available(Fid_t fd, unsigned int* readable, unsigned int* writable);
+
+
+/** @brief Poll event: the stream can be read without sleeping (there are data, or EOF) */
+#define POLLIN		0x001
+/** @brief Poll event: the stream can be written without sleeping */
+#define POLLOUT		0x004
+/** @brief Poll event: a write would fail, e.g., the read end of a pipe is closed (output only) */
+#define POLLERR		0x008
+/** @brief Poll event: the peer has closed, e.g., the write end of a pipe (output only) */
+#define POLLHUP		0x010
+/** @brief Poll event: the file id is not open (output only) */
+#define POLLNVAL	0x020
+
+/** @brief A timeout for @c Poll that never expires */
+#define POLL_FOREVER ((timeout_t)-1)
+
+/** @brief A file id and its events of interest, for @c Poll. */
+typedef struct poll_fid {
+  Fid_t fd;         /**< @brief The file id, or a negative value to skip this entry */
+  short events;     /**< @brief The events of interest, e.g., @c POLLIN|POLLOUT */
+  short revents;    /**< @brief Set by @c Poll to the events that occurred */
+} pollfd;
+
+
+/** @brief Wait until some of many streams are ready for I/O.
+
+  For each entry of @c fds, @c Poll sets @c revents to the events of @c events
+  that can happen without sleeping, plus any of @c POLLERR, @c POLLHUP and 
+  @c POLLNVAL, which are reported even if not requested. If no entry has any
+  event, the calling thread sleeps until one does, or until the timeout expires.
+
+  Streams without readiness support (e.g., the info streams) are always ready.
+  A stream that is ready for @c POLLIN may still return 0 (EOF) on @c Read.
+
+  @param fds an array of @c n entries
+  @param n the number of entries, at most @c MAX_FILEID
+  @param timeout the max. time to wait, in milliseconds: 0 returns at once, and
+    @c POLL_FOREVER waits for ever.
+  @returns the number of entries with a non-zero @c revents, 0 if the timeout
+    expired, or -1 if @c fds is NULL or @c n is too large.
+  @see SetNonBlocking
+ */
+int Poll(pollfd* fds, unsigned int n, timeout_t timeout);
+
+
+/** @brief Event queue interest flag: report the events of a stream once per change. 
+  @see EventCtl */
+#define EVQ_EDGE	0x1000
+
+/** @brief The operations of @c EventCtl */
+typedef enum {
+  EVQ_ADD,    /**< @brief Register a stream */
+  EVQ_MOD,    /**< @brief Change the events of interest of a registered stream */
+  EVQ_DEL     /**< @brief Remove a registered stream */
+} evq_op;
+
+/** @brief An event reported by an event queue. */
+typedef struct evq_event {
+  Fid_t fd;     /**< @brief The file id, as registered */
+  int events;   /**< @brief The poll events that hold for the stream */
+} evq_event;
+
+
+/** @brief Create an event queue.
+
+  An event queue watches a set of streams, registered by @c EventCtl, and
+  reports the ones that are ready for I/O through @c EventWait (or @c Read).
+  Unlike @c Poll, the cost of a wait is proportional to the number of ready
+  streams, not the number of registered ones: pipes and sockets push their
+  changes of state into the queue.
+
+  A registration is dropped when its stream is closed (by all file ids that
+  refer to it). An event queue can be polled, or registered into another 
+  event queue, as a stream that is readable when it has events.
+
+  @return a new file id, or NOFILE if the file ids are exhausted.
+ */
+Fid_t EventQueue();
+
+
+/** @brief Register, modify or remove a stream of an event queue.
+
+  The @c events is a mask of @c POLLIN and @c POLLOUT, optionally with 
+  @c EVQ_EDGE. By default, a stream is reported by every wait while it is 
+  ready (level-triggered). With @c EVQ_EDGE, a stream is reported once 
+  when it becomes ready, and then only after its state changes again, 
+  e.g., more data arrive (edge-triggered).
+
+  @param evq the file id of the event queue
+  @param op one of @c EVQ_ADD, @c EVQ_MOD, @c EVQ_DEL
+  @param fd the file id of the stream
+  @param events the events of interest, ignored by @c EVQ_DEL
+  @return 0 on success, or -1 on error. Possible errors are:
+    - @c evq is not an event queue, or @c fd is not a file id
+    - @c fd refers to @c evq itself
+    - @c EVQ_ADD of a registered file id, or @c EVQ_MOD/EVQ_DEL of one not registered
+ */
+int EventCtl(Fid_t evq, evq_op op, Fid_t fd, int events);
+
+
+/** @brief Wait for events on an event queue.
+
+  Up to @c max events are stored into @c events. If there are none, the calling
+  thread sleeps until there are, or until the timeout expires. 
+
+  A @c Read on an event queue is like an @c EventWait without timeout, 
+  returning events into the buffer; its size must fit at least one.
+
+  @param evq the file id of the event queue
+  @param events the array to store events into
+  @param max the size of @c events
+  @param timeout the max. time to wait in milliseconds, as with @c Poll
+  @return the number of events stored, 0 on timeout, or -1 on error.
+ */
+int EventWait(Fid_t evq, evq_event* events, unsigned int max, timeout_t timeout);
+
+
 /** @brief Close a file id.
    
 
@@ -472,6 +939,24 @@ int Write(Fid_t fd, const char* buf, unsigned int size);
 int Close(Fid_t fd);
 
 
+/** @brief Close all open file ids in a range.
+
+  Every open file id @c fd with @c lowfd<=fd<=highfd is closed, as if
+  by @c Close. This is cheaper than calling @c Close for each id, since
+  only the open file ids are visited. It is commonly used by a newly
+  executed process, to drop the file ids it inherited but does not need.
+
+  @param lowfd the lowest file id to close
+  @param highfd the highest file id to close; it may exceed @c MAX_FILEID-1
+  @return  This call returns 0 on success and -1 on failure.
+   Possible reasons for failure:
+   - @c lowfd is negative, or larger than @c highfd.
+   - There was a I/O runtime problem with some stream (nevertheless,
+     all file ids in the range are closed).
+ */
+int CloseRange(Fid_t lowfd, Fid_t highfd);
+
+
 /** @brief Make a copy of a stream to a new file ID.
 
   If @c newfd is already in use by another file, it is first
@@ -515,9 +1000,11 @@ typedef struct pipe_s {
 	@brief Construct and return a pipe.
 
 	A pipe is a one-directional buffer accessed via two file ids,
-	one for each end of the buffer. The size of the buffer is 
-	implementation-specific, but can be assumed to be between 4 and 16 
-	kbytes. 
+	one for each end of the buffer. The buffer starts small, grows 
+	(up to 64 kbytes) while writers find it full, and shrinks again when
+	it is lightly used. A pipe that has grown frees its buffer whenever it
+	empties, and the next write allocates it again. The size can also be 
+	set by @c SetPipeCapacity, in which case the buffer is kept.
 
 	Once a pipe is constructed, it remains operational as long as both
 	ends are open. If the read end is closed, the write end becomes 
@@ -531,6 +1018,216 @@ typedef struct pipe_s {
 */
 int Pipe(pipe_t* pipe);
 
+
+/**
+	@brief Construct and return a message pipe.
+
+	A message pipe is a pipe that preserves the boundaries of the data
+	written into it. Each call to @c Write (or @c WriteV) on the write end 
+	sends one message of up to @c max_size bytes, which is added to the 
+	pipe as a whole: it is never split, or interleaved with the messages 
+	of other writers. If there is not enough space for it, the writer 
+	blocks. Writing 0 bytes sends nothing, and returns 0.
+
+	Each call to @c Read (or @c ReadV) on the read end returns exactly one
+	message. If the message does not fit into the buffer of the reader, 
+	the call returns -1 and the message stays in the pipe; @c Available
+	returns the length of the next message.
+
+	Otherwise, a message pipe behaves as a pipe made by @c Pipe. It cannot
+	be used with @c Splice.
+
+	@param pipe a pointer to a pipe_t structure for storing the file ids.
+	@param max_size the max. size of a message
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- @c max_size is 0, or larger than the max. capacity of a pipe.
+		- the available file ids for the process are exhausted.
+	@see Pipe
+*/
+int MessagePipe(pipe_t* pipe, unsigned int max_size);
+
+
+/** @brief What a broadcast pipe does about slow readers.
+
+  @see BroadcastPipe
+ */
+typedef enum {
+	BCAST_BLOCK,	/**< the writer waits for the slowest reader */
+	BCAST_SKIP		/**< the writer overwrites the oldest data; slow readers skip them */
+} bcast_mode;
+
+
+/**
+	@brief Construct and return a broadcast pipe.
+
+	A broadcast pipe has one write end and any number of read ends, each
+	of which reads all the bytes written after it was opened. The data 
+	are stored once, in a buffer of @c capacity bytes, however many the
+	readers are. The first read end is returned in @c pipe->read, and more
+	are opened by @c BroadcastReader.
+
+	When a reader falls a full buffer behind the writer, 
+		- in mode @c BCAST_BLOCK, the writer blocks until the slowest reader
+		  reads some data, as with @c Pipe.
+		- in mode @c BCAST_SKIP, the writer never blocks, but overwrites the
+		  oldest data. A reader that falls behind loses the overwritten 
+		  bytes, and continues from the oldest byte in the buffer. A write 
+		  of more than @c capacity bytes writes only @c capacity of them.
+
+	When all read ends are closed, calls on @c Write to the write end return
+	error. When the write end is closed, every read end continues to operate
+	until it has read all the data, at which point calls to @c Read return 0.
+
+	@param pipe a pointer to a pipe_t structure for storing the file ids.
+	@param capacity the size of the buffer, or 0 for a default of 16 kbytes
+	@param mode @c BCAST_BLOCK or @c BCAST_SKIP
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- @c capacity is less than 512 bytes, or more than the max. capacity
+		  of a pipe.
+		- @c mode is invalid.
+		- the available file ids for the process are exhausted.
+	@see BroadcastReader
+*/
+int BroadcastPipe(pipe_t* pipe, unsigned int capacity, bcast_mode mode);
+
+
+/**
+	@brief Open a new read end of a broadcast pipe.
+
+	The new reader has its own position in the data, and reads the bytes
+	written after this call. Note that a copy of a read end made by 
+	@c Dup2 is not a new reader: it shares the position of the original.
+
+	@param fd an end of a broadcast pipe
+	@returns a new file id, or @c NOFILE on error. Possible reasons for error:
+		- @c fd is not an end of a broadcast pipe.
+		- the write end of the pipe has been closed.
+		- the available file ids for the process are exhausted.
+	@see BroadcastPipe
+*/
+Fid_t BroadcastReader(Fid_t fd);
+
+
+/**
+	@brief Move data from one stream to another, inside the kernel.
+
+	This call moves up to @c n bytes from the stream @c fd_in to the
+	stream @c fd_out, without copying them to a user buffer. Each of 
+	the two streams can be an end of a pipe or a connected socket.
+
+	The call blocks until there are data to read from @c fd_in and space
+	to write them into @c fd_out, and then moves as many bytes as possible,
+	up to @c n. Therefore, as with @c Read and @c Write, fewer than @c n 
+	bytes may be moved.
+
+	@param fd_in the stream to read from
+	@param fd_out the stream to write to
+	@param n the max. number of bytes to move
+	@returns the number of bytes moved, 0 if @c fd_in is at end of file 
+	  (or @c n is 0), or -1 on error. Possible reasons for error:
+		- @c fd_in is not the read end of a pipe, or a connected socket.
+		- @c fd_out is not the write end of a pipe, or a connected socket.
+		- both file ids refer to the same pipe.
+		- either stream is an end of a message pipe.
+		- the read end of @c fd_out has been closed.
+*/
+int Splice(Fid_t fd_in, Fid_t fd_out, unsigned int n);
+
+
+/**
+	@brief Set the buffer size of a pipe.
+
+	The capacity of the pipe is set to @c bytes, and stays fixed. A large
+	capacity lets a bulk transfer proceed with fewer context switches,
+	and a small one limits the memory of a pipe. Setting a capacity of 0 
+	returns the pipe to adaptive sizing, and can be used to query the 
+	current capacity.
+
+	@param fd either end of a pipe, or a connected socket
+	@param bytes the new capacity, between 512 bytes and 1 Mbyte, or 0
+	@returns the capacity of the pipe, or -1 on error. Possible reasons 
+	  for error:
+		- @c fd is not a pipe or a connected socket.
+		- @c bytes is out of range, or smaller than the data currently in the pipe.
+		- @c fd is a message pipe, and @c bytes cannot fit a message of the max. size.
+*/
+int SetPipeCapacity(Fid_t fd, unsigned int bytes);
+
+
+/**
+	@brief Set the wakeup watermarks of a pipe.
+
+	A reader that waits on an empty pipe is woken up when the pipe holds
+	@c high bytes (by default 1), and a writer that waits on a full pipe 
+	is woken up when the pipe has drained to @c low bytes (by default half
+	its capacity). Raising @c high and lowering @c low makes readers and 
+	writers move data in larger batches, with fewer wakeups, at the cost 
+	of latency: data below the high watermark wait until more data arrive, 
+	or the write end is closed. The watermarks are clamped to the capacity
+	of the pipe. @c Poll and event queues report the read end as readable
+	at the high watermark.
+
+	@param fd either end of a pipe, or a connected socket
+	@param low the low watermark, or 0 for the default
+	@param high the high watermark, or 0 for the default
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- @c fd is not a pipe or a connected socket.
+		- @c fd is a message pipe, whose readers take any message at once.
+		- a watermark is larger than the max. capacity of a pipe.
+	@see SetPipeCapacity
+*/
+int SetPipeWatermarks(Fid_t fd, unsigned int low, unsigned int high);
+
+
+/*******************************************
+ *
+ * Shared memory
+ *
+ *******************************************/
+
+/** @brief The max. size of a shared memory region. */
+#define MAX_SHM_SIZE (64*1024*1024)
+
+
+/**
+	@brief Create a shared memory region.
+
+	A shared memory region is a block of memory, accessed through a 
+	stream. Its address is returned by @c ShmAttach, and can be used by 
+	every thread of every process that holds a file id of the stream, 
+	e.g., one inherited through @c Exec. This way, processes can exchange 
+	data without system calls (see the rings of @c tinyoslib.h).
+
+	The region is zero-filled, and aligned to 64 bytes. It is freed when 
+	the last file id of the stream is closed; after that, its address must
+	not be used.
+
+	@param size the size of the region in bytes
+	@returns a file id for the new region, or @c NOFILE on error. Possible 
+	  reasons for error:
+		- @c size is 0, or larger than @c MAX_SHM_SIZE.
+		- there is not enough memory for the region.
+		- the available file ids for the process are exhausted.
+	@see ShmAttach
+*/
+Fid_t ShmCreate(unsigned int size);
+
+
+/**
+	@brief Return the address of a shared memory region.
+
+	The address remains valid as long as the calling process holds 
+	@c fd open.
+
+	@param fd a file id of the region
+	@param size if not NULL, the size of the region is stored here
+	@returns the address of the region, or NULL if @c fd is not a 
+	  shared memory region.
+	@see ShmCreate
+*/
+void* ShmAttach(Fid_t fd, unsigned int* size);
+
+
 /*******************************************
  *
  * Sockets (local)
@@ -695,6 +1392,136 @@ int ShutDown(Fid_t sock, shutdown_mode how);
 
 
 
+/*******************************************
+ *
+ * Asynchronous I/O
+ *
+ *******************************************/
+
+/** @brief The max. number of submission queue entries of an I/O ring. */
+#define MAX_IORING_ENTRIES 4096
+
+/** @brief The operations of an I/O ring request.
+
+  @see io_sqe
+ */
+typedef enum {
+	IO_NOP,			/**< do nothing, complete with 0 */
+	IO_READ,		/**< @c Read(fd,buf,len) */
+	IO_WRITE,		/**< @c Write(fd,buf,len) */
+	IO_ACCEPT,		/**< @c Accept(fd) */
+	IO_CONNECT		/**< @c Connect(fd,port,timeout); not supported yet */
+} io_opcode;
+
+/** @brief A submission queue entry: an I/O request. */
+typedef struct io_submission {
+	io_opcode opcode;			/**< @brief The operation */
+	Fid_t fd;					/**< @brief The stream of the operation */
+	void* buf;					/**< @brief The buffer of a read or write */
+	unsigned int len;			/**< @brief The size of @c buf */
+	port_t port;				/**< @brief The port of a connect */
+	timeout_t timeout;			/**< @brief The timeout of a connect */
+	unsigned long user_data;	/**< @brief Copied to the completion */
+} io_sqe;
+
+/** @brief A completion queue entry: the result of an I/O request. */
+typedef struct io_completion {
+	unsigned long user_data;	/**< @brief The @c user_data of the request */
+	int result;					/**< @brief What the operation returned */
+} io_cqe;
+
+/**
+	@brief The queues of an I/O ring, shared by a process and the kernel.
+
+	The submission queue holds the requests from @c sq_head up to (but not
+	including) @c sq_tail, and the completion queue the results from
+	@c cq_head up to @c cq_tail. The indices always increase; entry @c i
+	is @c sqes[i % sq_entries] (resp. @c cqes[i % cq_entries]). The process
+	advances @c sq_tail and @c cq_head, and the kernel @c sq_head and
+	@c cq_tail. The helpers of @c tinyoslib.h do this with the proper
+	atomic operations.
+
+	The kernel keeps its own copy of the sizes, the addresses and its
+	indices, and reads only @c sq_tail and @c cq_head from this block.
+
+	@see IoRingSetup
+ */
+typedef struct io_ring {
+	unsigned int sq_head;		/**< @brief The next request the kernel takes */
+	unsigned int sq_tail;		/**< @brief The next free submission entry */
+	unsigned int sq_entries;	/**< @brief The size of @c sqes, a power of 2 */
+	unsigned int cq_head;		/**< @brief The next completion the process takes */
+	unsigned int cq_tail;		/**< @brief The next free completion entry */
+	unsigned int cq_entries;	/**< @brief The size of @c cqes, twice @c sq_entries */
+	io_sqe* sqes;				/**< @brief The submission queue */
+	io_cqe* cqes;				/**< @brief The completion queue */
+} io_ring;
+
+
+/**
+	@brief Create an I/O ring.
+
+	An I/O ring lets a process issue many I/O requests with one system
+	call, and keep them in flight without blocking a thread for each. The
+	process places requests into the submission queue of the ring, and
+	passes them to the kernel with @c IoRingEnter. The kernel executes a
+	request at once, if it would not block; otherwise, it keeps it until
+	its stream becomes ready, and executes it then. The result of each
+	request is placed into the completion queue, in the order of
+	completion.
+
+	Requests are executed by the threads that call @c IoRingEnter on the
+	ring; therefore, a request that becomes executable while no thread is
+	in @c IoRingEnter completes at the next call.
+
+	The file ids of a request are resolved at submission, and the streams
+	stay open until the request completes. Closing the ring cancels the
+	requests that have not completed.
+
+	@c IO_CONNECT is not supported yet; such requests complete at once,
+	with result -1.
+
+	@param entries the size of the submission queue, a power of 2 up to
+		@c MAX_IORING_ENTRIES
+	@param ring a location to store the address of the queues
+	@returns a file id for the ring, or @c NOFILE on error. Possible
+	  reasons for error:
+		- @c entries is out of range, or @c ring is NULL.
+		- the available file ids for the process are exhausted.
+	@see IoRingEnter
+*/
+Fid_t IoRingSetup(unsigned int entries, io_ring** ring);
+
+
+/**
+	@brief Submit requests, and wait for completions.
+
+	Up to @c to_submit requests are taken from the submission queue. A
+	request with an invalid file id or operation completes at once, with
+	result -1. Fewer requests are taken if the completion queue could
+	not hold their results; the process must take completions to make
+	room.
+
+	Then, the call executes the requests that have become ready, and, if
+	there are fewer than @c min_complete entries in the completion queue,
+	waits until there are, or until no request is in flight, or until
+	@c timeout msec have passed.
+
+	@param ring the file id of the ring
+	@param to_submit the max. number of requests to submit
+	@param min_complete the number of completions to wait for
+	@param timeout the max. time to wait, or @c POLL_FOREVER
+	@returns the number of requests submitted, or -1 on error. Possible
+	  reasons for error:
+		- @c ring is not an I/O ring.
+		- @c sq_tail or @c cq_head is out of range; nothing is submitted.
+		- @c cq_head was moved past @c cq_tail, and completions were lost.
+	@see IoRingSetup
+*/
+int IoRingEnter(Fid_t ring, unsigned int to_submit, unsigned int min_complete, timeout_t timeout);
+
+
+
 /*******************************************
  *
  * System information
@@ -706,6 +1533,50 @@ int ShutDown(Fid_t sock, shutdown_mode how);
   */
 #define PROCINFO_MAX_ARGS_SIZE (128)
 
+/** @brief Resource usage of a thread or a process.
+
+  Run times are measured by the scheduler at each context switch, in
+  microseconds. 
+  @see GetRusage
+  @see procinfo
+ */
+typedef struct rusage_t
+{
+  unsigned long run_time;       /**< @brief Time spent running on a core (usec). */
+  unsigned long ready_time;     /**< @brief Time spent ready, waiting for a core (usec). */
+  unsigned long voluntary;      /**< @brief Context switches because the thread blocked or yielded. */
+  unsigned long involuntary;    /**< @brief Context switches because the time-slice expired. */
+  unsigned long bytes_read;     /**< @brief Bytes returned by @c Read. */
+  unsigned long bytes_written;  /**< @brief Bytes accepted by @c Write. */
+} rusage_t;
+
+
+/** @brief Designates the threads whose usage is returned by @c GetRusage. */
+typedef enum rusage_who {
+  USAGE_PROCESS,    /**< @brief All threads of the current process */
+  USAGE_THREAD,     /**< @brief The current thread */
+  USAGE_CHILDREN    /**< @brief The children of the current process that have been waited for */
+} rusage_who;
+
+
+/** @brief Return resource usage statistics.
+
+  The usage of the process includes all its threads, including those that
+  have exited. The usage of the children includes all children that have
+  been cleaned up by @c WaitChild or @c WaitChildren, and recursively their
+  own waited-for children. 
+
+  The statistics of running threads are updated at each context switch.
+  Keeping them is cheap, and always on.
+
+  @param who the threads whose usage is returned
+  @param usage the location to store the usage into
+  @returns 0 on success or -1 on error. Possible errors:
+    - @c usage is NULL or @c who is invalid.
+ */
+int GetRusage(rusage_who who, rusage_t* usage);
+
+
 /**
 	@brief A struct containing process-related information for a non-free
 	pid.
@@ -723,6 +1594,8 @@ typedef struct procinfo
   int alive;      /**< @brief Non-zero if process is alive, zero if process is zombie. */
 	
   unsigned long thread_count; /**< Current no of threads. */
+
+  rusage_t usage;  /**< @brief The resource usage of the process. */
 	
   Task main_task;  /**< @brief The main task of the process. */
 	
@@ -746,6 +1619,11 @@ typedef struct procinfo
 	@c procinfo structures,
 	each packed into a block of size @c sizeof(procinfo).
 
+	A single @c Read returns as many whole records as fit into the
+	buffer, i.e., @c n/sizeof(procinfo) of them, and fewer only at
+	the end of the stream. A @c Read with @c n<sizeof(procinfo) fails
+	with -1.
+
 	Each procinfo structure contains information pertaining to some
 	used PCB (active or zombie) during the time of the stream. 
 
@@ -760,6 +1638,131 @@ typedef struct procinfo
 Fid_t OpenInfo();
 
 
+/** @brief The state of a thread, as reported by a @c threadinfo record. */
+typedef enum {
+  THREAD_NEW,       /**< @brief The thread has not started yet */
+  THREAD_READY,     /**< @brief The thread waits for a core */
+  THREAD_RUNNING,   /**< @brief The thread runs on a core */
+  THREAD_BLOCKED    /**< @brief The thread sleeps at a wait channel */
+} thread_status;
+
+/**
+  @brief The max. size of the wait channel and cause names of a threadinfo structure.
+  */
+#define THREADINFO_MAX_NAME (32)
+
+/**
+  @brief A struct containing information about a thread.
+
+  The wait channel of a blocked thread is the kernel function it sleeps
+  in (e.g., @c pipe_read or @c wait_for_specific_child), or the 
+  synchronization call (e.g., @c Cond_Wait) for user-level sleeps. 
+  The cause is the reason given to the scheduler (e.g., @c PIPE, @c IO
+  or @c USER).
+
+  @see OpenThreadInfo
+  */
+typedef struct threadinfo
+{
+  Pid_t pid;              /**< @brief The pid of the process of the thread */
+  Tid_t tid;              /**< @brief The thread id */
+  thread_status state;    /**< @brief The state of the thread */
+  char wchan[THREADINFO_MAX_NAME];  /**< @brief The wait channel, or empty if not blocked */
+  char cause[THREADINFO_MAX_NAME];  /**< @brief The cause of the sleep, or empty if not blocked */
+  unsigned long wait_time;  /**< @brief Time blocked so far (usec), or 0 if not blocked */
+  rusage_t usage;           /**< @brief The resource usage of the thread */
+} threadinfo;
+
+
+/**
+  @brief Open a thread information stream.
+
+  This is a read-only stream that returns a sequence of @c threadinfo
+  structures, each packed into a block of size @c sizeof(threadinfo),
+  one for each live thread of every process. The threads of a process 
+  are returned together, in order of pid.
+
+  As with @c OpenInfo, a single @c Read returns as many whole records
+  as fit into the buffer, and a @c Read with @c n<sizeof(threadinfo) 
+  fails with -1. The information is a best-effort snapshot.
+
+  @returns a file id on success, or NOFILE on error. Possible reasons
+    for error are:
+    - the available file ids for the process are exhausted.
+  @see threadinfo
+ */
+Fid_t OpenThreadInfo();
+
+
+/** @brief The kind of lock that a @c lockinfo record refers to. */
+typedef enum { 
+  LOCK_MUTEX,     /**< @brief A @c Mutex */
+  LOCK_COND,      /**< @brief A @c CondVar */
+  LOCK_KERNEL     /**< @brief The kernel lock */
+} lock_kind;
+
+/** @brief The name of a lock kind, as printed in lock statistics. */
+static inline const char* lock_kind_name(lock_kind kind)
+{
+  switch(kind) {
+    case LOCK_MUTEX: return "mutex";
+    case LOCK_COND: return "cond";
+    case LOCK_KERNEL: return "kernel";
+  }
+  return "?";
+}
+
+/**
+  @brief The max. size of the site name returned by a lockinfo structure.
+  */
+#define LOCKINFO_MAX_SITE (32)
+
+/**
+  @brief Lock contention statistics for a lock site.
+
+  A lock site is the function that performs a lock operation. For kernel
+  waits, it is the wait channel passed to @c kernel_wait. All times are
+  in nanoseconds.
+
+  For @c LOCK_COND records, @c count is the number of waits, @c contended
+  the number of waits that were ended by a signal, and @c wait_time the
+  time spent waiting; @c signals counts the signals and broadcasts issued 
+  by the site.
+
+  @see OpenLockInfo
+  */
+typedef struct lockinfo
+{
+  lock_kind kind;             /**< @brief The kind of lock */
+  char site[LOCKINFO_MAX_SITE];  /**< @brief The (possibly truncated) site name */
+  unsigned long count;        /**< @brief Number of acquisitions (or waits) */
+  unsigned long contended;    /**< @brief Acquisitions that had to wait */
+  unsigned long spins;        /**< @brief Spin iterations of @c Mutex_Lock */
+  unsigned long yields;       /**< @brief Times @c Mutex_Lock yielded with @c SCHED_MUTEX */
+  unsigned long signals;      /**< @brief Signals and broadcasts */
+  unsigned long wait_time;    /**< @brief Total time spent waiting */
+  unsigned long hold_time;    /**< @brief Total time the lock was held */
+} lockinfo;
+
+
+/**
+  @brief Open a lock statistics stream.
+
+  This is a read-only stream that returns a sequence of @c lockinfo 
+  structures, each packed into a block of size @c sizeof(lockinfo),
+  one for each lock site that has been used so far.
+  Statistics are only collected when the kernel is compiled with
+  @c LOCK_PROFILING (e.g., by @c make @c LOCKPROF=1); otherwise, the
+  stream is empty.
+
+  @returns a file id on success, or NOFILE on error. Possible reasons
+    for error are:
+    - the available file ids for the process are exhausted.
+  @see lockinfo
+ */
+Fid_t OpenLockInfo();
+
+
 
 
 /*******************************************
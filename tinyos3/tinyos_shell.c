@@ -21,6 +21,9 @@ int Repeat(size_t,const char**);
 int Hanoi(size_t,const char**);
 int HelpMessage(size_t,const char**);
 int SystemInfo(size_t,const char**);
+int LockStat(size_t,const char**);
+int ThreadStat(size_t,const char**);
+int PipeBench(size_t,const char**);
 int Capitalize(size_t,const char**);
 int LowerCase(size_t,const char**);
 int LineEnum(size_t,const char**);
@@ -39,6 +42,8 @@ COMMANDS[]  =
 	{"help", HelpMessage, 0, "A help message."},
 	{"ls", ListPrograms, 0, "List available programs programs."},
 	{"sysinfo", SystemInfo, 0, "Print some basic info about the current system."},
+	{"lockstat", LockStat, 0, "Print lock contention statistics (build with LOCKPROF=1)."},
+	{"ps", ThreadStat, 0, "Print the threads of all processes, and where they are blocked."},
 	{"runterm", RunTerm, 2, "runterm <term> <prog>  <args...> : execute '<prog> <args...>' on terminal <term>."},
 	{"sh", Shell, 0, "Run a shell."},
 	{"repeat", Repeat, 2, "repeat <n> <prog> <args...>: execute '<prog> <args...>' <n> times."},
@@ -51,6 +56,7 @@ COMMANDS[]  =
 	{"symposium", Symposium_proc, 2, "Dining Philosophers(processes): symposium  <philosophers> <bites>"},
 	{"symp_thr", Symposium_thr, 2, "Dining Philosophers(threads): symp_thr  <philosophers> <bites>"},
 	{"hanoi", Hanoi, 1, "The towers of Hanoi."},
+	{"pipebench", PipeBench, 0, "Measure pipe throughput and context switches, plain, with Splice, and with watermarks, for messages of 1B to 1MB."},
 	{"rserver", RemoteServer, 0, "A server for remote execution."},
 	{"rcli", RemoteClient, 1, "Remote client: rcli <cmd> [<args...>]."},
 	{"echo", Echo, 0, "echo [<args...>], send the <args...> to stdout"},
@@ -171,32 +177,178 @@ int SystemInfo(size_t argc, const char** argv)
 	Fid_t finfo = OpenInfo();
 	if(finfo!=NOFILE) {
 		/* Print per-process info */
-		procinfo info;
-		printf("%5s %5s %6s %8s %20s\n",
-			"PID", "PPID", "State", "Threads", "Main program"
+		procinfo info[16];
+		printf("%5s %5s %6s %8s %10s %20s\n",
+			"PID", "PPID", "State", "Threads", "CPU(ms)", "Main program"
 			);
-		/* Read in next piece of info */		
-		while(Read(finfo, (char*) &info, sizeof(info)) > 0) {
-			Program prog=NULL;
-			const char* argv[10];
-			int argc = ParseProcInfo(&info, &prog, 10, argv);
-
-			const char* pname = "-";
-			if(argc>=1)  {
-				pname = argv[0];
-			} else if(argc==-1) {
-				/* Try to give some known names */
-				if(info.pid==1) pname = "init";
+		/* Read in the next batch of info */
+		int nbytes;
+		while((nbytes = Read(finfo, (char*) info, sizeof(info))) > 0) {
+			for(int i=0; i < nbytes/(int)sizeof(procinfo); i++) {
+				Program prog=NULL;
+				const char* argv[10];
+				int argc = ParseProcInfo(&info[i], &prog, 10, argv);
+
+				const char* pname = "-";
+				if(argc>=1)  {
+					pname = argv[0];
+				} else if(argc==-1) {
+					/* Try to give some known names */
+					if(info[i].pid==1) pname = "init";
+				}
+
+				printf("%5d %5d %6s %8lu %10lu %20s\n",
+					info[i].pid,
+					info[i].ppid,
+					(info[i].alive?"ALIVE":"ZOMBIE"),
+					info[i].thread_count,
+					info[i].usage.run_time/1000,
+					pname
+					);
 			}
+		}
+		Close(finfo);
+	}
+	printf("\n");
+	return 0;
+}
+
+
+int LockStat(size_t argc, const char** argv)
+{
+	Fid_t finfo = OpenLockInfo();
+	if(finfo==NOFILE) return 1;
+
+	lockinfo info;
+	printf("%-7s %-24s %10s %10s %8s %12s %12s\n",
+		"KIND", "SITE", "COUNT", "CONTENDED", "YIELDS", "WAIT(us)", "HOLD(us)");
+	while(Read(finfo, (char*) &info, sizeof(info)) > 0) {
+		printf("%-7s %-24.24s %10lu %10lu %8lu %12lu %12lu\n",
+			lock_kind_name(info.kind), info.site, info.count, info.contended,
+			info.yields, info.wait_time/1000, info.hold_time/1000);
+	}
+	Close(finfo);
+	printf("\n");
+	return 0;
+}
+
 
-			printf("%5d %5d %6s %8u %20s\n",
-				info.pid,
-				info.ppid,
-				(info.alive?"ALIVE":"ZOMBIE"),
-				info.thread_count,
-				pname
-				);
+int ThreadStat(size_t argc, const char** argv)
+{
+	static const char* state_name[] = { "NEW", "READY", "RUN", "BLOCK" };
+	Fid_t finfo = OpenThreadInfo();
+	if(finfo==NOFILE) return 1;
+
+	threadinfo info[16];
+	printf("%5s %10s %6s %8s %10s %10s  %s\n",
+		"PID", "TID", "STATE", "CAUSE", "WAIT(ms)", "CPU(ms)", "WCHAN");
+	int nbytes;
+	while((nbytes = Read(finfo, (char*) info, sizeof(info))) > 0) {
+		for(int i=0; i < nbytes/(int)sizeof(threadinfo); i++) {
+			printf("%5d %10lu %6s %8s %10lu %10lu  %s\n",
+				info[i].pid, (unsigned long) info[i].tid, state_name[info[i].state],
+				info[i].cause, info[i].wait_time/1000, info[i].usage.run_time/1000,
+				info[i].wchan);
+		}
+	}
+	Close(finfo);
+	printf("\n");
+	return 0;
+}
+
+
+/* A writer of the pipe benchmark */
+struct pipebench {
+	Fid_t fid;
+	unsigned int msg;
+	unsigned long total;
+};
+
+static int PipeBenchWriter(int argl, void* args)
+{
+	struct pipebench* b = args;
+	char* buf = calloc(b->msg, 1);
+	for(unsigned long sent=0; sent < b->total; ) {
+		unsigned int n = (b->total-sent < b->msg) ? b->total-sent : b->msg;
+		int rc = Write(b->fid, buf, n);
+		if(rc<=0) break;
+		sent += rc;
+	}
+	Close(b->fid);
+	free(buf);
+	return 0;
+}
+
+static int PipeBenchSplicer(int argl, void* args)
+{
+	pipe_t* p = args;
+	while(Splice(p[0].read, p[1].write, argl) > 0);
+	Close(p[0].read);
+	Close(p[1].write);
+	return 0;
+}
+
+enum { PIPEBENCH_PLAIN, PIPEBENCH_SPLICE, PIPEBENCH_WMARK };
+
+/* The watermarks of the PIPEBENCH_WMARK mode */
+#define PIPEBENCH_LOWAT (4*1024)
+#define PIPEBENCH_HIWAT (16*1024)
+
+/*
+	Move total bytes through a pipe (or two pipes and a splicer), return the throughput
+	in MB/s, and store the context switches of the threads that blocked into *switches.
+ */
+static double PipeBenchRun(unsigned int msg, unsigned long total, int mode, unsigned long* switches)
+{
+	int splice = (mode == PIPEBENCH_SPLICE);
+	pipe_t p[2];
+	rusage_t u0, u1;
+	*switches = 0;
+	if(Pipe(&p[0])!=0) return 0.0;
+	if(splice && Pipe(&p[1])!=0) return 0.0;
+	if(mode == PIPEBENCH_WMARK && SetPipeWatermarks(p[0].read, PIPEBENCH_LOWAT, PIPEBENCH_HIWAT)!=0)
+		return 0.0;
+
+	struct pipebench b = { p[0].write, msg, total };
+	char* buf = malloc(msg);
+
+	GetRusage(USAGE_PROCESS, &u0);
+	TimerDuration t0 = bios_clock();
+	Tid_t tw = CreateThread(PipeBenchWriter, 0, &b);
+	Tid_t ts = splice ? CreateThread(PipeBenchSplicer, msg, p) : NOTHREAD;
+	Fid_t rfid = splice ? p[1].read : p[0].read;
+	unsigned long count = 0;
+	int rc;
+	while((rc = Read(rfid, buf, msg)) > 0)
+		count += rc;
+	ThreadJoin(tw, NULL);
+	if(splice) ThreadJoin(ts, NULL);
+	TimerDuration t1 = bios_clock();
+	GetRusage(USAGE_PROCESS, &u1);
+	*switches = u1.voluntary - u0.voluntary;
+
+	Close(rfid);
+	free(buf);
+
+	if(count != total || t1 == t0) return 0.0;
+	return (double)total / (t1 - t0);
+}
+
+int PipeBench(size_t argc, const char** argv)
+{
+	/* SWITCHES counts the times the threads of the benchmark blocked */
+	printf("%10s %12s %14s %10s %14s %10s %14s %10s\n", "MSG(bytes)", "TOTAL(bytes)",
+		"PIPE(MB/s)", "SWITCHES", "SPLICE(MB/s)", "SWITCHES", "WMARK(MB/s)", "SWITCHES");
+	for(unsigned int msg=1; msg <= (1u<<20); msg <<= 2) {
+		unsigned long total = 100000ul*msg;
+		if(total > (64ul<<20)) total = (64ul<<20);
+		printf("%10u %12lu", msg, total);
+		for(int mode = PIPEBENCH_PLAIN; mode <= PIPEBENCH_WMARK; mode++) {
+			unsigned long switches;
+			double tput = PipeBenchRun(msg, total, mode, &switches);
+			printf(" %14.1f %10lu", tput, switches);
 		}
+		printf("\n");
 	}
 	printf("\n");
 	return 0;
@@ -171,23 +171,261 @@ int Execute(Program prog, size_t argc, const char** argv)
 
 void BarrierSync(barrier* bar, unsigned int n)
 {
-	assert(n>0);
-	Mutex_Lock(& bar->mx);
+	Barrier_Sync(bar, n);
+}
+
+
+
+/*
+	Rings in shared memory.
+
+	The SPSC ring is Lamport's queue: the writer owns the tail index and
+	the reader the head index, and each publishes its index with a release
+	store after copying an item. The MPMC ring is Vyukov's bounded queue: 
+	every slot carries a sequence number, which tells the writers and the
+	readers whose turn it is, and they claim positions with a CAS on the
+	tail and the head index respectively.
+
+	Sleeping is kept off the fast path. A thread that finds the ring empty
+	or full registers in sleepers, and checks again under the lock before 
+	it waits. A thread that moved an item wakes the sleepers only if there
+	are any; the fences on both sides make sure that either the sleeper 
+	sees the item, or the waker sees the sleeper.
+ */
+
+#define RING_LINE 64
+
+typedef struct ring_slot {
+	unsigned long seq;		/* the position the slot is ready for (MPMC only) */
+	char data[];
+} ring_slot;
+
+struct shm_ring {
+	unsigned long head __attribute__((aligned(RING_LINE)));	/* the next position to read */
+	unsigned long tail __attribute__((aligned(RING_LINE)));	/* the next position to write */
+
+	unsigned int mask __attribute__((aligned(RING_LINE)));		/* slots-1 */
+	unsigned int item_size;
+	unsigned int stride;		/* the size of a slot */
+	ring_mode mode;
+
+	unsigned int sleepers __attribute__((aligned(RING_LINE)));	/* threads waiting in ring_sleep */
+	Mutex lock;
+	CondVar changed;
+
+	char slots[] __attribute__((aligned(RING_LINE)));
+};
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+
+static unsigned int ring_stride(unsigned int item_size)
+{
+	return (sizeof(ring_slot) + item_size + 7) & ~7u;
+}
+
+size_t RingSize(unsigned int slots, unsigned int item_size)
+{
+	if(slots == 0 || (slots & (slots-1)) != 0) return 0;
+	return sizeof(shm_ring) + (size_t)slots * ring_stride(item_size);
+}
+
+static inline ring_slot* ring_slot_at(shm_ring* ring, unsigned long pos)
+{
+	return (ring_slot*) (ring->slots + (pos & ring->mask) * ring->stride);
+}
+
+shm_ring* RingInit(void* mem, unsigned int slots, unsigned int item_size, ring_mode mode)
+{
+	if(RingSize(slots, item_size) == 0) return NULL;
+
+	shm_ring* ring = mem;
+	ring->head = ring->tail = 0;
+	ring->mask = slots-1;
+	ring->item_size = item_size;
+	ring->stride = ring_stride(item_size);
+	ring->mode = mode;
+	ring->sleepers = 0;
+	ring->lock = MUTEX_INIT;
+	ring->changed = COND_INIT;
+
+	for(unsigned int i=0; i<slots; i++)
+		ring_slot_at(ring, i)->seq = i;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return ring;
+}
+
+
+static int spsc_put(shm_ring* ring, const void* item)
+{
+	unsigned long tail = ring->tail;
+	if(tail - LOAD(ring->head) > ring->mask) return -1;
+
+	memcpy(ring_slot_at(ring, tail)->data, item, ring->item_size);
+	STORE(ring->tail, tail+1);
+	return 0;
+}
+
+static int spsc_get(shm_ring* ring, void* item)
+{
+	unsigned long head = ring->head;
+	if(LOAD(ring->tail) == head) return -1;
+
+	memcpy(item, ring_slot_at(ring, head)->data, ring->item_size);
+	STORE(ring->head, head+1);
+	return 0;
+}
+
+static int mpmc_put(shm_ring* ring, const void* item)
+{
+	unsigned long pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	while(1) {
+		ring_slot* slot = ring_slot_at(ring, pos);
+		long diff = (long)(LOAD(slot->seq) - pos);
+		if(diff == 0) {
+			/* On failure, pos is updated to the current tail */
+			if(__atomic_compare_exchange_n(&ring->tail, &pos, pos+1, 1, 
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				memcpy(slot->data, item, ring->item_size);
+				STORE(slot->seq, pos+1);
+				return 0;
+			}
+		}
+		else if(diff < 0)
+			return -1;		/* the slot has not been read since the last round */
+		else
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	}
+}
+
+static int mpmc_get(shm_ring* ring, void* item)
+{
+	unsigned long pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	while(1) {
+		ring_slot* slot = ring_slot_at(ring, pos);
+		long diff = (long)(LOAD(slot->seq) - (pos+1));
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&ring->head, &pos, pos+1, 1, 
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				memcpy(item, slot->data, ring->item_size);
+				STORE(slot->seq, pos + ring->mask + 1);
+				return 0;
+			}
+		}
+		else if(diff < 0)
+			return -1;		/* the slot has not been written in this round */
+		else
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	}
+}
 
-	int epoch = bar->epoch;
-	assert(bar->count < n);
 
-	bar->count ++;
-	if(bar->count == n) {
-		bar->epoch ++;
-		bar->count = 0;
-		Cond_Broadcast(&bar->cv);
+/* 
+	Check if the slot at an index is ready for position index+offset. When
+	it is not, the index is checked again, since an index that moved on means
+	that we looked at a slot of another position.
+ */
+static int mpmc_ready(shm_ring* ring, unsigned long* index, unsigned long offset)
+{
+	while(1) {
+		unsigned long pos = LOAD(*index);
+		if(LOAD(ring_slot_at(ring, pos)->seq) == pos + offset) return 1;
+		if(LOAD(*index) == pos) return 0;
 	}
+}
 
-	while(epoch == bar->epoch)
-		Cond_Wait(&bar->mx, &bar->cv);
+static int ring_can_put(shm_ring* ring)
+{
+	if(ring->mode == RING_SPSC)
+		return LOAD(ring->tail) - LOAD(ring->head) <= ring->mask;
+	return mpmc_ready(ring, &ring->tail, 0);
+}
 
-	Mutex_Unlock(& bar->mx);
+static int ring_can_get(shm_ring* ring)
+{
+	if(ring->mode == RING_SPSC)
+		return LOAD(ring->tail) != LOAD(ring->head);
+	return mpmc_ready(ring, &ring->head, 1);
 }
 
 
+/* Sleep until the ring may allow the operation */
+static void ring_sleep(shm_ring* ring, int (*can)(shm_ring*))
+{
+	Mutex_Lock(&ring->lock);
+	__atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while(! can(ring))
+		Cond_Wait(&ring->lock, &ring->changed);
+	__atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+	Mutex_Unlock(&ring->lock);
+}
+
+/* Called after an item was moved */
+static void ring_wakeup(shm_ring* ring)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ring->sleepers, __ATOMIC_RELAXED)) {
+		Mutex_Lock(&ring->lock);
+		Cond_Broadcast(&ring->changed);
+		Mutex_Unlock(&ring->lock);
+	}
+}
+
+
+int RingTryPut(shm_ring* ring, const void* item)
+{
+	int rc = (ring->mode == RING_SPSC) ? spsc_put(ring, item) : mpmc_put(ring, item);
+	if(rc == 0) ring_wakeup(ring);
+	return rc;
+}
+
+int RingTryGet(shm_ring* ring, void* item)
+{
+	int rc = (ring->mode == RING_SPSC) ? spsc_get(ring, item) : mpmc_get(ring, item);
+	if(rc == 0) ring_wakeup(ring);
+	return rc;
+}
+
+void RingPut(shm_ring* ring, const void* item)
+{
+	while(RingTryPut(ring, item) != 0)
+		ring_sleep(ring, ring_can_put);
+}
+
+void RingGet(shm_ring* ring, void* item)
+{
+	while(RingTryGet(ring, item) != 0)
+		ring_sleep(ring, ring_can_get);
+}
+
+
+/*
+	I/O ring queues.
+
+	Only one thread at a time may push to (resp. pop from) an I/O ring; the
+	kernel is the other side of each queue.
+ */
+
+int IoRingPush(io_ring* ring, const io_sqe* sqe)
+{
+	unsigned int tail = ring->sq_tail;
+	if(tail - LOAD(ring->sq_head) == ring->sq_entries) return -1;
+	ring->sqes[tail & (ring->sq_entries-1)] = *sqe;
+	STORE(ring->sq_tail, tail+1);
+	return 0;
+}
+
+int IoRingPop(io_ring* ring, io_cqe* cqe)
+{
+	unsigned int head = ring->cq_head;
+	if(head == LOAD(ring->cq_tail)) return -1;
+	*cqe = ring->cqes[head & (ring->cq_entries-1)];
+	STORE(ring->cq_head, head+1);
+	return 0;
+}
+
+#undef LOAD
+#undef STORE
@@ -74,16 +74,100 @@ int ParseProcInfo(procinfo* pinfo, Program* prog, int argc, const char** argv );
 
 
 
-typedef struct barrier {
-	Mutex mx;
-	CondVar cv;
-	unsigned int count, epoch;
-} barrier;
+/**
+	@brief A barrier for the threads of a program.
 
-#define BARRIER_INIT  ((barrier){ MUTEX_INIT, COND_INIT, 0, 0})
+	This is the kernel @ref Barrier; initialize it with @c BARRIER_INIT.
+  */
+typedef Barrier barrier;
 
 
+/**
+	@brief Wait at a barrier, until @c n threads have arrived.
+
+	@see Barrier_Sync
+  */
 void BarrierSync(barrier* bar, unsigned int n);
 
 
+
+/**
+	@brief A lock-free ring of fixed-size items, for shared memory.
+
+	A ring is laid out by @c RingInit in a block of memory, usually a 
+	region made by @c ShmCreate, and is then used by the threads of all
+	processes that can reach that block. Items are copied into and out of
+	the ring with atomic instructions only. A thread makes a system call 
+	only to sleep, when it finds the ring empty (a reader) or full (a 
+	writer), and to wake such sleepers up.
+
+	@see RingInit
+  */
+typedef struct shm_ring shm_ring;
+
+/** @brief The kinds of rings. */
+typedef enum {
+	RING_SPSC,	/**< at most one writer and one reader at a time */
+	RING_MPMC	/**< any number of writers and readers */
+} ring_mode;
+
+
+/**
+	@brief The size of the memory needed by a ring.
+
+	@param slots the number of items the ring holds, a power of 2
+	@param item_size the size of an item in bytes
+	@returns the size in bytes, or 0 if @c slots is not a power of 2
+  */
+size_t RingSize(unsigned int slots, unsigned int item_size);
+
+
+/**
+	@brief Lay out an empty ring in a block of memory.
+
+	The block must be aligned to 64 bytes (as shared memory regions are), 
+	and hold @c RingSize(slots,item_size) bytes. The ring starts at the 
+	start of the block, so that other processes can use the address of the
+	block (as returned by @c ShmAttach) as the ring.
+
+	@returns the ring, or NULL if @c slots is not a power of 2
+  */
+shm_ring* RingInit(void* mem, unsigned int slots, unsigned int item_size, ring_mode mode);
+
+
+/** @brief Copy an item into the ring; return 0, or -1 if the ring is full. */
+int RingTryPut(shm_ring* ring, const void* item);
+
+/** @brief Copy an item out of the ring; return 0, or -1 if the ring is empty. */
+int RingTryGet(shm_ring* ring, void* item);
+
+/** @brief Copy an item into the ring, waiting while the ring is full. */
+void RingPut(shm_ring* ring, const void* item);
+
+/** @brief Copy an item out of the ring, waiting while the ring is empty. */
+void RingGet(shm_ring* ring, void* item);
+
+
+/**
+	@brief Place a request into the submission queue of an I/O ring.
+
+	The request is passed to the kernel by the next @c IoRingEnter.
+	At most one thread at a time may push requests to a ring.
+
+	@returns 0, or -1 if the submission queue is full
+	@see IoRingSetup
+  */
+int IoRingPush(io_ring* ring, const io_sqe* sqe);
+
+/**
+	@brief Take a result from the completion queue of an I/O ring.
+
+	At most one thread at a time may pop results from a ring.
+
+	@returns 0, or -1 if the completion queue is empty
+	@see IoRingEnter
+  */
+int IoRingPop(io_ring* ring, io_cqe* cqe);
+
+
 #endif
@@ -118,10 +118,32 @@ static inline void * xmalloc (size_t size)
   return value;
 }
 
+/**
+	@brief A wrapper for realloc checking for out-of-memory.
+
+	If there is no memory to fulfill a request, FATAL is used to
+	print an error message and abort.
+
+	@param ptr the memory block to resize, or NULL
+	@param size the new size of the block
+	@returns the resized memory block
+  */
+static inline void * xrealloc (void* ptr, size_t size)
+{
+  void *value = realloc (ptr, size);
+  if (value == 0 && size != 0)
+    FATAL("virtual memory exhausted");
+  return value;
+}
+
 
 /** @}   check_macros  */
 
 
+/** @brief The number of bits in an @c unsigned @c long, the word of bitmaps. */
+#define BITS_PER_WORD (8*sizeof(unsigned long))
+
+
 /*******************************************************
  *
  *
@@ -4,11 +4,13 @@
 #include <sys/time.h>
 #include <time.h>
 #include <math.h>
+#include <limits.h>
 #include <setjmp.h>
 
 #include "util.h"
 #include "symposium.h"
 #include "tinyoslib.h"
+#include "kernel_streams.h"
 #include "unit_testing.h"
 
 
@@ -303,6 +305,85 @@ BOOT_TEST(test_main_return_returns_status,
 }
 
 
+BOOT_TEST(test_exec_many_processes,
+	"Test that the process table grows to hold more simultaneous processes\n"
+	"than fit into one chunk, and that their pids remain valid."
+	)
+{
+	const int N = 1000;
+	int quick_child(int argl, void* args) { return *(int*)args; }
+
+	Pid_t* child = malloc(N*sizeof(Pid_t));
+	for(int i=0; i<N; i++) {
+		child[i] = Exec(quick_child, sizeof(i), &i);
+		ASSERT(child[i]!=NOPROC);
+	}
+
+	/* Wait in reverse order, to visit every chunk */
+	for(int i=N-1; i>=0; i--) {
+		int status;
+		ASSERT(WaitChild(child[i], &status)==child[i]);
+		ASSERT(status==i);
+	}
+	ASSERT(WaitChild(NOPROC, NULL)==NOPROC);
+
+	free(child);
+	return 0;
+}
+
+
+BOOT_TEST(test_execmany_waitchildren,
+	"Test that ExecMany creates children with their own arguments, and that\n"
+	"WaitChildren reaps them in batches with their exit statuses."
+	)
+{
+	const int N = 100;
+	int child(int argl, void* args) { 
+		ASSERT(argl==sizeof(int));
+		return *(int*)args; 
+	}
+
+	int val[N];
+	exec_args argv[N];
+	Pid_t pids[N];
+	for(int i=0; i<N; i++) {
+		val[i] = i;
+		argv[i].argl = sizeof(int);
+		argv[i].args = &val[i];
+	}
+
+	ASSERT(ExecMany(NULL, N, argv, pids)==-1);
+	ASSERT(WaitChildren(pids, NULL, N)==0);
+	ASSERT(ExecMany(child, N, argv, pids)==N);
+
+	/* Arguments are copied */
+	for(int i=0; i<N; i++) val[i] = -1;
+
+	int seen[N];
+	for(int i=0; i<N; i++) seen[i] = 0;
+
+	int total = 0;
+	while(total < N) {
+		Pid_t wpids[7];
+		int status[7];
+		int rc = WaitChildren(wpids, status, 7);
+		ASSERT(rc>=1 && rc<=7);
+		for(int j=0; j<rc; j++) {
+			ASSERT(status[j]>=0 && status[j]<N);
+			ASSERT(pids[status[j]]==wpids[j]);
+			seen[status[j]]++;
+		}
+		total += rc;
+	}
+	for(int i=0; i<N; i++)
+		ASSERT(seen[i]==1);
+
+	ASSERT(WaitChildren(pids, NULL, N)==0);
+	ASSERT(WaitChildren(NULL, NULL, N)==-1);
+	return 0;
+}
+
+
 BOOT_TEST(test_orphans_adopted_by_init,
 	"Test that when a process exits leaving orphans, init becomes the new parent."
 	)
@@ -477,6 +558,146 @@ BOOT_TEST(test_cond_timedwait_broadcast,
 
 
 
+BOOT_TEST(test_cond_broadcast_requeue,
+	"Test that threads signalled while their mutex is locked wake up only as the mutex\n"
+	"is unlocked, one at a time, and that every one returns, even when its wait times out."
+	)
+{
+	Mutex m = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	CondVar pcv = COND_INIT;
+	int flag=0, inside=0, done=0, go=0;
+
+	int waiter(int argl, void* args)
+	{
+		Mutex_Lock(&m);
+		flag ++;
+		Cond_Signal(&pcv);
+		if(argl) {
+			/* These will time out while requeued */
+			while(! go) Cond_TimedWait(&m, &cv, 20);
+		} else {
+			ASSERT(Cond_Wait(&m, &cv));
+			ASSERT(go);
+		}
+		ASSERT(inside++ == 0);
+		for(volatile int k=0; k<1000; k++);
+		done++;
+		ASSERT(--inside == 0);
+		Mutex_Unlock(&m);
+		return 0;
+	}
+
+	const int N=20;
+
+	for(int i=0; i<N; i++) Exec(waiter, i%2, NULL);
+
+	Mutex_Lock(&m);
+	while(flag!=N) Cond_Wait(&m, &pcv);
+	go = 1;
+	Cond_Broadcast(&cv);
+
+	/* Keep the mutex past the timeouts; nobody may return meanwhile */
+	struct timespec t1, t2;
+	clock_gettime(CLOCK_REALTIME, &t1);
+	do {
+		clock_gettime(CLOCK_REALTIME, &t2);
+	} while((t2.tv_sec-t1.tv_sec)*1000 + (t2.tv_nsec-t1.tv_nsec)/1000000 < 100);
+	ASSERT(done == 0);
+	Mutex_Unlock(&m);
+
+	int children = 0;
+	while(WaitChild(NOPROC, NULL)!=NOPROC) children++;
+	ASSERT(children == N);
+	ASSERT(done == N);
+	return 0;
+}
+
+
+BOOT_TEST(test_barrier_sync,
+	"Test that a barrier blocks every thread of an episode, until all threads have\n"
+	"arrived, and that it can be reused for many episodes."
+	)
+{
+	const unsigned int N = 8;
+	const unsigned int ROUNDS = 500;
+	Barrier B = BARRIER_INIT;
+	unsigned int arrived = 0;
+
+	int worker(int argl, void* args)
+	{
+		for(unsigned int r=0; r<ROUNDS; r++) {
+			__atomic_fetch_add(&arrived, 1, __ATOMIC_SEQ_CST);
+			Barrier_Sync(&B, N);
+			ASSERT(__atomic_load_n(&arrived, __ATOMIC_SEQ_CST) == N*(r+1));
+			Barrier_Sync(&B, N);
+		}
+		return 0;
+	}
+
+	Tid_t tids[N];
+	for(unsigned int i=0; i<N; i++)
+		tids[i] = CreateThread(worker, i, NULL);
+	for(unsigned int i=0; i<N; i++)
+		ASSERT(ThreadJoin(tids[i], NULL)==0);
+
+	ASSERT(arrived == N*ROUNDS);
+	ASSERT(B.count == 0);
+	ASSERT(B.epoch == 2*ROUNDS);
+	return 0;
+}
+
+
+BOOT_TEST(test_semaphore_post_wait,
+	"Test that every Sem_Post is consumed by exactly one Sem_Wait."
+	)
+{
+	const int P = 4;
+	const int K = 1000;
+	Semaphore S = SEMAPHORE_INIT(0);
+
+	int producer(int argl, void* args)
+	{
+		for(int i=0; i<K; i++)
+			Sem_Post(&S);
+		return 0;
+	}
+
+	Tid_t tids[P];
+	for(int i=0; i<P; i++)
+		tids[i] = CreateThread(producer, i, NULL);
+
+	for(int i=0; i<P*K; i++)
+		Sem_Wait(&S);
+
+	for(int i=0; i<P; i++)
+		ASSERT(ThreadJoin(tids[i], NULL)==0);
+
+	ASSERT(S.value == 0);
+	ASSERT(Sem_TimedWait(&S, 10)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_semaphore_timedwait_timeout,
+	"Test that a timed wait on a semaphore succeeds while the counter is positive,\n"
+	"and terminates after the timeout when it is zero."
+	)
+{
+	Semaphore S = SEMAPHORE_INIT(2);
+
+	ASSERT(Sem_TimedWait(&S, 100)==1);
+	ASSERT(Sem_TimedWait(&S, 100)==1);
+	ASSERT(Sem_TimedWait(&S, 100)==0);
+	ASSERT(S.waitset == NULL);
+
+	Sem_Post(&S);
+	ASSERT(Sem_TimedWait(&S, 100)==1);
+	return 0;
+}
+
+
+
 /*********************************************
  *
  *
@@ -553,6 +774,47 @@ BOOT_TEST(test_close_success_on_valid_nonfile_fid,
 	return 0;
 }
 
+BOOT_TEST(test_closerange_on_many_fids,
+	"Test that a process can open many more fids than fit in the initial\n"
+	"fileid table, that the lowest free fid is allocated first, and that\n"
+	"CloseRange closes exactly the fids in its range."
+	)
+{
+	const int N = 300;
+	for(Fid_t f=0; f<N; f++)
+		ASSERT(OpenNull()==f);
+
+	ASSERT(Close(100)==0);
+	ASSERT(Close(7)==0);
+	ASSERT(OpenNull()==7);
+	ASSERT(OpenNull()==100);
+
+	ASSERT(CloseRange(-1, 3)==-1);
+	ASSERT(CloseRange(5, 4)==-1);
+	ASSERT(CloseRange(10, MAX_FILEID)==0);
+
+	char c;
+	ASSERT(Read(9, &c, 1)==1);
+	for(Fid_t f=10; f<N; f++)
+		ASSERT(Read(f, &c, 1)==-1);
+	ASSERT(OpenNull()==10);
+
+	/* A child inherits only the open fids */
+	int child(int argl, void* args) {
+		char c;
+		ASSERT(Read(9, &c, 1)==1);
+		ASSERT(Read(11, &c, 1)==-1);
+		ASSERT(CloseRange(0, MAX_FILEID-1)==0);
+		ASSERT(Read(9, &c, 1)==-1);
+		return 0;
+	}
+	Pid_t pid = Exec(child, 0, NULL);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	ASSERT(Read(9, &c, 1)==1);
+	return 0;
+}
+
+
 BOOT_TEST(test_close_terminals,
 	"Test that terminals can be opened and then closed without error."
 	)
@@ -725,6 +987,332 @@ BOOT_TEST(test_child_inherits_files,
 	return 0;
 }
 
+BOOT_TEST(test_shm_region,
+	"Test that a shared memory region is shared with child processes, and lives\n"
+	"as long as some file id refers to it."
+	)
+{
+	ASSERT(ShmCreate(0)==NOFILE);
+	ASSERT(ShmCreate(MAX_SHM_SIZE+1)==NOFILE);
+
+	Fid_t shm = ShmCreate(1000);
+	ASSERT(shm!=NOFILE);
+	unsigned int size;
+	char* mem = ShmAttach(shm, &size);
+	ASSERT(mem!=NULL && size==1000);
+	ASSERT(((unsigned long)mem & 63)==0);
+	for(int i=0; i<1000; i++)
+		ASSERT(mem[i]==0);
+
+	Fid_t fn = OpenNull();
+	ASSERT(ShmAttach(fn, NULL)==NULL);
+	ASSERT(ShmAttach(MAX_FILEID, NULL)==NULL);
+	Close(fn);
+
+	/* The child attaches through the file id it inherited */
+	int shm_child(int argl, void* args)
+	{
+		char* m = ShmAttach(*(Fid_t*)args, NULL);
+		ASSERT(m!=NULL);
+		strcpy(m, "hello");
+		return 0;
+	}
+	Pid_t cpid = Exec(shm_child, sizeof(shm), &shm);
+	ASSERT(cpid!=NOPROC);
+	ASSERT(WaitChild(cpid, NULL)==cpid);
+	ASSERT(strcmp(mem, "hello")==0);
+
+	ASSERT(Dup2(shm, MAX_FILEID-1)==0);
+	ASSERT(Close(shm)==0);
+	ASSERT(ShmAttach(shm, NULL)==NULL);
+	ASSERT(ShmAttach(MAX_FILEID-1, NULL)==mem);
+	ASSERT(Close(MAX_FILEID-1)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_shm_rings,
+	"Test the single- and multi-producer rings of tinyoslib, between threads and\n"
+	"processes."
+	)
+{
+	ASSERT(RingSize(3, 4)==0);
+	char block[64];
+	ASSERT(RingInit(block, 6, 4, RING_SPSC)==NULL);
+
+	/* Fill and drain a ring */
+	Fid_t shm = ShmCreate(RingSize(8, sizeof(int)));
+	ASSERT(shm!=NOFILE);
+	shm_ring* ring = RingInit(ShmAttach(shm, NULL), 8, sizeof(int), RING_SPSC);
+	ASSERT(ring!=NULL);
+	int x;
+	ASSERT(RingTryGet(ring, &x)==-1);
+	for(int i=0; i<8; i++)
+		ASSERT(RingTryPut(ring, &i)==0);
+	ASSERT(RingTryPut(ring, &x)==-1);
+	for(int i=0; i<8; i++)
+		ASSERT(RingTryGet(ring, &x)==0 && x==i);
+	ASSERT(RingTryGet(ring, &x)==-1);
+
+	/* A producer process, through a small ring */
+	struct ring_args { Fid_t shm; int n; } pargs = { shm, 100000 };
+	int ring_producer(int argl, void* args)
+	{
+		struct ring_args* a = args;
+		shm_ring* r = ShmAttach(a->shm, NULL);
+		for(int i=0; i<a->n; i++)
+			RingPut(r, &i);
+		return 0;
+	}
+	Pid_t cpid = Exec(ring_producer, sizeof(pargs), &pargs);
+	for(int i=0; i<pargs.n; i++) {
+		RingGet(ring, &x);
+		ASSERT(x==i);
+	}
+	ASSERT(WaitChild(cpid, NULL)==cpid);
+	Close(shm);
+
+	/* Many producer and consumer threads; each consumer sees the items of a producer in order */
+	const int P = 4, C = 3, M = 30000;
+	shm = ShmCreate(RingSize(16, sizeof(int)));
+	ring = RingInit(ShmAttach(shm, NULL), 16, sizeof(int), RING_MPMC);
+	int received[C];
+	int mpmc_producer(int argl, void* args)
+	{
+		for(int i=0; i<M; i++) {
+			int item = (argl<<24) | i;
+			RingPut(ring, &item);
+		}
+		return 0;
+	}
+	int mpmc_consumer(int argl, void* args)
+	{
+		int last[P];
+		for(int p=0; p<P; p++) last[p] = -1;
+		int item;
+		for(RingGet(ring, &item); item != -1; RingGet(ring, &item)) {
+			int p = item >> 24, i = item & 0xffffff;
+			ASSERT(p>=0 && p<P && i>last[p]);
+			last[p] = i;
+			received[argl]++;
+		}
+		return 0;
+	}
+	Tid_t prod[P], cons[C];
+	for(int c=0; c<C; c++) {
+		received[c] = 0;
+		cons[c] = CreateThread(mpmc_consumer, c, NULL);
+	}
+	for(int p=0; p<P; p++)
+		prod[p] = CreateThread(mpmc_producer, p, NULL);
+	for(int p=0; p<P; p++)
+		ASSERT(ThreadJoin(prod[p], NULL)==0);
+
+	int total = 0, stop = -1;
+	for(int c=0; c<C; c++)
+		RingPut(ring, &stop);
+	for(int c=0; c<C; c++) {
+		ASSERT(ThreadJoin(cons[c], NULL)==0);
+		total += received[c];
+	}
+	ASSERT(total == P*M);
+	Close(shm);
+	return 0;
+}
+
+
+
+BOOT_TEST(test_lockinfo_stream,
+	"Test that the lock statistics stream returns whole lockinfo records, and that\n"
+	"(when profiling) the kernel lock is accounted at the system call that took it."
+	)
+{
+	Fid_t fid = OpenLockInfo();
+	ASSERT(fid!=NOFILE);
+
+	lockinfo info;
+	ASSERT(Read(fid, (char*)&info, sizeof(info)-1)==-1);
+
+	int found = 0, records = 0, rc;
+	while((rc = Read(fid, (char*)&info, sizeof(info))) > 0) {
+		ASSERT(rc == sizeof(info));
+		records++;
+		if(info.kind==LOCK_KERNEL && strcmp(info.site, "OpenLockInfo")==0) {
+			ASSERT(info.count >= 1);
+			found = 1;
+		}
+	}
+	ASSERT(rc == 0);
+
+#ifdef LOCK_PROFILING
+	ASSERT(found);
+#else
+	ASSERT(records == 0 && !found);
+#endif
+
+	ASSERT(Close(fid)==0);
+	return 0;
+}
+
+
+
+
+BOOT_TEST(test_openinfo_bulk_read,
+	"Test that the info stream returns many procinfo records per read, covering\n"
+	"exactly the live and zombie processes."
+	)
+{
+	const int N = 10;
+	int quick_child(int argl, void* args) { return 0; }
+
+	Pid_t child[N];
+	for(int i=0; i<N; i++) {
+		child[i] = Exec(quick_child, sizeof(i), &i);
+		ASSERT(child[i]!=NOPROC);
+	}
+
+	Fid_t fid = OpenInfo();
+	ASSERT(fid!=NOFILE);
+
+	procinfo info[3];
+	ASSERT(Read(fid, (char*)info, sizeof(procinfo)-1)==-1);
+
+	int seen_init = 0, seen_self = 0, seen_child = 0, rc;
+	while((rc = Read(fid, (char*)info, sizeof(info))) > 0) {
+		ASSERT(rc % sizeof(procinfo) == 0);
+		for(int j=0; j < rc/(int)sizeof(procinfo); j++) {
+			if(info[j].pid==1) seen_init++;
+			if(info[j].pid==GetPid()) seen_self++;
+			for(int i=0; i<N; i++)
+				if(info[j].pid==child[i]) {
+					ASSERT(info[j].ppid==GetPid());
+					ASSERT(info[j].argl==sizeof(int));
+					ASSERT(*(int*)info[j].args == i);
+					seen_child++;
+				}
+		}
+	}
+	ASSERT(rc == 0);
+	ASSERT(seen_init==1 && seen_self==1 && seen_child==N);
+	ASSERT(Close(fid)==0);
+
+	for(int i=0; i<N; i++)
+		ASSERT(WaitChild(child[i], NULL)==child[i]);
+	return 0;
+}
+
+
+
+BOOT_TEST(test_getrusage,
+	"Test that GetRusage accounts run time and I/O to the thread, the process\n"
+	"and, once they are waited for, to the parent of the process."
+	)
+{
+	rusage_t ru;
+	ASSERT(GetRusage(USAGE_THREAD, NULL)==-1);
+	ASSERT(GetRusage(42, &ru)==-1);
+
+	Fid_t fn = OpenNull();
+	ASSERT(fn!=NOFILE);
+	char buf[1000];
+	memset(buf, 0, sizeof(buf));
+	ASSERT(Write(fn, buf, sizeof(buf))==sizeof(buf));
+	ASSERT(Read(fn, buf, 100)==100);
+
+	ASSERT(GetRusage(USAGE_THREAD, &ru)==0);
+	ASSERT(ru.bytes_written==1000 && ru.bytes_read==100);
+
+	/* Spend a few quanta running */
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do clock_gettime(CLOCK_MONOTONIC, &t1);
+	while((t1.tv_sec-t0.tv_sec)*1000000000l + (t1.tv_nsec-t0.tv_nsec) < 50000000l);
+
+	ASSERT(GetRusage(USAGE_THREAD, &ru)==0);
+	ASSERT(ru.run_time >= 20000);
+
+	/* The usage of an exited thread stays with the process */
+	int writer(int argl, void* args) {
+		char b[500];
+		memset(b, 0, sizeof(b));
+		return Write(argl, b, sizeof(b));
+	}
+	Tid_t t = CreateThread(writer, fn, NULL);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT(GetRusage(USAGE_PROCESS, &ru)==0);
+	ASSERT(ru.bytes_written==1500);
+
+	ASSERT(GetRusage(USAGE_CHILDREN, &ru)==0);
+	ASSERT(ru.bytes_written==0);
+	Pid_t pid = Exec(writer, fn, NULL);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	ASSERT(GetRusage(USAGE_CHILDREN, &ru)==0);
+	ASSERT(ru.bytes_written==500);
+	return 0;
+}
+
+
+
+BOOT_TEST(test_threadinfo_wchan,
+	"Test that the thread info stream reports where each thread is blocked."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	int reader(int argl, void* args) {
+		char c;
+		return Read(argl, &c, 1);
+	}
+	Tid_t t = CreateThread(reader, pipe.read, NULL);
+	ASSERT(t!=NOTHREAD);
+
+	Fid_t fid = OpenThreadInfo();
+	ASSERT(fid!=NOFILE);
+	threadinfo info[4];
+	ASSERT(Read(fid, (char*)info, sizeof(threadinfo)-1)==-1);
+	ASSERT(Close(fid)==0);
+
+	/* Look for the reader until it blocks */
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	int found = 0;
+	for(int tries=0; tries<100 && !found; tries++) {
+		fid = OpenThreadInfo();
+		ASSERT(fid!=NOFILE);
+		int rc, seen_self = 0;
+		while((rc = Read(fid, (char*)info, sizeof(info))) > 0) {
+			ASSERT(rc % sizeof(threadinfo) == 0);
+			for(int j=0; j < rc/(int)sizeof(threadinfo); j++) {
+				if(info[j].pid!=GetPid()) continue;
+				if(info[j].tid==ThreadSelf()) {
+					ASSERT(info[j].state==THREAD_RUNNING);
+					ASSERT(info[j].wchan[0]=='\0');
+					seen_self++;
+				}
+				if(info[j].tid==t && info[j].state==THREAD_BLOCKED) {
+					ASSERT(strcmp(info[j].wchan, "pipe_readv")==0);
+					ASSERT(strcmp(info[j].cause, "PIPE")==0);
+					found = 1;
+				}
+			}
+		}
+		ASSERT(rc==0 && seen_self==1);
+		ASSERT(Close(fid)==0);
+		if(!found) {
+			Mutex_Lock(&mx);
+			Cond_TimedWait(&mx, &cv, 10);
+			Mutex_Unlock(&mx);
+		}
+	}
+	ASSERT(found);
+
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	int retval;
+	ASSERT(ThreadJoin(t, &retval)==0);
+	ASSERT(retval==1);
+	return 0;
+}
 
 
 
@@ -879,10 +1467,16 @@ TEST_SUITE(basic_tests,
 	&test_exit_returns_status,
 	&test_main_return_returns_status,
 	&test_wait_for_any_child,
+	&test_exec_many_processes,
+	&test_execmany_waitchildren,
 	&test_orphans_adopted_by_init,
 	&test_cond_timedwait_timeout,
 	&test_cond_timedwait_signal,
 	&test_cond_timedwait_broadcast,
+	&test_cond_broadcast_requeue,
+	&test_barrier_sync,
+	&test_semaphore_post_wait,
+	&test_semaphore_timedwait_timeout,
 	&test_null_device,
 	&test_get_terminals,
 	&test_open_terminals,
@@ -891,6 +1485,7 @@ TEST_SUITE(basic_tests,
 	&test_dup2_copies_file,
 	&test_close_error_on_invalid_fid,
 	&test_close_success_on_valid_nonfile_fid,
+	&test_closerange_on_many_fids,
 	&test_close_terminals,
 	&test_read_kbd,
 	&test_read_kbd_big,
@@ -901,6 +1496,12 @@ TEST_SUITE(basic_tests,
 	&test_write_error_on_bad_fid,
 	&test_write_to_many_terminals,
 	&test_child_inherits_files,
+	&test_shm_region,
+	&test_shm_rings,
+	&test_lockinfo_stream,
+	&test_openinfo_bulk_read,
+	&test_getrusage,
+	&test_threadinfo_wchan,
 	NULL
 };
 
@@ -1338,6 +1939,191 @@ BOOT_TEST(test_cyclic_joins,
 }
 
 
+BOOT_TEST(test_stale_tid_rejected,
+	"Test that the tid of a joined thread stays invalid after its handle is reused")
+{
+	int task(int argl, void* args) { return argl; }
+
+	Tid_t t1 = CreateThread(task, 1, NULL);
+	ASSERT(t1!=NOTHREAD);
+	ASSERT(ThreadJoin(t1, NULL)==0);
+
+	/* The new thread may take over the handle of t1 */
+	Tid_t t2 = CreateThread(task, 2, NULL);
+	ASSERT(t2!=NOTHREAD);
+	ASSERT(t2!=t1);
+
+	ASSERT(ThreadJoin(t1, NULL)==-1);
+	ASSERT(ThreadDetach(t1)==-1);
+
+	int exitval;
+	ASSERT(ThreadJoin(t2, &exitval)==0);
+	ASSERT(exitval==2);
+	return 0;
+}
+
+
+BOOT_TEST(test_join_thousands_of_threads,
+	"Test that a process can create and join thousands of threads")
+{
+	const int N = 4000;
+	Tid_t* tids = malloc(N*sizeof(Tid_t));
+
+	int task(int argl, void* args) { return argl; }
+
+	for(int i=0; i<N; i++) {
+		tids[i] = CreateThread(task, i, NULL);
+		ASSERT(tids[i]!=NOTHREAD);
+	}
+
+	/* Join in reverse order of creation */
+	for(int i=N-1; i>=0; i--) {
+		int exitval;
+		ASSERT(ThreadJoin(tids[i], &exitval)==0);
+		ASSERT(exitval==i);
+	}
+
+	free(tids);
+	return 0;
+}
+
+
+BOOT_TEST(test_waitchild_from_many_threads,
+	"Test that threads waiting for a specific child are woken up by its exit only,\n"
+	"and that only one of many threads waiting for the same child reaps it.")
+{
+	static Mutex mx = MUTEX_INIT;
+	static CondVar cv = COND_INIT;
+	static int released[2];
+
+	int child(int argl, void* args) {
+		Mutex_Lock(&mx);
+		while(! released[argl]) Cond_Wait(&mx, &cv);
+		Mutex_Unlock(&mx);
+		return argl+1;
+	}
+
+	static Pid_t pid[2];
+	static int reaped[2];
+	int waiter(int argl, void* args) {
+		int status;
+		Pid_t p = WaitChild(pid[argl], &status);
+		if(p == NOPROC) return 0;
+		ASSERT(p == pid[argl] && status == argl+1);
+		__atomic_add_fetch(&reaped[argl], 1, __ATOMIC_SEQ_CST);
+		return 1;
+	}
+
+	released[0] = released[1] = 0;
+	reaped[0] = reaped[1] = 0;
+	pid[0] = Exec(child, 0, NULL);
+	pid[1] = Exec(child, 1, NULL);
+
+	/* Two waiters on child 0, one on child 1 */
+	Tid_t t0 = CreateThread(waiter, 0, NULL);
+	Tid_t t1 = CreateThread(waiter, 0, NULL);
+	Tid_t t2 = CreateThread(waiter, 1, NULL);
+
+	Mutex_Lock(&mx);
+	released[1] = 1;
+	Cond_Broadcast(&cv);
+	Mutex_Unlock(&mx);
+
+	int rv;
+	ASSERT(ThreadJoin(t2, &rv)==0 && rv==1);
+	ASSERT(reaped[1]==1 && reaped[0]==0);
+
+	Mutex_Lock(&mx);
+	released[0] = 1;
+	Cond_Broadcast(&cv);
+	Mutex_Unlock(&mx);
+
+	int rv0, rv1;
+	ASSERT(ThreadJoin(t0, &rv0)==0);
+	ASSERT(ThreadJoin(t1, &rv1)==0);
+	ASSERT(rv0+rv1 == 1);
+	ASSERT(reaped[0]==1);
+	ASSERT(WaitChild(NOPROC, NULL)==NOPROC);
+	return 0;
+}
+
+
+BOOT_TEST(test_join_and_wait_with_timeout,
+	"Test that ThreadJoinTimeout and WaitChildTimeout give up after the timeout,\n"
+	"and succeed once the thread or child exits.")
+{
+	static Mutex mx = MUTEX_INIT;
+	static CondVar cv = COND_INIT;
+	static int released;
+
+	int blocked(int argl, void* args) {
+		Mutex_Lock(&mx);
+		while(! released) Cond_Wait(&mx, &cv);
+		Mutex_Unlock(&mx);
+		return argl;
+	}
+
+	released = 0;
+	Tid_t t = CreateThread(blocked, 5, NULL);
+	Pid_t pid = Exec(blocked, 7, NULL);
+
+	ASSERT(ThreadJoinTimeout(ThreadSelf(), NULL, 10)==-1);
+	ASSERT(ThreadJoinTimeout(t, NULL, 20)==-1);
+	ASSERT(WaitChildTimeout(pid, NULL, 20)==NOPROC);
+	ASSERT(WaitChildTimeout(NOPROC, NULL, 20)==NOPROC);
+
+	Mutex_Lock(&mx);
+	released = 1;
+	Cond_Broadcast(&cv);
+	Mutex_Unlock(&mx);
+
+	int rv;
+	ASSERT(ThreadJoinTimeout(t, &rv, 10000)==0 && rv==5);
+	ASSERT(WaitChildTimeout(NOPROC, &rv, 10000)==pid && rv==7);
+	ASSERT(WaitChildTimeout(NOPROC, NULL, 10)==NOPROC);
+	return 0;
+}
+
+
+BOOT_TEST(test_join_any_thread,
+	"Test that one thread can join thousands of threads with ThreadJoinAny,\n"
+	"and that it does not return threads that were joined or detached.")
+{
+	const int N = 2000;
+	int task(int argl, void* args) { return argl; }
+
+	ASSERT(ThreadJoinAny(NULL)==NOTHREAD);
+
+	/* A detached thread is not waited for */
+	Tid_t d = CreateThread(task, -1, NULL);
+	ASSERT(ThreadDetach(d)==0);
+	ASSERT(ThreadJoinAny(NULL)==NOTHREAD);
+
+	/* A thread joined by ThreadJoin is not returned again */
+	Tid_t t = CreateThread(task, -2, NULL);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT(ThreadJoinAny(NULL)==NOTHREAD);
+
+	char* seen = calloc(N, 1);
+	for(int i=0; i<N; i++)
+		ASSERT(CreateThread(task, i, NULL)!=NOTHREAD);
+
+	for(int i=0; i<N; i++) {
+		int exitval;
+		Tid_t j = ThreadJoinAny(&exitval);
+		ASSERT(j!=NOTHREAD);
+		ASSERT(exitval>=0 && exitval<N && !seen[exitval]);
+		seen[exitval] = 1;
+		ASSERT(ThreadJoin(j, NULL)==-1);
+	}
+	ASSERT(ThreadJoinAny(NULL)==NOTHREAD);
+
+	free(seen);
+	return 0;
+}
+
+
+
 TEST_SUITE(thread_tests, 
 	"A suite of tests for threads."
 	)
@@ -1356,6 +2142,11 @@ TEST_SUITE(thread_tests,
 	&test_main_exit_cleanup,
 	&test_noexit_cleanup,
 	&test_cyclic_joins,
+	&test_stale_tid_rejected,
+	&test_join_thousands_of_threads,
+	&test_waitchild_from_many_threads,
+	&test_join_and_wait_with_timeout,
+	&test_join_any_thread,
 	NULL
 };
 
@@ -1572,6 +2363,892 @@ BOOT_TEST(test_pipe_multi_producer,
 	return 0;
 }
 
+/* Writes a numbered byte sequence of argl bytes to the fid in args, in chunks of odd sizes */
+static int pattern_writer(int argl, void* args)
+{
+	Fid_t fid = *(Fid_t*)args;
+	char buffer[5000];
+	int sent = 0, chunk = 1;
+	while(sent < argl) {
+		int n = (argl-sent < chunk) ? argl-sent : chunk;
+		for(int i=0; i<n; i++) buffer[i] = (char)(sent+i);
+		int rc = Write(fid, buffer, n);
+		ASSERT(rc>0);
+		sent += rc;
+		chunk = (chunk*7 + 3) % 5000 + 1;
+	}
+	Close(fid);
+	return 0;
+}
+
+/* Reads the fid to the end, checking the byte sequence, in chunks of odd sizes */
+static int pattern_check(Fid_t fid)
+{
+	char buffer[3000];
+	int count = 0, chunk = 1, rc;
+	while((rc = Read(fid, buffer, chunk)) > 0) {
+		for(int i=0; i<rc; i++)
+			if(buffer[i] != (char)(count+i)) return -1;
+		count += rc;
+		chunk = (chunk*5 + 1) % 3000 + 1;
+	}
+	return (rc==0) ? count : -1;
+}
+
+
+BOOT_TEST(test_pipe_wraparound,
+	"Test that data survive reads and writes of various sizes, as they wrap around\n"
+	"the end of the pipe buffer."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	const int N = 1000000;
+	Tid_t t = CreateThread(pattern_writer, N, &pipe.write);
+	ASSERT(pattern_check(pipe.read)==N);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	Close(pipe.read);
+	return 0;
+}
+
+
+BOOT_TEST(test_splice_pipes,
+	"Test that Splice moves the data of one pipe to another, up to end of file."
+	)
+{
+	pipe_t p1, p2;
+	ASSERT(Pipe(&p1)==0);
+	ASSERT(Pipe(&p2)==0);
+
+	/* Illegal combinations */
+	ASSERT(Splice(p1.write, p2.write, 10)==-1);
+	ASSERT(Splice(p1.read, p2.read, 10)==-1);
+	ASSERT(Splice(p1.read, p1.write, 10)==-1);
+	ASSERT(Splice(p1.read, MAX_FILEID, 10)==-1);
+	Fid_t fn = OpenNull();
+	ASSERT(Splice(fn, p2.write, 10)==-1);
+	Close(fn);
+	ASSERT(Splice(p1.read, p2.write, 0)==0);
+
+	const int N = 1000000;
+	Tid_t t = CreateThread(pattern_writer, N, &p1.write);
+
+	int splicer(int argl, void* args) {
+		pipe_t* pp = args;
+		int count = 0, rc;
+		while((rc = Splice(pp[0].read, pp[1].write, 3333)) > 0) {
+			ASSERT(rc <= 3333);
+			count += rc;
+		}
+		ASSERT(rc==0);
+		Close(pp[1].write);
+		return count;
+	}
+	pipe_t pp[2] = { p1, p2 };
+	Tid_t s = CreateThread(splicer, 0, pp);
+
+	ASSERT(pattern_check(p2.read)==N);
+
+	int moved;
+	ASSERT(ThreadJoin(s, &moved)==0 && moved==N);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* The output has no reader */
+	Close(p2.read);
+	ASSERT(Pipe(&p2)==0);
+	Close(p2.read);
+	ASSERT(Splice(p1.read, p2.write, 10)==-1);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_capacity,
+	"Test that the pipe capacity can be set, that it grows under bulk transfers,\n"
+	"and shrinks back under light use."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	Fid_t fn = OpenNull();
+	ASSERT(SetPipeCapacity(fn, 4096)==-1);
+	Close(fn);
+	ASSERT(SetPipeCapacity(pipe.read, 100)==-1);
+	ASSERT(SetPipeCapacity(pipe.write, 2<<20)==-1);
+
+	int small = SetPipeCapacity(pipe.read, 0);
+	ASSERT(small >= 512 && small < 4096);
+
+	/* A fixed capacity takes a large write at once */
+	const int N = 100000;
+	char* buf = malloc(N);
+	memset(buf, 'x', N);
+	ASSERT(SetPipeCapacity(pipe.write, N)==N);
+	ASSERT(Write(pipe.write, buf, N)==N);
+	ASSERT(SetPipeCapacity(pipe.write, N/2)==-1);
+	ASSERT(Read(pipe.read, buf, N)==N);
+	ASSERT(SetPipeCapacity(pipe.read, N/2)==N/2);
+
+	/* Adaptive again: light use shrinks the pipe */
+	ASSERT(SetPipeCapacity(pipe.read, 0)==N/2);
+	for(int i=0; i<100; i++) {
+		ASSERT(Write(pipe.write, "hello", 5)==5);
+		ASSERT(Read(pipe.read, buf, 5)==5);
+	}
+	ASSERT(SetPipeCapacity(pipe.read, 0)==small);
+
+	/* A bulk transfer makes it grow */
+	Tid_t t = CreateThread(pattern_writer, 10*N, &pipe.write);
+	int count = 0, rc;
+	while((rc = Read(pipe.read, buf, N)) > 0)
+		count += rc;
+	ASSERT(count == 10*N);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT(SetPipeCapacity(pipe.read, 0) > small);
+
+	free(buf);
+	Close(pipe.read);
+	return 0;
+}
+
+
+/* The control block of a pipe, to check the state of its buffer */
+static PIPE_CB* pipe_control_block(Fid_t fd)
+{
+	return get_fcb(fd)->streamobj;
+}
+
+BOOT_TEST(test_pipe_shrinks_when_idle,
+	"Test that a pipe that grew under a bulk transfer gives its buffer back when\n"
+	"it empties, and falls back to the small capacity once it is lightly used,\n"
+	"keeping a small buffer for ping-pong messages."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	int small = SetPipeCapacity(pipe.read, 0);
+
+	const int N = 1000000;
+	char* buf = malloc(N);
+	int bulk_writer(int argl, void* args)
+	{
+		char chunk[4096];
+		memset(chunk, 'x', sizeof(chunk));
+		for(int sent = 0, rc; sent < N; sent += rc) {
+			int n = (N - sent < 4096) ? N - sent : 4096;
+			rc = Write(pipe.write, chunk, n);
+			ASSERT(rc > 0);
+		}
+		return 0;
+	}
+	Tid_t t = CreateThread(bulk_writer, 0, NULL);
+	int count = 0, rc;
+	while(count < N && (rc = Read(pipe.read, buf, N)) > 0)
+		count += rc;
+	ASSERT(count == N);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	int grown = SetPipeCapacity(pipe.read, 0);
+	ASSERT(grown > small);
+	PIPE_CB* pipe_cb = pipe_control_block(pipe.read);
+	ASSERT(pipe_cb->BUFFER == NULL);
+
+	/* The empty pipe still takes a write of its whole capacity */
+	unsigned int r, w;
+	ASSERT(Available(pipe.write, &r, &w)==0 && w==grown);
+	memset(buf, 'y', grown);
+	ASSERT(Write(pipe.write, buf, grown)==grown);
+	memset(buf, 0, grown);
+
+	ASSERT(pipe_cb->BUFFER != NULL);
+
+	/* Emptying the pipe frees its buffer */
+	ASSERT(Read(pipe.read, buf, N)==grown);
+	ASSERT(pipe_cb->BUFFER == NULL && pipe_cb->capacity == grown);
+	ASSERT(buf[0]=='y' && buf[grown-1]=='y');
+
+	/* Light use brings the capacity back down */
+	for(int i=0; i<20; i++) {
+		ASSERT(Write(pipe.write, "hello", 5)==5);
+		ASSERT(Read(pipe.read, buf, 5)==5 && memcmp(buf, "hello", 5)==0);
+	}
+	ASSERT(SetPipeCapacity(pipe.read, 0)==small);
+
+	/* ... where the buffer is kept across messages */
+	char* buffer = pipe_cb->BUFFER;
+	ASSERT(buffer != NULL);
+	for(int i=0; i<20; i++) {
+		ASSERT(Write(pipe.write, "hello", 5)==5);
+		ASSERT(Read(pipe.read, buf, 5)==5);
+		ASSERT(pipe_cb->BUFFER == buffer);
+	}
+
+	free(buf);
+	Close(pipe.read);
+	Close(pipe.write);
+	return 0;
+}
+
+
+BOOT_TEST(test_readv_writev,
+	"Test scatter-gather I/O on pipes, the null device, and streams without\n"
+	"native support."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	/* A header and a payload, written at once */
+	char hdr[4] = "HDR:";
+	char payload[] = "the payload";
+	iovec_t out[2] = { { hdr, 4 }, { payload, sizeof(payload) } };
+	ASSERT(WriteV(pipe.write, out, 2)==4+sizeof(payload));
+
+	/* Read back, split differently */
+	char a[6], b[64];
+	iovec_t in[2] = { { a, 6 }, { b, sizeof(b) } };
+	ASSERT(ReadV(pipe.read, in, 2)==4+sizeof(payload));
+	ASSERT(memcmp(a, "HDR:th", 6)==0);
+	ASSERT(strcmp(b, "e payload")==0);
+
+	/* Errors */
+	ASSERT(WriteV(pipe.read, out, 2)==-1);
+	ASSERT(ReadV(pipe.write, in, 2)==-1);
+	ASSERT(WriteV(pipe.write, out, MAX_IOV+1)==-1);
+	ASSERT(WriteV(pipe.write, NULL, 1)==-1);
+	iovec_t bad = { NULL, 10 };
+	ASSERT(WriteV(pipe.write, &bad, 1)==-1);
+	ASSERT(WriteV(NOFILE, out, 2)==-1);
+	ASSERT(WriteV(pipe.write, out, 0)==0);
+
+	/* EOF */
+	Close(pipe.write);
+	ASSERT(ReadV(pipe.read, in, 2)==0);
+	Close(pipe.read);
+
+	/* The null device */
+	Fid_t fn = OpenNull();
+	ASSERT(WriteV(fn, out, 2)==4+sizeof(payload));
+	ASSERT(ReadV(fn, in, 2)==6+sizeof(b));
+	ASSERT(a[0]==0 && b[sizeof(b)-1]==0);
+	Close(fn);
+
+	/* The process info stream has no ReadV, and returns one record per Read */
+	procinfo info[2];
+	iovec_t pin[2] = { { &info[0], sizeof(procinfo) }, { &info[1], sizeof(procinfo) } };
+	Fid_t finfo = OpenInfo();
+	ASSERT(ReadV(finfo, pin, 2) == 2*sizeof(procinfo));
+	ASSERT(info[0].pid == 0 && info[1].pid == 1);
+	Close(finfo);
+
+	return 0;
+}
+
+
+BOOT_TEST(test_nonblocking_pipe,
+	"Test that non-blocking pipe ends return WOULDBLOCK instead of sleeping, and\n"
+	"that Available reports the buffered bytes and the free space."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetPipeCapacity(pipe.write, 1024)==1024);
+
+	ASSERT(SetNonBlocking(NOFILE, 1)==-1);
+	ASSERT(Available(NOFILE, NULL, NULL)==-1);
+
+	ASSERT(SetNonBlocking(pipe.read, 1)==0);
+	ASSERT(SetNonBlocking(pipe.read, 1)==1);
+	ASSERT(SetNonBlocking(pipe.write, 1)==0);
+
+	unsigned int r, w;
+	char buf[300];
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==WOULDBLOCK);
+	ASSERT(Available(pipe.read, &r, &w)==0 && r==0 && w==0);
+	ASSERT(Available(pipe.write, &r, &w)==0 && r==0 && w==1024);
+
+	/* Fill the pipe, without sleeping */
+	memset(buf, 'x', sizeof(buf));
+	int total = 0, rc;
+	while((rc = Write(pipe.write, buf, sizeof(buf))) > 0)
+		total += rc;
+	ASSERT(rc==WOULDBLOCK);
+	ASSERT(total==1024);
+	ASSERT(Available(pipe.read, &r, NULL)==0 && r==1024);
+	ASSERT(Available(pipe.write, NULL, &w)==0 && w==0);
+
+	/* The mode is shared by duplicated file ids */
+	ASSERT(Dup2(pipe.read, 10)==0);
+	ASSERT(SetNonBlocking(10, 1)==1);
+
+	total = 0;
+	while((rc = Read(10, buf, sizeof(buf))) > 0)
+		total += rc;
+	ASSERT(rc==WOULDBLOCK);
+	ASSERT(total==1024);
+	Close(10);
+
+	/* End of file is not WOULDBLOCK */
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==0);
+	Close(pipe.read);
+
+	/* The null device never blocks */
+	Fid_t fn = OpenNull();
+	ASSERT(Available(fn, &r, &w)==0 && r==UINT_MAX && w==UINT_MAX);
+	Close(fn);
+
+	return 0;
+}
+
+
+BOOT_TEST(test_poll_pipes,
+	"Test that Poll reports the ready pipe ends, and sleeps until one becomes ready\n"
+	"or the timeout expires."
+	)
+{
+	pipe_t p1, p2;
+	ASSERT(Pipe(&p1)==0);
+	ASSERT(Pipe(&p2)==0);
+
+	pollfd fds[4] = {
+		{ p1.read, POLLIN, 0 }, { p2.read, POLLIN, 0 },
+		{ p1.write, POLLOUT, 0 }, { -1, POLLIN, 0 }
+	};
+
+	ASSERT(Poll(NULL, 1, 0)==-1);
+	ASSERT(Poll(fds, MAX_FILEID+1, 0)==-1);
+
+	/* Only the write end is ready */
+	ASSERT(Poll(fds, 4, 0)==1);
+	ASSERT(fds[0].revents==0 && fds[1].revents==0 && fds[2].revents==POLLOUT && fds[3].revents==0);
+	ASSERT(Poll(fds, 2, 20)==0);
+
+	/* Sleep until another thread writes */
+	int delayed_write(int argl, void* args)
+	{
+		Mutex mx = MUTEX_INIT;
+		CondVar cv = COND_INIT;
+		Mutex_Lock(&mx);
+		Cond_TimedWait(&mx, &cv, 20);
+		Mutex_Unlock(&mx);
+		return Write(p2.write, "x", 1);
+	}
+	Tid_t t = CreateThread(delayed_write, 0, NULL);
+	ASSERT(Poll(fds, 2, POLL_FOREVER)==1);
+	ASSERT(fds[0].revents==0 && fds[1].revents==POLLIN);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* Closed ends */
+	Close(p1.write);
+	Close(p2.read);
+	pollfd hup[3] = { { p1.read, POLLIN, 0 }, { p2.write, POLLOUT, 0 }, { p1.write, POLLIN, 0 } };
+	ASSERT(Poll(hup, 3, POLL_FOREVER)==3);
+	ASSERT(hup[0].revents==(POLLIN|POLLHUP));
+	ASSERT(hup[1].revents==POLLERR);
+	ASSERT(hup[2].revents==POLLNVAL);
+	Close(p1.read);
+	Close(p2.write);
+
+	/* Streams without readiness support are always ready */
+	Fid_t fn = OpenNull();
+	pollfd nul = { fn, POLLIN|POLLOUT, 0 };
+	ASSERT(Poll(&nul, 1, POLL_FOREVER)==1 && nul.revents==(POLLIN|POLLOUT));
+	Close(fn);
+
+	return 0;
+}
+
+
+BOOT_TEST(test_event_queue,
+	"Test that event queues report the ready streams, in level- and edge-triggered\n"
+	"mode, and drop the streams that are closed."
+	)
+{
+	pipe_t p1, p2;
+	ASSERT(Pipe(&p1)==0);
+	ASSERT(Pipe(&p2)==0);
+
+	Fid_t eq = EventQueue();
+	ASSERT(eq != NOFILE);
+	evq_event ev[4];
+
+	ASSERT(EventCtl(p1.read, EVQ_ADD, p2.read, POLLIN)==-1);
+	ASSERT(EventCtl(eq, EVQ_ADD, eq, POLLIN)==-1);
+	ASSERT(EventCtl(eq, EVQ_DEL, p1.read, 0)==-1);
+	ASSERT(EventWait(p1.read, ev, 4, 0)==-1);
+
+	ASSERT(EventCtl(eq, EVQ_ADD, p1.read, POLLIN)==0);
+	ASSERT(EventCtl(eq, EVQ_ADD, p1.read, POLLIN)==-1);
+	ASSERT(EventCtl(eq, EVQ_ADD, p2.read, POLLIN|EVQ_EDGE)==0);
+	ASSERT(EventCtl(eq, EVQ_ADD, p1.write, POLLOUT)==0);
+
+	/* The write end is ready at once */
+	ASSERT(EventWait(eq, ev, 4, 0)==1);
+	ASSERT(ev[0].fd==p1.write && ev[0].events==POLLOUT);
+	ASSERT(EventCtl(eq, EVQ_DEL, p1.write, 0)==0);
+	ASSERT(EventWait(eq, ev, 4, 20)==0);
+
+	/* Level-triggered streams are reported while they are ready, edge-triggered once */
+	ASSERT(Write(p1.write, "ab", 2)==2);
+	ASSERT(Write(p2.write, "cd", 2)==2);
+	ASSERT(EventWait(eq, ev, 4, 0)==2);
+	ASSERT(ev[0].fd==p1.read && ev[1].fd==p2.read && ev[1].events==POLLIN);
+	ASSERT(EventWait(eq, ev, 4, 0)==1 && ev[0].fd==p1.read);
+
+	ASSERT(Write(p2.write, "e", 1)==1);
+	ASSERT(EventWait(eq, ev, 4, 0)==2);
+
+	char buf[8];
+	ASSERT(Read(p1.read, buf, 8)==2);
+	ASSERT(EventWait(eq, ev, 4, 0)==0);
+
+	/* Sleep until another thread writes, reading the events from the queue */
+	int delayed_write(int argl, void* args)
+	{
+		Mutex mx = MUTEX_INIT;
+		CondVar cv = COND_INIT;
+		Mutex_Lock(&mx);
+		Cond_TimedWait(&mx, &cv, 20);
+		Mutex_Unlock(&mx);
+		return Write(p1.write, "x", 1);
+	}
+	Tid_t t = CreateThread(delayed_write, 0, NULL);
+	pollfd pq = { eq, POLLIN, 0 };
+	ASSERT(Poll(&pq, 1, POLL_FOREVER)==1);
+	ASSERT(Read(eq, (char*)ev, sizeof(ev))==sizeof(evq_event));
+	ASSERT(ev[0].fd==p1.read);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* End of file, and closed streams */
+	Close(p1.write);
+	ASSERT(EventWait(eq, ev, 4, 0)==1 && ev[0].events==(POLLIN|POLLHUP));
+	Close(p1.read);
+	ASSERT(EventWait(eq, ev, 4, 0)==0);
+	ASSERT(EventCtl(eq, EVQ_DEL, p1.read, 0)==-1);
+
+	/* Streams that cannot push their state are polled */
+	Fid_t fn = OpenNull();
+	ASSERT(EventCtl(eq, EVQ_ADD, fn, POLLIN)==0);
+	ASSERT(EventWait(eq, ev, 4, POLL_FOREVER)==1 && ev[0].fd==fn);
+	Close(fn);
+
+	Close(p2.read);
+	Close(p2.write);
+	ASSERT(Close(eq)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_watermarks,
+	"Test that the pipe watermarks delay the wakeups of readers, without losing\n"
+	"data."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	Fid_t fn = OpenNull();
+	ASSERT(SetPipeWatermarks(fn, 0, 0)==-1);
+	Close(fn);
+	ASSERT(SetPipeWatermarks(pipe.read, 2<<20, 0)==-1);
+	ASSERT(SetPipeWatermarks(pipe.write, 0, 2<<20)==-1);
+
+	/* The read end is readable at the high watermark */
+	ASSERT(SetPipeWatermarks(pipe.write, 0, 4)==0);
+	pollfd pfd = { pipe.read, POLLIN, 0 };
+	ASSERT(Write(pipe.write, "ab", 2)==2);
+	ASSERT(Poll(&pfd, 1, 0)==0);
+	ASSERT(Write(pipe.write, "cd", 2)==2);
+	ASSERT(Poll(&pfd, 1, 0)==1 && pfd.revents==POLLIN);
+
+	/* Data below the watermark can still be read, if the reader does not wait */
+	char buf[16];
+	ASSERT(Write(pipe.write, "e", 1)==1);
+	ASSERT(Read(pipe.read, buf, 16)==5);
+	ASSERT(memcmp(buf, "abcde", 5)==0);
+
+	/* A sleeping reader is woken up at the watermark, by writes in small pieces */
+	int delayed_writes(int argl, void* args)
+	{
+		Mutex mx = MUTEX_INIT;
+		CondVar cv = COND_INIT;
+		for(int i=0; i<4; i++) {
+			Mutex_Lock(&mx);
+			Cond_TimedWait(&mx, &cv, 5);
+			Mutex_Unlock(&mx);
+			ASSERT(Write(pipe.write, "x", 1)==1);
+		}
+		return 0;
+	}
+	Tid_t t = CreateThread(delayed_writes, 0, NULL);
+	ASSERT(Read(pipe.read, buf, 16)==4);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* Closing the write end wakes the reader below the watermark */
+	ASSERT(Write(pipe.write, "yz", 2)==2);
+	Close(pipe.write);
+	ASSERT(Poll(&pfd, 1, 0)==1 && pfd.revents==(POLLIN|POLLHUP));
+	ASSERT(Read(pipe.read, buf, 16)==2);
+	ASSERT(Read(pipe.read, buf, 16)==0);
+	Close(pipe.read);
+
+	/* A message pipe rejects watermarks, and its reader takes each message as it arrives */
+	ASSERT(MessagePipe(&pipe, 300)==0);
+	ASSERT(SetPipeWatermarks(pipe.write, 0, 1000)==-1);
+	ASSERT(SetPipeWatermarks(pipe.read, 4, 0)==-1);
+	t = CreateThread(delayed_writes, 0, NULL);
+	for(int i=0; i<4; i++)
+		ASSERT(Read(pipe.read, buf, 16)==1);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	Close(pipe.read);
+	Close(pipe.write);
+
+	/* Batched writers and readers move all the data */
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetPipeCapacity(pipe.read, 4096)==4096);
+	ASSERT(SetPipeWatermarks(pipe.read, 512, 1024)==0);
+	Tid_t w = CreateThread(pattern_writer, 100000, &pipe.write);
+	ASSERT(pattern_check(pipe.read)==100000);
+	ASSERT(ThreadJoin(w, NULL)==0);
+	Close(pipe.read);
+
+	return 0;
+}
+
+
+BOOT_TEST(test_message_pipe,
+	"Test that message pipes preserve the boundaries of messages, and that the\n"
+	"messages of many writers do not interleave."
+	)
+{
+	pipe_t pipe;
+	ASSERT(MessagePipe(&pipe, 0)==-1);
+	ASSERT(MessagePipe(&pipe, 2<<20)==-1);
+	ASSERT(MessagePipe(&pipe, 300)==0);
+
+	/* Each read returns one message */
+	char buf[400];
+	ASSERT(Write(pipe.write, "hello", 5)==5);
+	ASSERT(Write(pipe.write, "", 0)==0);
+	ASSERT(Write(pipe.write, "world!", 6)==6);
+	ASSERT(Write(pipe.write, buf, 301)==-1);
+
+	unsigned int r, w;
+	ASSERT(Available(pipe.read, &r, &w)==0 && r==5);
+	ASSERT(Read(pipe.read, buf, 4)==-1);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==5 && memcmp(buf, "hello", 5)==0);
+
+	/* Scattered and gathered messages */
+	iovec_t iov[2] = { { buf, 3 }, { buf+10, 10 } };
+	ASSERT(ReadV(pipe.read, iov, 2)==6);
+	ASSERT(memcmp(buf, "wor", 3)==0 && memcmp(buf+10, "ld!", 3)==0);
+	iovec_t wiov[2] = { { "ab", 2 }, { "cde", 3 } };
+	ASSERT(WriteV(pipe.write, wiov, 2)==5);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==5 && memcmp(buf, "abcde", 5)==0);
+
+	/* 
+		A message pipe has no watermarks: a reader takes each message as soon
+		as it arrives, even while the writer waits for space for the next one.
+	 */
+	ASSERT(SetPipeWatermarks(pipe.write, 0, 1000)==-1);
+	ASSERT(SetPipeWatermarks(pipe.read, 0, 1000)==-1);
+	int msg_burst(int argl, void* args)
+	{
+		char msg[300];
+		memset(msg, 'm', sizeof(msg));
+		ASSERT(Write(pipe.write, msg, 100)==100);
+		ASSERT(Write(pipe.write, msg, 250)==250);
+		ASSERT(Write(pipe.write, msg, 300)==300);
+		return 0;
+	}
+	Tid_t tm = CreateThread(msg_burst, 0, NULL);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==100);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==250);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==300);
+	ASSERT(ThreadJoin(tm, NULL)==0);
+
+	/* A message pipe does not take a capacity too small for its messages, or splicing */
+	ASSERT(SetPipeCapacity(pipe.read, 300)==-1);
+	pipe_t p2;
+	ASSERT(Pipe(&p2)==0);
+	ASSERT(Splice(pipe.read, p2.write, 10)==-1);
+	ASSERT(Splice(p2.read, pipe.write, 10)==-1);
+	Close(p2.read);
+	Close(p2.write);
+
+	/* Many writers, each writing messages filled with its own number */
+	const int W = 4, M = 200;
+	int msg_writer(int argl, void* args)
+	{
+		char msg[300];
+		for(int i=0; i<M; i++) {
+			int len = (argl*31 + i*17) % 300 + 1;
+			memset(msg, argl, len);
+			ASSERT(Write(pipe.write, msg, len)==len);
+		}
+		return 0;
+	}
+	Tid_t t[W];
+	for(int i=0; i<W; i++)
+		t[i] = CreateThread(msg_writer, i+1, NULL);
+
+	int count[W+1];
+	memset(count, 0, sizeof(count));
+	for(int k=0; k<W*M; k++) {
+		int len = Read(pipe.read, buf, sizeof(buf));
+		ASSERT(len > 0 && buf[0] >= 1 && buf[0] <= W);
+		int id = buf[0];
+		ASSERT(len == (id*31 + count[id]*17) % 300 + 1);
+		for(int i=1; i<len; i++)
+			ASSERT(buf[i]==id);
+		count[id]++;
+	}
+	for(int i=0; i<W; i++)
+		ASSERT(ThreadJoin(t[i], NULL)==0);
+
+	/* End of file */
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==0);
+	Close(pipe.read);
+	return 0;
+}
+
+
+BOOT_TEST(test_broadcast_pipe,
+	"Test that every reader of a broadcast pipe reads all the data, and that slow\n"
+	"readers block the writer, or skip data, according to the mode."
+	)
+{
+	pipe_t pipe;
+	ASSERT(BroadcastPipe(&pipe, 100, BCAST_BLOCK)==-1);
+	ASSERT(BroadcastPipe(&pipe, 0, 7)==-1);
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(BroadcastReader(pipe.read)==NOFILE);
+	Close(pipe.read);
+	Close(pipe.write);
+
+	/* Each reader reads the data written after it was opened */
+	ASSERT(BroadcastPipe(&pipe, 512, BCAST_BLOCK)==0);
+	char buf[1024];
+	ASSERT(Write(pipe.write, "hello", 5)==5);
+	Fid_t r2 = BroadcastReader(pipe.write);
+	ASSERT(r2!=NOFILE);
+	ASSERT(Write(pipe.write, "world", 5)==5);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==10 && memcmp(buf, "helloworld", 10)==0);
+	ASSERT(Read(r2, buf, sizeof(buf))==5 && memcmp(buf, "world", 5)==0);
+	ASSERT(Read(pipe.write, buf, 1)==-1);
+	ASSERT(Write(r2, buf, 1)==-1);
+
+	/* The slowest reader holds the writer back */
+	unsigned int r, w;
+	memset(buf, 'x', sizeof(buf));
+	ASSERT(Write(pipe.write, buf, 1000)==512);
+	ASSERT(Available(pipe.write, &r, &w)==0 && w==0);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==512);
+	ASSERT(Available(pipe.write, &r, &w)==0 && w==0);
+	ASSERT(SetNonBlocking(pipe.write, 1)==0);
+	ASSERT(Write(pipe.write, buf, 1)==WOULDBLOCK);
+	ASSERT(Read(r2, buf, 100)==100);
+	ASSERT(Write(pipe.write, buf, 200)==100);
+	ASSERT(SetNonBlocking(pipe.write, 0)==1);
+
+	/* ... until it goes away */
+	ASSERT(Close(r2)==0);
+	ASSERT(Available(pipe.write, &r, &w)==0 && w==412);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==100);
+
+	/* Many readers, at their own pace */
+	const int R = 3, N = 200000;
+	Fid_t rd[R];
+	Tid_t t[R];
+	rd[0] = pipe.read;
+	for(int i=1; i<R; i++) {
+		rd[i] = BroadcastReader(pipe.read);
+		ASSERT(rd[i]!=NOFILE);
+	}
+	int bcast_reader(int argl, void* args)
+	{
+		ASSERT(pattern_check(argl)==N);
+		return 0;
+	}
+	for(int i=0; i<R; i++)
+		t[i] = CreateThread(bcast_reader, rd[i], NULL);
+	Tid_t wt = CreateThread(pattern_writer, N, &pipe.write);
+	ASSERT(ThreadJoin(wt, NULL)==0);
+	for(int i=0; i<R; i++) {
+		ASSERT(ThreadJoin(t[i], NULL)==0);
+		Close(rd[i]);
+	}
+
+	/* A writer that skips slow readers does not block */
+	ASSERT(BroadcastPipe(&pipe, 512, BCAST_SKIP)==0);
+	for(int i=0; i<4; i++) {
+		memset(buf, 'a'+i, 300);
+		ASSERT(Write(pipe.write, buf, 300)==300);
+	}
+	ASSERT(Available(pipe.read, &r, &w)==0 && r==512);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==512);
+	ASSERT(buf[0]=='c' && buf[211]=='c' && buf[212]=='d' && buf[511]=='d');
+	ASSERT(Write(pipe.write, buf, 1000)==512);
+
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==512);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==0);
+	ASSERT(BroadcastReader(pipe.read)==NOFILE);
+	Close(pipe.read);
+	return 0;
+}
+
+
+BOOT_TEST(test_io_ring,
+	"Test that an I/O ring keeps many requests in flight, completes them as their\n"
+	"streams become ready, and cancels them when it is closed."
+	)
+{
+	io_ring* ring;
+	ASSERT(IoRingSetup(0, &ring)==NOFILE);
+	ASSERT(IoRingSetup(3, &ring)==NOFILE);
+	ASSERT(IoRingSetup(2*MAX_IORING_ENTRIES, &ring)==NOFILE);
+	ASSERT(IoRingSetup(4, NULL)==NOFILE);
+	Fid_t rfd = IoRingSetup(128, &ring);
+	ASSERT(rfd!=NOFILE);
+	ASSERT(ring->sq_entries==128 && ring->cq_entries==256);
+	ASSERT(IoRingEnter(77, 0, 0, 0)==-1);
+
+	/* Requests that complete at once */
+	io_sqe sqe = { IO_NOP, .user_data = 1 };
+	io_cqe cqe;
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	sqe = (io_sqe){ IO_READ, 77, .user_data = 2 };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	sqe = (io_sqe){ IO_READ, rfd, .user_data = 3 };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	sqe = (io_sqe){ IO_CONNECT, 0, .port = 100, .timeout = 1000, .user_data = 4 };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 8, 4, 0)==4);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.user_data==1 && cqe.result==0);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.user_data==2 && cqe.result==-1);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.user_data==3 && cqe.result==-1);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.user_data==4 && cqe.result==-1);
+	ASSERT(IoRingPop(ring, &cqe)==-1);
+
+	/* Many pending reads, completed as a writer fills their pipes */
+	const int P = 100;
+	pipe_t pipes[P];
+	int bufs[P];
+	for(int i=0; i<P; i++) {
+		ASSERT(Pipe(&pipes[i])==0);
+		sqe = (io_sqe){ IO_READ, pipes[i].read, &bufs[i], sizeof(int), .user_data = i };
+		ASSERT(IoRingPush(ring, &sqe)==0);
+	}
+	ASSERT(IoRingEnter(rfd, P, 0, 0)==P);
+	ASSERT(IoRingPop(ring, &cqe)==-1);
+
+	int ring_writer(int argl, void* args)
+	{
+		for(int i=P-1; i>=0; i--)
+			ASSERT(Write(pipes[i].write, (char*)&i, sizeof(int))==sizeof(int));
+		return 0;
+	}
+	Tid_t t = CreateThread(ring_writer, 0, NULL);
+	ASSERT(IoRingEnter(rfd, 0, P, POLL_FOREVER)==0);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	int done[P];
+	memset(done, 0, sizeof(done));
+	for(int i=0; i<P; i++) {
+		ASSERT(IoRingPop(ring, &cqe)==0);
+		ASSERT(cqe.result==sizeof(int) && bufs[cqe.user_data]==cqe.user_data);
+		done[cqe.user_data]++;
+	}
+	ASSERT(IoRingPop(ring, &cqe)==-1);
+	for(int i=0; i<P; i++) {
+		ASSERT(done[i]==1);
+		Close(pipes[i].write);
+	}
+
+	/* A write that fits completes at once; a read of an empty pipe times out */
+	sqe = (io_sqe){ IO_WRITE, pipes[0].read, "hello", 5 };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 1, 0)==1);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.result==-1);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	sqe = (io_sqe){ IO_WRITE, pipe.write, "hello", 5, .user_data = 5 };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 0, 0)==1);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.user_data==5 && cqe.result==5);
+
+	char buf[16];
+	sqe = (io_sqe){ IO_READ, pipe.read, buf, sizeof(buf), .user_data = 6 };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 1, 0)==1);
+	ASSERT(IoRingPop(ring, &cqe)==0 && cqe.user_data==6 && cqe.result==5);
+	ASSERT(memcmp(buf, "hello", 5)==0);
+
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 1, 20)==1);
+	ASSERT(IoRingPop(ring, &cqe)==-1);
+
+	/* Closing the ring cancels the pending read, and releases its stream */
+	for(int i=0; i<P; i++)
+		Close(pipes[i].read);
+	Close(pipe.read);
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(Close(rfd)==0);
+	ASSERT(Write(pipe.write, "x", 1)==-1);
+	Close(pipe.write);
+
+	/* Requests are not taken, when their completions may not fit */
+	rfd = IoRingSetup(2, &ring);
+	ASSERT(rfd!=NOFILE);
+	sqe = (io_sqe){ IO_NOP };
+	for(int k=0; k<2; k++) {
+		ASSERT(IoRingPush(ring, &sqe)==0);
+		ASSERT(IoRingPush(ring, &sqe)==0);
+		ASSERT(IoRingPush(ring, &sqe)==-1);
+		ASSERT(IoRingEnter(rfd, 2, 0, 0)==2);
+	}
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 2, 0, 0)==0);
+	ASSERT(IoRingPop(ring, &cqe)==0);
+	ASSERT(IoRingEnter(rfd, 2, 0, 0)==1);
+
+	/* The kernel ignores the sizes in the shared block, and rejects bad indices */
+	ring->cq_entries = 1000;
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 0, 0)==0);
+	ring->cq_entries = 4;
+	ring->sq_tail += 100;
+	ASSERT(IoRingEnter(rfd, 1, 0, 0)==-1);
+	ring->sq_tail -= 100;
+	ring->cq_head -= 100;
+	ASSERT(IoRingEnter(rfd, 1, 0, 0)==-1);
+	ring->cq_head += 100;
+	while(IoRingPop(ring, &cqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 0, 0)==1);
+	ASSERT(IoRingPop(ring, &cqe)==0 && IoRingPop(ring, &cqe)==-1);
+
+	/* A completion that finds the queue overrun is lost, and reported */
+	ASSERT(Pipe(&pipe)==0);
+	sqe = (io_sqe){ IO_READ, pipe.read, buf, sizeof(buf) };
+	ASSERT(IoRingPush(ring, &sqe)==0);
+	ASSERT(IoRingEnter(rfd, 1, 0, 0)==1);
+	ring->cq_head -= ring->cq_entries;
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(IoRingEnter(rfd, 0, 0, 0)==-1);
+	ring->cq_head += ring->cq_entries;
+	ASSERT(IoRingPop(ring, &cqe)==-1);
+	ASSERT(IoRingEnter(rfd, 0, 0, 0)==0);
+	Close(pipe.read);
+	Close(pipe.write);
+	Close(rfd);
+
+	return 0;
+}
+
 
 TEST_SUITE(pipe_tests,
 	"A suite of tests for pipes. We are focusing on correctness, not performance."
@@ -1583,6 +3260,18 @@ TEST_SUITE(pipe_tests,
 	&test_pipe_close_writer,
 	&test_pipe_single_producer,
 	&test_pipe_multi_producer,
+	&test_pipe_wraparound,
+	&test_splice_pipes,
+	&test_pipe_capacity,
+	&test_pipe_shrinks_when_idle,
+	&test_readv_writev,
+	&test_nonblocking_pipe,
+	&test_poll_pipes,
+	&test_event_queue,
+	&test_pipe_watermarks,
+	&test_message_pipe,
+	&test_broadcast_pipe,
+	&test_io_ring,
 	NULL
 };
 